@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../utz.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::vector<char> read_file(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) throw std::runtime_error("Failed to open file: " + filename);
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    std::vector<char> buffer(size);
+    if (!file.read(buffer.data(), size)) throw std::runtime_error("Failed to read file: " + filename);
+    return buffer;
+}
+
+template <typename F>
+static double nanoseconds_per_item(size_t items, F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)items;
+}
+
+// Random UTC timestamps between 1970 and ~2500, most of them land in the rule tail.
+static std::vector<utz_time_t> random_timestamps(size_t count, utz_time_t max, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<utz_time_t> result(count);
+    for (size_t i = 0; i < count; i++)
+        result[i] = (utz_time_t)(rng() % (utz_u64)max);
+    return result;
+}
+
+
+static void bench_startup(std::vector<char>& targz, utz_timezones* tzs)
+{
+    printf("== startup (parse tarball vs load snapshot) ==\n");
+
+    utz_usize size     = utz_write_snapshot(tzs, NULL, 0);
+    void*     snapshot = aligned_alloc(64, (size + 63) / 64 * 64);
+    utz_write_snapshot(tzs, snapshot, size);
+
+    int rounds = 20;
+    double inflate = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            int   tar_size = 0;
+            char* tarball  = utz_zlib_decode_malloc_guesssize_headerflag(targz.data() + 10, (int)targz.size() - 18, 1332000, &tar_size, 0, NULL);
+            free(tarball);
+        }
+    });
+    double parse = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones parsed;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            utz_free_timezones(&parsed);
+        }
+    });
+    double parallel = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones parsed;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_PARALLEL | UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            utz_free_timezones(&parsed);
+        }
+    });
+    double streaming = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones parsed;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_STREAMING | UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            utz_free_timezones(&parsed);
+        }
+    });
+    // Results in one arena and temporaries in another, both freed at once.
+    double arena = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_arena     arena = {};
+            utz_timezones parsed;
+            arena.block_size = 1 << 20;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), utz_arena_userdata(&arena), 2500, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            utz_free_timezones(&parsed, utz_arena_userdata(&arena));
+            utz_free_arena(&arena);
+        }
+    });
+    // Lazy parsing, then what a service touching 20 zones compiles.
+    double lazy = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones parsed;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_LAZY | UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            utz_free_timezones(&parsed);
+        }
+    });
+    double lazy_20 = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones parsed;
+            utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_LAZY | UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX);
+            for (utz_usize i = 0; i < 20; i++)
+                utz_wall_time_from_utc(&parsed.timezones[i * parsed.timezone_count / 20], 0);
+            utz_free_timezones(&parsed);
+        }
+    });
+    double load = nanoseconds_per_item(rounds, [&] {
+        for (int r = 0; r < rounds; r++)
+        {
+            utz_timezones loaded;
+            utz_load_snapshot(&loaded, snapshot, size);
+            utz_free_timezones(&loaded);
+        }
+    });
+    printf("snapshot: %u KB  parse: %8.3f ms  load: %8.3f ms\n", (unsigned)(size / 1024), parse / 1e6, load / 1e6);
+    printf("inflate: %8.3f ms  parallel parse: %8.3f ms  streaming parse: %8.3f ms\n", inflate / 1e6, parallel / 1e6, streaming / 1e6);
+    printf("lazy parse: %8.3f ms  lazy parse + 20 zones: %8.3f ms  arena parse: %8.3f ms\n", lazy / 1e6, lazy_20 / 1e6, arena / 1e6);
+    free(snapshot);
+
+    // Where one parse spends its time.
+    const char* phase_names[UTZ_PARSE_PHASE_COUNT] = { "inflate", "tar", "tokenize", "rules", "ranges", "links", "countries" };
+    utz_parse_stats stats = {};
+    utz_timezones   parsed;
+    utz_parse_iana_tzdb_targz(&parsed, targz.data(), (int)targz.size(), NULL, 2500, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX, &stats);
+    utz_free_timezones(&parsed);
+    for (int phase = 0; phase < UTZ_PARSE_PHASE_COUNT; phase++)
+        printf("%s: %.3f ms  ", phase_names[phase], stats.phase_nanoseconds[phase] / 1e6);
+    printf("\nrules expanded: %llu  ranges emitted: %llu  kept: %llu  allocations: %llu (%llu KB)\n",
+           (unsigned long long)stats.rules_expanded, (unsigned long long)stats.ranges_emitted, (unsigned long long)stats.ranges,
+           (unsigned long long)stats.allocations, (unsigned long long)(stats.bytes_allocated / 1024));
+}
+
+
+static void bench_find_timezone(utz_timezones* tzs)
+{
+    printf("== timezone by name (all names and links, 1 in 8 unknown) ==\n");
+
+    std::mt19937_64 rng(6);
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        std::string name = tzs->timezones[rng() % tzs->timezone_count].name;
+        if (i % 8 == 0) name += "x";
+        names.push_back(name);
+    }
+
+    // Few enough names to stay in cache, like the zones a server keeps seeing.
+    int rounds = 256;
+    utz_usize found_binary = 0, found_hash = 0;
+    double binary = nanoseconds_per_item(rounds * names.size(), [&] {
+        for (int r = 0; r < rounds; r++)
+            for (const std::string& n : names) found_binary += utz_find_timezone_binary_search(tzs, n.data(), n.size()) != NULL;
+    });
+    double hash = nanoseconds_per_item(rounds * names.size(), [&] {
+        for (int r = 0; r < rounds; r++)
+            for (const std::string& n : names) found_hash += utz_find_timezone(tzs, n.data(), n.size()) != NULL;
+    });
+    printf("binary search: %6.2f ns  perfect hash: %6.2f ns%s\n", binary, hash, found_binary == found_hash ? "" : "  MISMATCH");
+}
+
+
+static void bench_default_tz(utz_timezones* tzs)
+{
+    printf("== default timezone by country code ==\n");
+
+    std::mt19937_64 rng(7);
+    std::vector<const char*> codes;
+    for (size_t i = 0; i < (1 << 20); i++) codes.push_back(tzs->countries[rng() % tzs->country_count].code);
+
+    // What utz_default_tz_for_country used to do.
+    auto linear_scan = [&](const char* code) -> utz_timezone* {
+        for (utz_usize ci = 0; ci < tzs->country_count; ci++)
+            if (!strcmp(tzs->countries[ci].code, code))
+                return tzs->countries[ci].timezone_count ? tzs->countries[ci].timezones[0] : NULL;
+        return NULL;
+    };
+
+    utz_usize sum_scan = 0, sum_table = 0;
+    double scan = nanoseconds_per_item(codes.size(), [&] {
+        for (const char* c : codes) sum_scan += (utz_usize) linear_scan(c);
+    });
+    double table = nanoseconds_per_item(codes.size(), [&] {
+        for (const char* c : codes) sum_table += (utz_usize) utz_default_tz_for_country(tzs, c);
+    });
+    printf("linear scan: %6.2f ns  table: %6.2f ns%s\n", scan, table, sum_scan == sum_table ? "" : "  MISMATCH");
+}
+
+
+static void bench_range_search(utz_timezones* tzs)
+{
+    printf("== range search (random timestamps) ==\n");
+
+    std::vector<utz_time_t> timestamps = random_timestamps(1 << 20, 16725225600LL /* 2500-01-01 */, 1);
+
+    const char* names[] = { "America/New_York", "Europe/Berlin", "Australia/Sydney", "Asia/Tokyo" };
+    for (const char* name : names)
+    {
+        utz_timezone* tz = NULL;
+        for (utz_usize i = 0; i < tzs->timezone_count; i++)
+            if (!strcmp(tzs->timezones[i].name, name)) tz = &tzs->timezones[i];
+        if (!tz) continue;
+
+        utz_usize sum_binary = 0, sum_index = 0, sum_bucket = 0;
+        double binary = nanoseconds_per_item(timestamps.size(), [&] {
+            for (utz_time_t t : timestamps) sum_binary += utz_find_range_binary_search(tz, t);
+        });
+        double index = nanoseconds_per_item(timestamps.size(), [&] {
+            for (utz_time_t t : timestamps) sum_index += utz_find_range_search_index(tz, t);
+        });
+        double bucket = nanoseconds_per_item(timestamps.size(), [&] {
+            for (utz_time_t t : timestamps) sum_bucket += utz_find_range_bucket_index(tz, t);
+        });
+
+        printf("%-20s ranges: %5u  binary search: %6.2f ns  search index: %6.2f ns  buckets: %6.2f ns%s\n",
+               name, (unsigned)tz->range_count, binary, index, bucket,
+               sum_binary == sum_index && sum_binary == sum_bucket ? "" : "  MISMATCH");
+    }
+}
+
+
+static void bench_batch(utz_timezones* tzs, utz_timezones* unindexed)
+{
+    printf("== batch conversion (Australia/Sydney) ==\n");
+
+    utz_timezone* tz    = NULL;
+    utz_timezone* plain = NULL;
+    for (utz_usize i = 0; i < tzs->timezone_count; i++)
+        if (!strcmp(tzs->timezones[i].name, "Australia/Sydney")) tz = &tzs->timezones[i];
+    for (utz_usize i = 0; i < unindexed->timezone_count; i++)
+        if (!strcmp(unindexed->timezones[i].name, "Australia/Sydney")) plain = &unindexed->timezones[i];
+    if (!tz || !plain) return;
+
+    std::vector<utz_time_t> random = random_timestamps(1 << 22, 16725225600LL /* 2500-01-01 */, 2);
+    std::vector<utz_time_t> sorted = random;
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<utz_time_t> out(random.size());
+
+    const char*              labels[] = { "random", "sorted" };
+    std::vector<utz_time_t>* columns[] = { &random, &sorted };
+    for (int c = 0; c < 2; c++)
+    {
+        std::vector<utz_time_t>& in = *columns[c];
+        double single = nanoseconds_per_item(in.size(), [&] {
+            for (size_t i = 0; i < in.size(); i++) out[i] = utz_wall_time_from_utc(tz, in[i]);
+        });
+        double batch = nanoseconds_per_item(in.size(), [&] {
+            utz_wall_time_from_utc_batch(tz, in.data(), out.data(), in.size());
+        });
+        printf("%-8s per element: %6.2f ns  batch: %6.2f ns\n", labels[c], single, batch);
+    }
+
+    // The kernels are for zones without a bucket index, against the search they replace. Timestamps in the tail would
+    // only measure utz_fix_tail, so these are all before it.
+    std::vector<utz_time_t> ranged = random_timestamps(1 << 22, tz->range_since[tz->range_count - 1], 7);
+
+    struct { const char* name; utz_wall_time_kernel* kernel; utz_bool supported; } kernels[] = {
+        { "scalar", utz_wall_time_from_utc_scalar, 1 },
+#ifdef UTZ_SIMD_DISPATCH
+        { "avx2",   utz_wall_time_from_utc_avx2,   utz_cpu_supports(false) },
+        { "avx512", utz_wall_time_from_utc_avx512, utz_cpu_supports(true)  },
+#endif
+    };
+    for (auto& k : kernels)
+    {
+        if (!k.supported) continue;
+        double t = nanoseconds_per_item(ranged.size(), [&] { k.kernel(plain, ranged.data(), out.data(), ranged.size()); });
+        printf("ranges   %-6s kernel: %6.2f ns\n", k.name, t);
+    }
+}
+
+
+static void bench_rows(const char* label, std::vector<utz_timezone*>& row_zones, std::vector<utz_time_t>& utc)
+{
+    size_t count = row_zones.size();
+    std::vector<utz_time_t> out(count);
+
+    double single = nanoseconds_per_item(count, [&] {
+        for (size_t i = 0; i < count; i++) out[i] = utz_wall_time_from_utc(row_zones[i], utc[i]);
+    });
+    double multi = nanoseconds_per_item(count, [&] {
+        utz_wall_time_from_utc_multi(row_zones.data(), utc.data(), out.data(), count);
+    });
+    printf("%-10s row by row: %6.2f ns  multi: %6.2f ns\n", label, single, multi);
+}
+
+static void bench_multi(utz_timezones* tzs, utz_timezones* unindexed)
+{
+    printf("== mixed zones (zipf over all zones with and without indices, and a few zones searched over ranges) ==\n");
+
+    // Real traffic is dominated by a few zones with a long tail, weight zone k by 1 / (k + 1).
+    // Both databases have their zones in the same order, so both get the same rows.
+    std::mt19937_64 rng(3);
+    std::vector<utz_usize> zones;
+    for (utz_usize i = 0; i < tzs->timezone_count; i++) zones.push_back(i);
+    std::shuffle(zones.begin(), zones.end(), rng);
+
+    std::vector<double> weights;
+    for (size_t k = 0; k < zones.size(); k++) weights.push_back(1.0 / (double)(k + 1));
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+    size_t count = 1 << 22;
+    std::vector<utz_usize> rows(count);
+    for (size_t i = 0; i < count; i++) rows[i] = zones[pick(rng)];
+    std::vector<utz_time_t> utc = random_timestamps(count, 16725225600LL /* 2500-01-01 */, 4);
+
+    std::vector<utz_timezone*> row_zones(count);
+    for (size_t i = 0; i < count; i++) row_zones[i] = &tzs->timezones[rows[i]];
+    bench_rows("zipf", row_zones, utc);
+    for (size_t i = 0; i < count; i++) row_zones[i] = &unindexed->timezones[rows[i]];
+    bench_rows("zipf plain", row_zones, utc);
+
+    // The zones with the most ranges, without indices so that groups go through the kernels.
+    std::vector<utz_timezone*> plain;
+    for (utz_usize i = 0; i < unindexed->timezone_count; i++) plain.push_back(&unindexed->timezones[i]);
+    std::sort(plain.begin(), plain.end(), [](utz_timezone* a, utz_timezone* b) { return a->range_count > b->range_count; });
+    plain.resize(4);
+
+    utz_time_t until = plain[0]->range_since[plain[0]->range_count - 1];
+    for (utz_timezone* tz : plain) until = std::min(until, tz->range_since[tz->range_count - 1]);
+    utc = random_timestamps(count, until, 5);
+    for (size_t i = 0; i < count; i++) row_zones[i] = plain[rng() % plain.size()];
+    bench_rows("4 zones", row_zones, utc);
+}
+
+
+static void bench_cursor(utz_timezones* tzs)
+{
+    printf("== streaming log (Australia/Sydney, a few seconds between lines) ==\n");
+
+    utz_timezone* tz = NULL;
+    for (utz_usize i = 0; i < tzs->timezone_count; i++)
+        if (!strcmp(tzs->timezones[i].name, "Australia/Sydney")) tz = &tzs->timezones[i];
+    if (!tz) return;
+
+    std::mt19937_64 rng(5);
+    size_t count = 1 << 22;
+    std::vector<utz_time_t> lines(count);
+    utz_time_t t = 1700000000;
+    for (size_t i = 0; i < count; i++) lines[i] = (t += (utz_time_t)(rng() % 8));
+
+    utz_time_t sum_lookup = 0, sum_cursor = 0;
+    double lookup = nanoseconds_per_item(count, [&] { for (utz_time_t x : lines) sum_lookup += utz_wall_time_from_utc(tz, x); });
+    double cursor = nanoseconds_per_item(count, [&] {
+        utz_cursor c;
+        utz_cursor_init(&c, tz);
+        for (utz_time_t x : lines) sum_cursor += utz_cursor_wall_time_from_utc(&c, x);
+    });
+    printf("utc  -> wall  lookup: %6.2f ns  cursor: %6.2f ns%s\n", lookup, cursor, sum_lookup == sum_cursor ? "" : "  MISMATCH");
+
+    sum_lookup = sum_cursor = 0;
+    lookup = nanoseconds_per_item(count, [&] { for (utz_time_t x : lines) sum_lookup += utz_utc_from_wall_time(tz, x).closest_valid; });
+    cursor = nanoseconds_per_item(count, [&] {
+        utz_cursor c;
+        utz_cursor_init(&c, tz);
+        for (utz_time_t x : lines) sum_cursor += utz_cursor_utc_from_wall_time(&c, x).closest_valid;
+    });
+    printf("wall -> utc   lookup: %6.2f ns  cursor: %6.2f ns%s\n", lookup, cursor, sum_lookup == sum_cursor ? "" : "  MISMATCH");
+}
+
+
+int main(int argc, char** argv)
+{
+    std::vector<char> file = read_file("tzdata2023c.tar.gz");
+
+    utz_timezones tzs;
+    if (!utz_parse_iana_tzdb_targz(&tzs, file.data(), (int)file.size(), NULL, 2500, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX))
+    {
+        printf("ERROR: %s", tzs.parsing_error);
+        return 1;
+    }
+
+    // The same zones without indices, for the searches that the indices replace.
+    utz_timezones unindexed;
+    if (!utz_parse_iana_tzdb_targz(&unindexed, file.data(), (int)file.size()))
+    {
+        printf("ERROR: %s", unindexed.parsing_error);
+        return 1;
+    }
+
+    bench_startup(file, &tzs);
+    bench_find_timezone(&tzs);
+    bench_default_tz(&tzs);
+    bench_range_search(&tzs);
+    bench_batch(&tzs, &unindexed);
+    bench_multi(&tzs, &unindexed);
+    bench_cursor(&tzs);
+
+    utz_free_timezones(&unindexed);
+    utz_free_timezones(&tzs);
+    return 0;
+}
@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../utz.h"
 
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <random>
 
 std::vector<char> readFileToVector(const std::string& filename) {
     // Open the file in binary mode
@@ -33,6 +38,1157 @@ std::vector<char> readFileToVector(const std::string& filename) {
     return buffer;
 }
 
+// Checks that both zones convert UTC and wall times the same, around every change of `a` and every ~11 days until 2200.
+// Returns the first time they don't, or -1. Counts the times checked in *checks.
+utz_time_t firstDifference(utz_timezone* a, utz_timezone* b, long long* checks)
+{
+    std::vector<utz_time_t> times;
+    for (int j = 1; j < a->range_count; j++)
+        for (utz_time_t delta = -7200; delta <= 7200; delta += 1800)
+            times.push_back(a->range_since[j] + delta);
+    for (utz_time_t t = 0; t < 7258118400LL; t += 999983)
+        times.push_back(t);
+
+    for (utz_time_t t : times)
+    {
+        if (t < 0) continue;
+        (*checks)++;
+
+        utz_conversion x = utz_utc_from_wall_time(a, t);
+        utz_conversion y = utz_utc_from_wall_time(b, t);
+        if (utz_wall_time_from_utc(a, t) != utz_wall_time_from_utc(b, t) ||
+            x.status != y.status || x.earlier != y.earlier || x.later != y.later || x.closest_valid != y.closest_valid)
+            return t;
+    }
+    return -1;
+}
+
+// Every zone loaded from the TZif files zic made out of the same tarball (`make zoneinfo`) has to convert like the parsed one.
+// Returns the number of mismatches, or -1 if the zoneinfo tree isn't there.
+int testTzifLoader(utz_timezones* tzs, const char* directory)
+{
+    std::string probe = std::string(directory) + "/UTC";
+    if (!std::ifstream(probe).is_open()) return -1;
+
+    utz_timezones loaded;
+    if (!utz_load_tzif_directory(&loaded, directory, NULL, 0))
+    {
+        printf("ERROR: %s", loaded.parsing_error);
+        utz_free_timezones(&loaded);
+        return 1;
+    }
+
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* parsed = &tzs->timezones[i];
+        utz_timezone* tzif   = utz_find_timezone(&loaded, parsed->name, strlen(parsed->name));
+        utz_time_t    at     = tzif ? firstDifference(parsed, tzif, &checks) : 0;
+        if (at >= 0)
+        {
+            printf("TZIF: %s converts %lld differently\n", parsed->name, (long long)at);
+            mismatches++;
+        }
+    }
+
+    // Only the zones asked for.
+    const char* names[] = { "Europe/Zagreb", "America/New_York" };
+    utz_timezones some;
+    if (!utz_load_tzif_directory(&some, directory, names, 2) || some.timezone_count != 2 ||
+        !utz_find_timezone(&some, "Europe/Zagreb", 13) || utz_find_timezone(&some, "Europe/Berlin", 13))
+    {
+        printf("TZIF: loading only some zones doesn't work\n");
+        mismatches++;
+    }
+    utz_free_timezones(&some);
+
+    printf("TZIF: %d zones, %lld checks, %d mismatches\n", (int)loaded.timezone_count, checks, mismatches);
+    utz_free_timezones(&loaded);
+    return mismatches;
+}
+
+// Every zone written as TZif and read back has to convert like the original.
+// Also checks the parts of the file a libc reads, which the round trip alone wouldn't notice.
+int testTzifRoundTrip(utz_timezones* tzs)
+{
+    std::vector<std::vector<char>> buffers(tzs->timezone_count);
+    std::vector<utz_tzif_file>     files;
+    int mismatches = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone*      tz     = &tzs->timezones[i];
+        std::vector<char>& buffer = buffers[i];
+
+        buffer.resize(utz_write_tzif(tz, NULL, 0));
+        if (buffer.empty() || utz_write_tzif(tz, buffer.data(), buffer.size()) != buffer.size())
+        {
+            printf("TZIF: can't write %s\n", tz->name);
+            mismatches++;
+            continue;
+        }
+
+        // Magic, a version, the 32 bit block, and a POSIX TZ string between newlines at the end.
+        bool well_formed = buffer.size() > 2 * 44 && memcmp(buffer.data(), "TZif", 4) == 0 &&
+                           (buffer[4] == '2' || buffer[4] == '3') && buffer.back() == '\n' &&
+                           std::string(buffer.begin(), buffer.end() - 1).rfind('\n') != std::string::npos;
+        if (!well_formed)
+        {
+            printf("TZIF: %s isn't a well formed TZif file\n", tz->name);
+            mismatches++;
+        }
+        files.push_back({ tz->name, buffer.data(), buffer.size() });
+    }
+
+    utz_timezones loaded;
+    if (!utz_load_tzif(&loaded, files.data(), files.size()))
+    {
+        printf("ERROR: %s", loaded.parsing_error);
+        utz_free_timezones(&loaded);
+        return mismatches + 1;
+    }
+
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* original = &tzs->timezones[i];
+        utz_timezone* read     = utz_find_timezone(&loaded, original->name, strlen(original->name));
+        utz_time_t    at       = read ? firstDifference(original, read, &checks) : 0;
+        if (at >= 0)
+        {
+            printf("TZIF ROUND TRIP: %s converts %lld differently\n", original->name, (long long)at);
+            mismatches++;
+        }
+    }
+
+    printf("TZIF ROUND TRIP: %d zones, %lld checks, %d mismatches\n", (int)files.size(), checks, mismatches);
+    utz_free_timezones(&loaded);
+    return mismatches;
+}
+
+// Zones of UTZ_PARSE_LAZY have to compile to the same thing, also when threads race to compile them.
+int testLazyParse(utz_timezones* tzs, std::vector<char>& file)
+{
+    utz_timezones lazy;
+    if (!utz_parse_iana_tzdb_targz(&lazy, file.data(), (int)file.size(), NULL, 2500, UTZ_PARSE_LAZY))
+    {
+        printf("ERROR: %s", lazy.parsing_error);
+        utz_free_timezones(&lazy);
+        return 1;
+    }
+
+    int mismatches = 0;
+    if (lazy.timezone_count != tzs->timezone_count) mismatches++;
+    for (int i = 0; i < lazy.timezone_count; i++)
+        if (lazy.timezones[i].range_count != 0 || lazy.timezones[i].lazy_state != UTZ_LAZY_PENDING) mismatches++;
+
+    // Only what's looked up gets compiled, a link compiles its zone too.
+    utz_timezone* link = utz_find_timezone(&lazy, "Europe/Ljubljana", 16);
+    int compiled = 0;
+    for (int i = 0; i < lazy.timezone_count; i++) compiled += lazy.timezones[i].lazy_state == UTZ_LAZY_COMPILED;
+    if (!link || !link->alias_of || link->range_count == 0 || compiled != 2) mismatches++;
+
+    // Every thread converts with every zone, starting at a different one.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&lazy, t]
+        {
+            for (int i = 0; i < lazy.timezone_count; i++)
+                utz_wall_time_from_utc(&lazy.timezones[(i + t * 97) % lazy.timezone_count], 1700000000);
+        });
+    for (std::thread& thread : threads) thread.join();
+
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count && i < lazy.timezone_count; i++)
+    {
+        utz_timezone* eager = &tzs->timezones[i];
+        utz_timezone* tz    = &lazy.timezones[i];
+        if (strcmp(eager->name, tz->name) || firstDifference(eager, tz, &checks) >= 0 || tz->compile_error)
+        {
+            printf("LAZY: %s converts differently\n", eager->name);
+            mismatches++;
+        }
+    }
+
+    printf("LAZY: %d zones, %lld checks, %d mismatches\n", (int)lazy.timezone_count, checks, mismatches);
+    utz_free_timezones(&lazy);
+    return mismatches;
+}
+
+// UTZ_PARSE_PARALLEL and UTZ_PARSE_STREAMING have to end up with the same zones, links and ranges as a default parse,
+// and so does parsing into an arena.
+int testParseWithFlags(utz_timezones* tzs, std::vector<char>& file, unsigned flags, const char* label, void* allocator_userdata = NULL)
+{
+    utz_timezones parsed;
+    if (!utz_parse_iana_tzdb_targz(&parsed, file.data(), (int)file.size(), allocator_userdata, 2500, flags))
+    {
+        printf("ERROR: %s", parsed.parsing_error);
+        utz_free_timezones(&parsed, allocator_userdata);
+        return 1;
+    }
+
+    // Zones of UTZ_PARSE_LAZY are compiled from a couple of threads at once, allocating at the same time.
+    if (flags & UTZ_PARSE_LAZY)
+    {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++)
+            threads.emplace_back([&parsed, t]
+            {
+                for (int i = 0; i < parsed.timezone_count; i++)
+                    utz_wall_time_from_utc(&parsed.timezones[(i + t * 97) % parsed.timezone_count], 1700000000);
+            });
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    int mismatches = 0;
+    if (parsed.timezone_count != tzs->timezone_count) mismatches++;
+
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count && i < parsed.timezone_count; i++)
+    {
+        utz_timezone* eager = &tzs->timezones[i];
+        utz_timezone* tz    = &parsed.timezones[i];
+        bool same_alias = !eager->alias_of == !tz->alias_of &&
+                          (!eager->alias_of || !strcmp(eager->alias_of->name, tz->alias_of->name));
+        if (strcmp(eager->name, tz->name) || !same_alias || eager->range_count != tz->range_count ||
+            firstDifference(eager, tz, &checks) >= 0)
+        {
+            printf("%s: %s differs\n", label, eager->name);
+            mismatches++;
+        }
+    }
+
+    // Countries point at the zones of their own copy.
+    for (int i = 0; i < parsed.country_count; i++)
+        for (int j = 0; j < parsed.countries[i].timezone_count; j++)
+        {
+            utz_timezone* tz = parsed.countries[i].timezones[j];
+            if (tz < parsed.timezones || tz >= parsed.timezones + parsed.timezone_count) mismatches++;
+        }
+
+    printf("%s: %d zones, %lld checks, %d mismatches\n", label, (int)parsed.timezone_count, checks, mismatches);
+    utz_free_timezones(&parsed, allocator_userdata);
+    return mismatches;
+}
+
+// Everything in one arena, that's only freed at the end.
+int testArenaParse(utz_timezones* tzs, std::vector<char>& file)
+{
+    int mismatches = 0;
+    struct { unsigned flags; const char* label; } cases[] = {
+        { UTZ_PARSE_DEFAULT,   "ARENA"           },
+        { UTZ_PARSE_LAZY,      "ARENA LAZY"      },
+        { UTZ_PARSE_PARALLEL,  "ARENA PARALLEL"  },
+        { UTZ_PARSE_STREAMING, "ARENA STREAMING" },
+    };
+    for (auto& c : cases)
+    {
+        utz_arena arena = {};
+        arena.block_size = 1 << 20;
+        mismatches += testParseWithFlags(tzs, file, c.flags, c.label, utz_arena_userdata(&arena));
+        utz_free_arena(&arena);
+    }
+
+    utz_arena     arena = {};
+    utz_timezones truncated;
+    if (utz_parse_iana_tzdb_targz(&truncated, file.data(), (int)file.size() / 2, utz_arena_userdata(&arena)) || truncated.timezones)
+    {
+        printf("ARENA: parsed a truncated tarball\n");
+        mismatches++;
+    }
+    utz_free_timezones(&truncated, utz_arena_userdata(&arena));
+    utz_free_arena(&arena);
+
+    // Any other allocator_userdata is ignored by the default allocator, it isn't taken for an arena.
+    mismatches += testParseWithFlags(tzs, file, UTZ_PARSE_DEFAULT, "USERDATA", &arena);
+    return mismatches;
+}
+
+// The counters match what was parsed, and every phase that runs for these flags took some time.
+int testParseStats(utz_timezones* tzs, std::vector<char>& file)
+{
+    unsigned long long zones = 0, links = 0, ranges = 0;
+    for (utz_usize i = 0; i < tzs->timezone_count; i++)
+    {
+        if (tzs->timezones[i].alias_of) links++;
+        else                            zones++, ranges += tzs->timezones[i].range_count;
+    }
+
+    int mismatches = 0;
+    struct { unsigned flags; const char* label; } cases[] = {
+        { UTZ_PARSE_DEFAULT,   "STATS"           },
+        { UTZ_PARSE_PARALLEL,  "STATS PARALLEL"  },
+        { UTZ_PARSE_STREAMING, "STATS STREAMING" },
+        { UTZ_PARSE_LAZY,      "STATS LAZY"      },
+    };
+    for (auto& c : cases)
+    {
+        std::atomic<int> traced(0);
+        utz_parse_stats  stats = {};
+        stats.trace_userdata = &traced;
+        stats.trace = [](void* userdata, utz_parse_phase, const char*, utz_usize, utz_u64) { (*(std::atomic<int>*)userdata)++; };
+
+        utz_timezones parsed;
+        if (!utz_parse_iana_tzdb_targz(&parsed, file.data(), (int)file.size(), NULL, 2500, c.flags, &stats))
+        {
+            printf("%s: %s\n", c.label, parsed.parsing_error);
+            mismatches++;
+            continue;
+        }
+
+        bool lazy = c.flags & UTZ_PARSE_LAZY;
+        for (int phase = 0; phase < UTZ_PARSE_PHASE_COUNT; phase++)
+        {
+            bool ran = !(phase == UTZ_PARSE_PHASE_TAR && (c.flags & UTZ_PARSE_STREAMING)) &&
+                       !(lazy && (phase == UTZ_PARSE_PHASE_RULES || phase == UTZ_PARSE_PHASE_RANGES));
+            if ((stats.phase_nanoseconds[phase] > 0) != ran) mismatches++;
+        }
+
+        unsigned long long file_zones = 0;
+        for (utz_usize i = 0; i < stats.file_count; i++) file_zones += stats.files[i].zones;
+
+        if (stats.file_count != 9 || strcmp(stats.files[0].name, "africa")) mismatches++;
+        if (stats.zones != zones || stats.links != links || file_zones != zones) mismatches++;
+        if (stats.ranges != (lazy ? 0 : ranges) || stats.ranges_emitted < stats.ranges) mismatches++;
+        if (!lazy && !stats.rules_expanded) mismatches++;
+        if (!stats.allocations || !stats.bytes_allocated || !stats.total_nanoseconds || !traced) mismatches++;
+
+        printf("%s: %.3f ms, %llu allocations, %d traces, %d mismatches\n", c.label, stats.total_nanoseconds / 1e6,
+               (unsigned long long)stats.allocations, (int)traced, mismatches);
+        utz_free_timezones(&parsed);
+    }
+    return mismatches;
+}
+
+// How days of rules were found before utz_day_rule_days, trying days one by one with the date conversions.
+static bool referenceDayRule(utz_day_rule rule, utz_u32 year, utz_u32 month, utz_time_t* out_date_timestamp)
+{
+    utz_date date = {};
+    date.year  = year;
+    date.month = month;
+
+    if (rule.kind == DAY_RULE_EQUAL_TO_DATE)
+    {
+        date.day = rule.date;
+        return utz_maybe_unix_timestamp_from_utc_date(&date, out_date_timestamp);
+    }
+    else if (rule.kind == DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE)
+    {
+        date.day = rule.date;
+
+        utz_time_t t = 0;
+        if (!utz_maybe_unix_timestamp_from_utc_date(&date, &t))
+            return false;
+
+        for (utz_usize i = 0; i < 7; i++)
+        {
+            utz_time_t offseted = t + i * 24 * 60 * 60;
+            utz_date with_weekday  = {};
+            utz_utc_date_from_unix_timestamp(&with_weekday, offseted);
+
+            if (with_weekday.week_day == rule.weekday)
+            {
+                *out_date_timestamp = offseted;
+                return true;
+            }
+        }
+    }
+    else if (rule.kind == DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE)
+    {
+        // Set date.day.
+        // rule.date can be bigger than the maximum date for this month (example: month=Feb, rule.date=31)
+        // If that's the case, seek until we get to the valid end of month.
+        utz_time_t t = 0;
+        bool end_of_month_ok = false;
+        for (utz_usize i = 0; i <= 3; i++) // test 31, 30, 29, 28
+        {
+            date.day = (utz_u32)(rule.date - i);
+            if (utz_maybe_unix_timestamp_from_utc_date(&date, &t))
+            {
+                end_of_month_ok = true;
+                break;
+            }
+        }
+        if (!end_of_month_ok) return false;
+
+        for (utz_usize i = 0; i < 7; i++)
+        {
+            utz_time_t offseted = t - i * 24 * 60 * 60;
+            utz_date with_weekday  = {};
+            utz_utc_date_from_unix_timestamp(&with_weekday, offseted);
+
+            if (with_weekday.week_day == rule.weekday)
+            {
+                *out_date_timestamp = offseted;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Every kind of day rule in every month over three 400 year cycles, the way it's expanded for a span of years.
+int testDayRules()
+{
+    const utz_u32 first_year = 1600, year_count = 1201;
+    std::vector<utz_time_t> days(year_count);
+
+    long long checks = 0;
+    int mismatches = 0;
+    for (utz_u32 month = 1; month <= 12; month++)
+    for (int kind = DAY_RULE_EQUAL_TO_DATE; kind <= DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE; kind++)
+    for (utz_u32 date = 1; date <= 31; date++)
+    for (utz_u32 weekday = 0; weekday < (kind == DAY_RULE_EQUAL_TO_DATE ? 1u : 7u); weekday++)
+    {
+        utz_day_rule rule = {};
+        rule.kind    = (utz_day_rule_kind)kind;
+        rule.date    = date;
+        rule.weekday = weekday;
+
+        // A year the day doesn't exist in ends the span, the rest is expanded from the year after.
+        for (utz_u32 from = 0; from < year_count;)
+        {
+            utz_u32 bad_year = 0;
+            utz_u32 end      = year_count;
+            if (!utz_day_rule_days(rule, month, first_year + from, year_count - from, &days[from], &bad_year))
+                end = bad_year - first_year;
+
+            for (utz_u32 i = from; i <= end && i < year_count; i++, checks++)
+            {
+                utz_time_t expected = 0;
+                bool       ok       = referenceDayRule(rule, first_year + i, month, &expected);
+                if (i == end ? ok : (!ok || days[i] * 24 * 60 * 60 != expected)) mismatches++;
+            }
+            from = end + 1;
+        }
+    }
+
+    printf("DAY RULES: %lld checks, %d mismatches\n", checks, mismatches);
+    return mismatches;
+}
+
+// Every member of the tarball can be found by its name, also the ones utz doesn't parse.
+int testTarIndex(std::vector<char>& file)
+{
+    utz_tarball tarball;
+    if (!utz_open_targz(&tarball, file.data(), (int)file.size()))
+    {
+        printf("TAR: can't open the tarball\n");
+        return 1;
+    }
+
+    int mismatches = 0;
+    for (utz_usize i = 0; i < tarball.member_count; i++)
+    {
+        const utz_tar_member* member = &tarball.members[i];
+        if (utz_find_tar_member(&tarball, member->name, member->name_length) != member) mismatches++;
+    }
+
+    const utz_tar_member* leapseconds = utz_find_tar_member(&tarball, "leapseconds", 11);
+    const utz_tar_member* backward    = utz_find_tar_member(&tarball, "backward", 8);
+    if (!leapseconds || !strstr(std::string(leapseconds->content, leapseconds->size).c_str(), "Leap\t2016\tDec\t31")) mismatches++;
+    if (!backward    || strncmp(backward->content + backward->size - 1, "\n", 1)) mismatches++;
+    if (utz_find_tar_member(&tarball, "leapsecond", 10) || utz_find_tar_member(&tarball, "", 0)) mismatches++;
+
+    printf("TAR: %d members, %d mismatches\n", (int)tarball.member_count, mismatches);
+    utz_free_tarball(&tarball);
+    return mismatches;
+}
+
+// The parallel arrays hold the same ranges as `ranges`, and every abbreviation is stored once per zone.
+int testRangeArrays(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* tz = &tzs->timezones[i];
+        for (int j = 0; j < tz->range_count; j++)
+        {
+            utz_time_range* range = &tz->ranges[j];
+            checks++;
+            if (tz->range_since[j] != range->since || tz->range_offset_seconds[j] != range->offset_seconds ||
+                tz->range_abbreviation_index[j] >= tz->abbreviation_count ||
+                strcmp(tz->abbreviations[tz->range_abbreviation_index[j]], range->zone_abbreviation))
+            {
+                printf("RANGE ARRAYS: %s range %d differs\n", tz->name, j);
+                mismatches++;
+            }
+        }
+
+        for (int a = 0; a < tz->abbreviation_count; a++)
+            for (int b = a + 1; b < tz->abbreviation_count; b++)
+                if (!strcmp(tz->abbreviations[a], tz->abbreviations[b])) mismatches++;
+    }
+
+    printf("RANGE ARRAYS: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// Zones parsed with an index find the same range as a binary search right around every change, and convert the same.
+int testRangeIndex(utz_timezones* tzs, std::vector<char>& file, unsigned flags, const char* label)
+{
+    utz_timezones indexed;
+    if (!utz_parse_iana_tzdb_targz(&indexed, file.data(), (int)file.size(), NULL, 2500, flags))
+    {
+        printf("ERROR: %s", indexed.parsing_error);
+        utz_free_timezones(&indexed);
+        return 1;
+    }
+
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count && i < indexed.timezone_count; i++)
+    {
+        utz_timezone* tz = &indexed.timezones[i];
+        // Buckets only cover times from 0, so zones that stop changing before 1970 go without.
+        bool wants_buckets = tz->range_count > 1 && tz->range_since[tz->range_count - 1] >= 0;
+        if (tz->range_count && (((flags & UTZ_PARSE_SEARCH_INDEX) && !tz->search_index_keys) ||
+                                ((flags & UTZ_PARSE_BUCKET_INDEX) && wants_buckets && !tz->bucket_first_range)))
+        {
+            printf("%s: %s has no index\n", label, tz->name);
+            mismatches++;
+        }
+
+        // Wall times are looked up with bucket_first_wall_range, or searched without it.
+        utz_timezone plain = *tz;
+        plain.bucket_first_wall_range = NULL;
+        for (int j = 1; j < tz->range_count; j++)
+            for (utz_time_t delta = -1; delta <= 1; delta++)
+            {
+                utz_time_t t    = tz->range_since[j] + delta;
+                utz_time_t wall = tz->range_since[j] + tz->range_offset_seconds[j - 1] + delta;
+                if (t < 0 || wall < 0) continue;
+                checks++;
+                if (utz_find_range(tz, t) != utz_find_range_binary_search(tz, t) ||
+                    utz_find_wall_range(tz, wall) != utz_find_wall_range(&plain, wall))
+                {
+                    printf("%s: %s finds the wrong range at %lld\n", label, tz->name, (long long)t);
+                    mismatches++;
+                }
+            }
+
+        if (firstDifference(&tzs->timezones[i], tz, &checks) >= 0)
+        {
+            printf("%s: %s converts differently\n", label, tz->name);
+            mismatches++;
+        }
+    }
+
+    printf("%s: %d zones, %lld checks, %d mismatches\n", label, (int)indexed.timezone_count, checks, mismatches);
+    utz_free_timezones(&indexed);
+    return mismatches;
+}
+
+// utz_utc_from_wall_time the way it was before the wall keyed table, going through the ranges one by one.
+static utz_conversion referenceUtcFromWallTime(utz_timezone* tz, utz_time_t wall_time)
+{
+    if (wall_time < 24 * 60 * 60 || tz->range_count == 0)
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+
+    for (int i = 0; i < tz->range_count; i++)
+    {
+        utz_time_range* current = &tz->ranges[i];
+        utz_time_range* next    = (i + 1 < tz->range_count) ? &tz->ranges[i + 1] : NULL;
+
+        utz_time_t to  = next ? next->since : INT64_MAX;
+        utz_time_t utc = wall_time - current->offset_seconds;
+        if (utc > to) continue;
+
+        if (next && wall_time - next->offset_seconds >= to)
+            return { UTZ_TIMESTAMP_CONVERSION_INPUT_AMBIGUOUS, utc, wall_time - next->offset_seconds, utc };
+
+        if (utc < current->since)
+        {
+            if (i == 0) return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+            return { UTZ_TIMESTAMP_CONVERSION_INPUT_INVALID, utc, wall_time - tz->ranges[i - 1].offset_seconds, current->since };
+        }
+        return { UTZ_TIMESTAMP_CONVERSION_OK, utc, utc, utc };
+    }
+    return {};
+}
+
+// The wall keyed table resolves wall times like going through the ranges, right at both ends of every change.
+// Zones with a tail are only checked up to a day into their last range, after that the tail takes over.
+int testWallTable(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* tz = &tzs->timezones[i];
+        if (!tz->range_count) continue;
+
+        std::vector<utz_time_t> times;
+        for (int j = 1; j < tz->range_count; j++)
+            for (utz_time_t wall : { tz->range_since[j] + tz->range_offset_seconds[j - 1], tz->range_since[j] + tz->range_offset_seconds[j] })
+                for (utz_time_t delta = -1; delta <= 1; delta++)
+                    times.push_back(wall + delta);
+        for (utz_time_t t = 0; t < 7258118400LL; t += 999983)
+            times.push_back(t);
+
+        utz_time_t until = tz->tail_change_count ? tz->range_since[tz->range_count - 1] + 24 * 60 * 60 : INT64_MAX;
+        for (utz_time_t t : times)
+        {
+            if (t < 0 || t >= until) continue;
+            checks++;
+
+            utz_conversion x = utz_utc_from_wall_time(tz, t);
+            utz_conversion y = referenceUtcFromWallTime(tz, t);
+            if (x.status != y.status || x.earlier != y.earlier || x.later != y.later || x.closest_valid != y.closest_valid)
+            {
+                printf("WALL TABLE: %s resolves %lld differently\n", tz->name, (long long)t);
+                mismatches++;
+                break;
+            }
+        }
+
+        for (int j = 1; j < tz->range_count; j++)
+            if (tz->range_wall_until[j] < tz->range_wall_until[j - 1]) mismatches++;
+    }
+
+    printf("WALL TABLE: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// Times to convert with a zone: around every change, every ~11 days until 2200, and random ones until 2500 (in the tail).
+static std::vector<utz_time_t> timesAround(utz_timezone* tz, std::mt19937_64& rng)
+{
+    std::vector<utz_time_t> times;
+    for (int j = 1; j < tz->range_count; j++)
+        for (utz_time_t delta = -7200; delta <= 7200; delta += 1800)
+            times.push_back(tz->range_since[j] + delta);
+    for (utz_time_t t = -86400; t < 7258118400LL; t += 999983)
+        times.push_back(t);
+    for (int k = 0; k < 1000; k++)
+        times.push_back((utz_time_t)(rng() % 16725225600ULL));
+    return times;
+}
+
+// The batch functions convert like one by one, sorted (swept with a cursor) and shuffled (searched, with the kernels).
+int testBatch(utz_timezones* tzs, const char* label)
+{
+    std::mt19937_64 rng(1);
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = -1; i < (int)tzs->timezone_count; i++)
+    {
+        utz_timezone*           tz    = (i < 0) ? NULL : &tzs->timezones[i];
+        std::vector<utz_time_t> times = timesAround(tz ? tz : &tzs->timezones[0], rng);
+        for (int shuffled = 0; shuffled < 2; shuffled++)
+        {
+            if (shuffled) std::shuffle(times.begin(), times.end(), rng);
+            else          std::sort(times.begin(), times.end());
+
+            std::vector<utz_time_t>     wall(times.size());
+            std::vector<utz_conversion> utc(times.size());
+            utz_wall_time_from_utc_batch(tz, times.data(), wall.data(), times.size());
+            utz_utc_from_wall_time_batch(tz, times.data(), utc.data(),  times.size());
+            for (size_t k = 0; k < times.size(); k++)
+            {
+                checks++;
+                utz_conversion x = utz_utc_from_wall_time(tz, times[k]);
+                if (wall[k] != utz_wall_time_from_utc(tz, times[k]) || utc[k].status != x.status || utc[k].earlier != x.earlier ||
+                    utc[k].later != x.later || utc[k].closest_valid != x.closest_valid)
+                {
+                    printf("%s: %s converts %lld differently (%s)\n", label, tz ? tz->name : "UTC", (long long)times[k], shuffled ? "shuffled" : "sorted");
+                    mismatches++;
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("%s: %d zones, %lld checks, %d mismatches\n", label, (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// Every kernel the CPU has converts like one by one (after utz_fix_tail), also for counts that leave a remainder.
+int testKernels(utz_timezones* tzs)
+{
+    struct { const char* name; utz_wall_time_kernel* kernel; bool supported; } kernels[] = {
+        { "scalar", utz_wall_time_from_utc_scalar, true },
+#ifdef UTZ_SIMD_DISPATCH
+        { "avx2",   utz_wall_time_from_utc_avx2,   (bool)utz_cpu_supports(false) },
+        { "avx512", utz_wall_time_from_utc_avx512, (bool)utz_cpu_supports(true)  },
+#endif
+    };
+
+    std::mt19937_64 rng(2);
+    int mismatches = 0;
+    for (auto& k : kernels)
+    {
+        if (!k.supported) continue;
+
+        int       failed = 0;
+        long long checks = 0;
+        for (int i = 0; i < tzs->timezone_count; i++)
+        {
+            utz_timezone* tz = &tzs->timezones[i];
+            if (!tz->range_count) continue;
+
+            std::vector<utz_time_t> times = timesAround(tz, rng);
+            std::shuffle(times.begin(), times.end(), rng);
+            std::vector<utz_time_t> wall(times.size());
+            for (size_t count : { (size_t)1, (size_t)7, (size_t)17, (size_t)33, times.size() })
+            {
+                k.kernel    (tz, times.data(), wall.data(), count);
+                utz_fix_tail(tz, times.data(), wall.data(), count);
+                for (size_t j = 0; j < count; j++)
+                {
+                    checks++;
+                    if (wall[j] != utz_wall_time_from_utc(tz, times[j]))
+                    {
+                        printf("KERNEL %s: %s converts %lld differently\n", k.name, tz->name, (long long)times[j]);
+                        failed++;
+                        break;
+                    }
+                }
+            }
+        }
+        printf("KERNEL %s: %lld checks, %d mismatches\n", k.name, checks, failed);
+        mismatches += failed;
+    }
+    return mismatches;
+}
+
+// Rows of mixed zones convert like one by one: rows over every zone (row by row), rows over a few zones (grouped),
+// and chunks that start with a few zones and then use all of them (grouped, with lots of small groups).
+int testMulti(utz_timezones* tzs)
+{
+    std::mt19937_64 rng(3);
+    std::vector<utz_timezone*> all(1, NULL);
+    for (int i = 0; i < tzs->timezone_count; i++) all.push_back(&tzs->timezones[i]);
+    std::vector<utz_timezone*> few = { NULL, all[1] };
+    for (int i = 0; i < tzs->timezone_count; i++)
+        if (!strcmp(tzs->timezones[i].name, "Europe/Paris") || !strcmp(tzs->timezones[i].name, "America/New_York")) few.push_back(&tzs->timezones[i]);
+
+    int mismatches = 0;
+    long long checks = 0;
+    for (int mix = 0; mix < 3; mix++)
+    {
+        size_t count = 200000;
+        std::vector<utz_timezone*> zones(count);
+        std::vector<utz_time_t>    utc(count);
+        std::vector<utz_time_t>    wall(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::vector<utz_timezone*>& from = (mix == 1 || (mix == 2 && i % 512 < 64)) ? few : all;
+            zones[i] = from[rng() % from.size()];
+            utc[i]   = (utz_time_t)(rng() % 16725225600ULL) - 86400;
+        }
+
+        utz_wall_time_from_utc_multi(zones.data(), utc.data(), wall.data(), count);
+        for (size_t i = 0; i < count; i++)
+        {
+            checks++;
+            if (wall[i] != utz_wall_time_from_utc(zones[i], utc[i]))
+            {
+                printf("MULTI: %s converts %lld differently\n", zones[i] ? zones[i]->name : "UTC", (long long)utc[i]);
+                mismatches++;
+                break;
+            }
+        }
+    }
+
+    printf("MULTI: %lld checks, %d mismatches\n", checks, mismatches);
+    return mismatches;
+}
+
+// A cursor converts like one by one, walking forwards, backwards and jumping around, also a second off every change.
+int testCursor(utz_timezones* tzs)
+{
+    std::mt19937_64 rng(4);
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = -1; i < (int)tzs->timezone_count; i++)
+    {
+        utz_timezone*           tz    = (i < 0) ? NULL : &tzs->timezones[i];
+        std::vector<utz_time_t> times = timesAround(tz ? tz : &tzs->timezones[0], rng);
+        for (int j = 1; tz && j < tz->range_count; j++)
+            for (utz_time_t wall : { tz->range_since[j], tz->range_since[j] + tz->range_offset_seconds[j - 1], tz->range_since[j] + tz->range_offset_seconds[j] })
+                for (utz_time_t delta = -1; delta <= 1; delta++)
+                    times.push_back(wall + delta);
+
+        for (int order = 0; order < 3; order++)
+        {
+            if      (order == 0) std::sort(times.begin(), times.end());
+            else if (order == 1) std::reverse(times.begin(), times.end());
+            else                 std::shuffle(times.begin(), times.end(), rng);
+
+            utz_cursor cursor;
+            utz_cursor_init(&cursor, tz);
+            for (utz_time_t t : times)
+            {
+                checks++;
+                utz_conversion x = utz_cursor_utc_from_wall_time(&cursor, t);
+                utz_conversion y = utz_utc_from_wall_time(tz, t);
+                if (utz_cursor_wall_time_from_utc(&cursor, t) != utz_wall_time_from_utc(tz, t) ||
+                    x.status != y.status || x.earlier != y.earlier || x.later != y.later || x.closest_valid != y.closest_valid)
+                {
+                    printf("CURSOR: %s converts %lld differently\n", tz ? tz->name : "UTC", (long long)t);
+                    mismatches++;
+                    break;
+                }
+            }
+        }
+    }
+
+    printf("CURSOR: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// Zones with a tail change clocks every year until 2500 when the rules say so (days found with referenceDayRule), and the
+// last range starts at one of those changes. Both sides of every change convert to the right offset and back.
+int testTail(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    int tail_zones = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* tz = &tzs->timezones[i];
+        if (!tz->tail_change_count) continue;
+        tail_zones++;
+
+        utz_date   start = {};
+        utz_time_t since = tz->range_since[tz->range_count - 1];
+        utz_utc_date_from_unix_timestamp(&start, since);
+
+        bool starts_at_change = false;
+        for (utz_u32 year = (utz_u32)start.year; year < 2500; year++)
+            for (int c = 0; c < 2; c++)
+            {
+                utz_tail_change* change = &tz->tail_changes[c];
+                utz_tail_change* other  = &tz->tail_changes[1 - c];
+
+                utz_day_rule rule = {};
+                rule.kind    = (utz_day_rule_kind) change->day_kind;
+                rule.date    = change->day;
+                rule.weekday = change->weekday;
+
+                utz_time_t day = 0;
+                if (!referenceDayRule(rule, year, change->month, &day))
+                {
+                    mismatches++;
+                    continue;
+                }
+
+                utz_time_t t = day + change->at_seconds;
+                if (year == (utz_u32)start.year)
+                {
+                    starts_at_change |= (t == since);
+                    continue;
+                }
+
+                checks++;
+                utz_time_t     before      = utz_wall_time_from_utc(tz, t - 1);
+                utz_time_t     after       = utz_wall_time_from_utc(tz, t);
+                utz_conversion back_before = utz_utc_from_wall_time(tz, before);
+                utz_conversion back_after  = utz_utc_from_wall_time(tz, after);
+                if (before != t - 1 + other->offset_seconds || after != t + change->offset_seconds ||
+                    (back_before.earlier != t - 1 && back_before.later != t - 1) || (back_after.earlier != t && back_after.later != t))
+                {
+                    printf("TAIL: %s changes clocks differently at %lld\n", tz->name, (long long)t);
+                    mismatches++;
+                    year = 2500;
+                    break;
+                }
+            }
+
+        if (!starts_at_change)
+        {
+            printf("TAIL: %s doesn't start at a change\n", tz->name);
+            mismatches++;
+        }
+    }
+
+    printf("TAIL: %d zones, %lld checks, %d mismatches\n", tail_zones, checks, mismatches);
+    return mismatches;
+}
+
+// Every zone is of the kind its ranges and tail say, and from the time it settles on converts like searching the ranges.
+int testClassification(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* tz = &tzs->timezones[i];
+        if (!tz->range_count) continue;
+
+        utz_time_t last_since = tz->range_since[tz->range_count - 1];
+        utz_timezone_kind kind = tz->tail_change_count ? UTZ_TIMEZONE_RECURRING
+                               : last_since <= 0       ? UTZ_TIMEZONE_FIXED
+                                                       : UTZ_TIMEZONE_HISTORICAL;
+        if (tz->kind != kind)
+        {
+            printf("CLASSIFICATION: %s has kind %d, expected %d\n", tz->name, (int)tz->kind, (int)kind);
+            mismatches++;
+            continue;
+        }
+        if (kind == UTZ_TIMEZONE_RECURRING)
+        {
+            if (tz->settled_since != INT64_MAX || tz->settled_wall_since != INT64_MAX) mismatches++;
+            continue;
+        }
+        if (tz->settled_offset_seconds != tz->range_offset_seconds[tz->range_count - 1] || tz->settled_since != (last_since > 0 ? last_since : 0))
+        {
+            printf("CLASSIFICATION: %s settles at the wrong time or offset\n", tz->name);
+            mismatches++;
+            continue;
+        }
+
+        // Past the settled times, conversions must agree with searching the ranges.
+        std::vector<utz_time_t> times;
+        for (utz_time_t start : { tz->settled_since, tz->settled_wall_since })
+        {
+            if (start != INT64_MIN)
+                for (utz_time_t delta = -1; delta <= 1; delta++)
+                    times.push_back(start + delta);
+            for (utz_time_t t = (start > 0 ? start : 0); t < 16725225600LL; t += 9999991)
+                times.push_back(t);
+        }
+        for (utz_time_t t : times)
+        {
+            if (t < 0) continue;
+            checks++;
+
+            utz_time_t     wall = utz_wall_time_from_utc(tz, t);
+            utz_conversion x    = utz_utc_from_wall_time(tz, t);
+            utz_conversion y    = referenceUtcFromWallTime(tz, t);
+            if (wall != t + tz->range_offset_seconds[utz_find_range_binary_search(tz, t)] ||
+                x.status != y.status || x.earlier != y.earlier || x.later != y.later || x.closest_valid != y.closest_valid)
+            {
+                printf("CLASSIFICATION: %s converts %lld differently\n", tz->name, (long long)t);
+                mismatches++;
+                break;
+            }
+        }
+    }
+
+    printf("CLASSIFICATION: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// utz_find_timezone finds every zone by its name, and nothing for names that are close to one but aren't.
+int testNameHash(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    if (!tzs->name_hash_seeds)
+    {
+        printf("NAME HASH: no hash\n");
+        return 1;
+    }
+
+    std::vector<std::string> misses = { "", "Nowhere/Atlantis", "UTC/", "europe/berlin" };
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* tz = &tzs->timezones[i];
+        std::string name = tz->name;
+        checks++;
+        if (utz_find_timezone(tzs, name.c_str(), name.size()) != tz)
+        {
+            printf("NAME HASH: %s isn't found\n", tz->name);
+            mismatches++;
+        }
+
+        std::string changed = name;
+        changed.back() ^= 0x20;
+        for (std::string miss : { changed, name + "x", name.substr(0, name.size() - 1) })
+            misses.push_back(miss);
+    }
+
+    // Every name hashes to some zone, so the ones that don't exist have to come back NULL.
+    for (std::string& miss : misses)
+    {
+        checks++;
+        utz_timezone* found = utz_find_timezone(tzs, miss.c_str(), miss.size());
+        if (found != utz_find_timezone_binary_search(tzs, miss.c_str(), miss.size()) || (found && found->name != miss))
+        {
+            printf("NAME HASH: \"%s\" finds %s\n", miss.c_str(), found ? found->name : "NULL");
+            mismatches++;
+        }
+    }
+
+    printf("NAME HASH: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    return mismatches;
+}
+
+// The table gives every country the first of its zones, and nothing to codes that aren't a country.
+int testCountryTable(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    for (char first = 'A'; first <= 'Z'; first++)
+        for (char second = 'A'; second <= 'Z'; second++)
+        {
+            char code[3] = { first, second, '\0' };
+            utz_timezone* expected = NULL;
+            for (int i = 0; i < tzs->country_count; i++)
+                if (strcmp(tzs->countries[i].code, code) == 0 && tzs->countries[i].timezone_count)
+                    expected = tzs->countries[i].timezones[0];
+
+            checks++;
+            utz_timezone* found = utz_default_tz_for_country(tzs, code);
+            utz_time_t    wall  = 0;
+            bool          ok    = utz_wall_time_from_utc_default_tz(tzs, code, 1700000000, &wall);
+            if (found != expected || ok != (expected != NULL) || wall != (expected ? utz_wall_time_from_utc(expected, 1700000000) : 1700000000))
+            {
+                printf("COUNTRY TABLE: %s finds %s\n", code, found ? found->name : "NULL");
+                mismatches++;
+            }
+        }
+
+    // Anything but two uppercase letters is no country, and converts as UTC.
+    for (const char* code : { "", "A", "us", "Us", "USA", "1A", "A1", "A@", "[A", "\xC1\xC1" })
+    {
+        checks++;
+        utz_conversion result = {};
+        if (utz_default_tz_for_country(tzs, code) || utz_utc_from_wall_time_default_tz(tzs, code, 1700000000, &result) ||
+            result.earlier != 1700000000)
+        {
+            printf("COUNTRY TABLE: \"%s\" is a country\n", code);
+            mismatches++;
+        }
+    }
+
+    printf("COUNTRY TABLE: %d countries, %lld checks, %d mismatches\n", (int)tzs->country_count, checks, mismatches);
+    return mismatches;
+}
+
+// A snapshot loads into the same zones and countries, and a damaged one doesn't load.
+int testSnapshot(utz_timezones* tzs, std::vector<char>& file)
+{
+    utz_timezones indexed;
+    if (!utz_parse_iana_tzdb_targz(&indexed, file.data(), (int)file.size(), NULL, 2500, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX))
+    {
+        printf("ERROR: %s", indexed.parsing_error);
+        utz_free_timezones(&indexed);
+        return 1;
+    }
+
+    // Snapshots have to be aligned to 64 bytes, like mmap'd files are.
+    utz_usize size    = utz_write_snapshot(&indexed, NULL, 0);
+    utz_usize padded  = (size + 63) & ~(utz_usize)63;
+    char*     written = (char*) aligned_alloc(64, padded);
+    char*     damaged = (char*) aligned_alloc(64, padded);
+    int mismatches = (utz_write_snapshot(&indexed, written, size) == size) ? 0 : 1;
+
+    long long checks = 0;
+    utz_timezones loaded;
+    if (!utz_load_snapshot(&loaded, written, size))
+    {
+        printf("ERROR: %s", loaded.parsing_error);
+        mismatches++;
+    }
+    else
+    {
+        for (int i = 0; i < tzs->timezone_count; i++)
+        {
+            utz_timezone* original = &tzs->timezones[i];
+            utz_timezone* read     = utz_find_timezone(&loaded, original->name, strlen(original->name));
+            utz_time_t    at       = read ? firstDifference(original, read, &checks) : 0;
+            if (at >= 0 || (read && (read->kind != original->kind || !read->search_index_keys != !original->range_count)))
+            {
+                printf("SNAPSHOT: %s converts %lld differently\n", original->name, (long long)at);
+                mismatches++;
+            }
+        }
+
+        for (int i = 0; i < tzs->country_count; i++)
+        {
+            utz_timezone* expected = utz_default_tz_for_country(tzs, tzs->countries[i].code);
+            utz_timezone* read     = utz_default_tz_for_country(&loaded, tzs->countries[i].code);
+            if (!expected != !read || (read && strcmp(read->name, expected->name) != 0))
+            {
+                printf("SNAPSHOT: %s defaults to %s\n", tzs->countries[i].code, read ? read->name : "NULL");
+                mismatches++;
+            }
+        }
+        if (loaded.country_count != tzs->country_count || strcmp(loaded.iana_version, tzs->iana_version) != 0) mismatches++;
+    }
+    utz_free_timezones(&loaded);
+
+    // Damaged snapshots have to fail to load, instead of handing out indices past the end of their arrays.
+    utz_snapshot_header*   header  = (utz_snapshot_header*) written;
+    utz_snapshot_timezone* records = (utz_snapshot_timezone*)(written + header->timezones);
+    utz_snapshot_timezone* record  = records;
+    while (record + 1 < records + header->timezone_count && !(record->range_count > 1 && record->bucket_first_range)) record++;
+
+    const char* damages[] = { "magic", "cut short", "abbreviation index", "bucket range", "search index rank" };
+    for (int d = 0; d < (int)(sizeof(damages) / sizeof(damages[0])); d++)
+    {
+        memcpy(damaged, written, size);
+        utz_usize damaged_size = size;
+        switch (d)
+        {
+            case 0: damaged[0] ^= 1; break;
+            case 1: damaged_size -= 8; break;
+            case 2: damaged[record->range_abbreviation_index] = (char) record->abbreviation_count; break;
+            case 3: *(utz_u32*)(damaged + record->bucket_first_range) = (utz_u32) record->range_count; break;
+            case 4: *(utz_u32*)(damaged + record->search_index_ranks) = (utz_u32) record->range_count + 1; break;
+        }
+
+        checks++;
+        utz_timezones broken;
+        if (utz_load_snapshot(&broken, damaged, damaged_size))
+        {
+            printf("SNAPSHOT: loads with a damaged %s\n", damages[d]);
+            mismatches++;
+        }
+        utz_free_timezones(&broken);
+    }
+
+    printf("SNAPSHOT: %d zones, %lld checks, %d mismatches\n", (int)tzs->timezone_count, checks, mismatches);
+    free(damaged);
+    free(written);
+    utz_free_timezones(&indexed);
+    return mismatches;
+}
+
+// utz_tzdata is made by tools/generate_tzdata.cpp with both indices, and has to convert like the parsed database.
+int testGeneratedTzdata(utz_timezones* tzs)
+{
+    int mismatches = 0;
+    long long checks = 0;
+    if (utz_tzdata.timezone_count != tzs->timezone_count || utz_tzdata.country_count != tzs->country_count ||
+        strcmp(utz_tzdata.iana_version, tzs->iana_version) != 0)
+    {
+        printf("GENERATED TZDATA: has %d zones and %d countries of %s\n", (int)utz_tzdata.timezone_count,
+               (int)utz_tzdata.country_count, utz_tzdata.iana_version);
+        mismatches++;
+    }
+
+    for (int i = 0; i < tzs->timezone_count; i++)
+    {
+        utz_timezone* original  = &tzs->timezones[i];
+        utz_timezone* generated = utz_find_timezone(&utz_tzdata, original->name, strlen(original->name));
+        utz_time_t    at        = generated ? firstDifference(original, generated, &checks) : 0;
+        if (!generated || at >= 0 || generated->kind != original->kind || generated->settled_since != original->settled_since ||
+            (generated->range_count > 1 && !generated->search_index_keys))
+        {
+            printf("GENERATED TZDATA: %s converts %lld differently\n", original->name, (long long)at);
+            mismatches++;
+        }
+    }
+
+    for (int i = 0; i < tzs->country_count; i++)
+    {
+        utz_timezone* expected  = utz_default_tz_for_country(tzs, tzs->countries[i].code);
+        utz_timezone* generated = utz_default_tz_for_country(&utz_tzdata, tzs->countries[i].code);
+        if (!expected != !generated || (generated && strcmp(generated->name, expected->name) != 0)) mismatches++;
+    }
+
+    checks++;
+    if (utz_find_timezone(&utz_tzdata, "Nowhere/Atlantis", strlen("Nowhere/Atlantis"))) mismatches++;
+
+    printf("GENERATED TZDATA: %d zones, %lld checks, %d mismatches\n", (int)utz_tzdata.timezone_count, checks, mismatches);
+    return mismatches;
+}
+
 int main(int argc, char** argv)
 {
     std::vector<char> file = readFileToVector("tzdata2023c.tar.gz");
@@ -54,12 +1210,52 @@ int main(int argc, char** argv)
         for (int j = 0; j < tzs.timezones[i].range_count; j++)
         {
             auto& r = tzs.timezones[i].ranges[j];
-            printf("\tsince: %lld\toffset: %d\tabbr: %s\n", r.since, r.offset_seconds, r.zone_abbreviation);
+            printf("\tsince: %lld\toffset: %d\tabbr: %s\n", (long long)r.since, r.offset_seconds, r.zone_abbreviation);
         }
     }
 
     printf("CCA SIZE: %llu\n", cca_size);
 
+    int tzif_mismatches = testTzifLoader(&tzs, "run_tree/zoneinfo");
+    if (tzif_mismatches < 0) printf("TZIF: skipped, run `make zoneinfo` first (needs zic)\n");
+    if (tzif_mismatches > 0) result = 0;
+    if (testTzifRoundTrip(&tzs) > 0) result = 0;
+    if (testLazyParse(&tzs, file) > 0) result = 0;
+    if (testTarIndex(file) > 0) result = 0;
+    if (testParseWithFlags(&tzs, file, UTZ_PARSE_PARALLEL, "PARALLEL") > 0) result = 0;
+    if (testParseWithFlags(&tzs, file, UTZ_PARSE_STREAMING, "STREAMING") > 0) result = 0;
+    if (testArenaParse(&tzs, file) > 0) result = 0;
+    if (testParseStats(&tzs, file) > 0) result = 0;
+    if (testDayRules() > 0) result = 0;
+    if (testRangeArrays(&tzs) > 0) result = 0;
+    if (testRangeIndex(&tzs, file, UTZ_PARSE_SEARCH_INDEX, "SEARCH INDEX") > 0) result = 0;
+    if (testWallTable(&tzs) > 0) result = 0;
+    if (testBatch(&tzs, "BATCH") > 0) result = 0;
+    if (testKernels(&tzs) > 0) result = 0;
+    if (testMulti(&tzs) > 0) result = 0;
+    if (testCursor(&tzs) > 0) result = 0;
+    if (testTail(&tzs) > 0) result = 0;
+    if (testRangeIndex(&tzs, file, UTZ_PARSE_BUCKET_INDEX, "BUCKET INDEX") > 0) result = 0;
+    if (testRangeIndex(&tzs, file, UTZ_PARSE_SEARCH_INDEX | UTZ_PARSE_BUCKET_INDEX, "BOTH INDICES") > 0) result = 0;
+    if (testClassification(&tzs) > 0) result = 0;
+    if (testNameHash(&tzs) > 0) result = 0;
+    if (testCountryTable(&tzs) > 0) result = 0;
+    if (testSnapshot(&tzs, file) > 0) result = 0;
+    if (testGeneratedTzdata(&tzs) > 0) result = 0;
+    if (testBatch(&utz_tzdata, "GENERATED BATCH") > 0) result = 0;
+
+    // A cut off tarball is an error, also when it's noticed halfway through the files.
+    for (unsigned flags : { (unsigned)UTZ_PARSE_DEFAULT, (unsigned)UTZ_PARSE_STREAMING })
+    {
+        utz_timezones truncated;
+        if (utz_parse_iana_tzdb_targz(&truncated, file.data(), (int)file.size() / 2, NULL, 2500, flags))
+        {
+            printf("TRUNCATED: parsed with flags %u\n", flags);
+            result = 0;
+        }
+        utz_free_timezones(&truncated);
+    }
+
     utz_free_timezones(&tzs);
     return result ? 0 : 1;
 }
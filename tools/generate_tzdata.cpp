@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../utz.h"
+
+// Compiles the IANA tarball once and writes the result as a C++ source file of static const arrays.
+// Linking that file gives a ready utz_timezones (utz_tzdata) without parsing, allocating or touching the tarball at runtime.
+//
+//   generate_tzdata <tzdata.tar.gz> <out.cpp> [--search-index] [--bucket-index] [--include <path to utz.h>]
+//
+// The indices are only emitted when asked for, like with utz_parse_iana_tzdb_targz flags.
+
+static void* read_file(const char* path, int* out_size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* data = malloc(size > 0 ? size : 1);
+    if (fread(data, 1, size, file) != (size_t)size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *out_size = (int)size;
+    return data;
+}
+
+static void put_string(FILE* out, const char* str)
+{
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)str; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')    fprintf(out, "\\%c", *c);
+        else if (*c < 32 || *c >= 127)  fprintf(out, "\\%03o", *c); // Always 3 digits, so the next character can't extend the escape.
+        else                            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void put_time(FILE* out, utz_time_t time)
+{
+    // The smallest value has no literal of its own.
+    if (time == INT64_MIN) fprintf(out, "(-9223372036854775807LL - 1)");
+    else                   fprintf(out, "%lldLL", (long long)time);
+}
+
+static void put_times(FILE* out, const utz_time_t* times, utz_usize count)
+{
+    for (utz_usize i = 0; i < count; i++)
+    {
+        fprintf(out, (i % 4) ? " " : "\n    ");
+        put_time(out, times[i]);
+        fputc(',', out);
+    }
+    fprintf(out, "\n");
+}
+
+template <typename T>
+static void put_integers(FILE* out, const T* values, utz_usize count)
+{
+    for (utz_usize i = 0; i < count; i++)
+        fprintf(out, "%s%lld,", (i % 16) ? " " : "\n    ", (long long)values[i]);
+    fprintf(out, "\n");
+}
+
+// Every zone's arrays are named utz_tzdata_<what>_<zone index>. Links reuse the arrays of the zone they point to.
+static void put_zone_arrays(FILE* out, utz_timezone* tz, utz_usize zi)
+{
+    utz_usize n = tz->range_count;
+    if (n == 0) return;
+
+    fprintf(out, "// %s\n", tz->name);
+
+    fprintf(out, "static const utz_time_range utz_tzdata_ranges_%zu[%zu] = {\n", (size_t)zi, (size_t)n);
+    for (utz_usize i = 0; i < n; i++)
+    {
+        fprintf(out, "    { ");
+        put_string(out, tz->ranges[i].zone_abbreviation);
+        fprintf(out, ", ");
+        put_time(out, tz->ranges[i].since);
+        fprintf(out, ", %d },\n", (int)tz->ranges[i].offset_seconds);
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const utz_time_t utz_tzdata_range_since_%zu[%zu] = {", (size_t)zi, (size_t)n);
+    put_times(out, tz->range_since, n);
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const utz_s32 utz_tzdata_range_offset_seconds_%zu[%zu] = {", (size_t)zi, (size_t)n);
+    put_integers(out, tz->range_offset_seconds, n);
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const utz_u8 utz_tzdata_range_abbreviation_index_%zu[%zu] = {", (size_t)zi, (size_t)n);
+    put_integers(out, tz->range_abbreviation_index, n);
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const char utz_tzdata_abbreviations_%zu[%zu][5 + 1] = {\n", (size_t)zi, (size_t)tz->abbreviation_count);
+    for (utz_usize i = 0; i < tz->abbreviation_count; i++)
+    {
+        fprintf(out, "    ");
+        put_string(out, tz->abbreviations[i]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const utz_time_t utz_tzdata_range_wall_until_%zu[%zu] = {", (size_t)zi, (size_t)n);
+    put_times(out, tz->range_wall_until, n);
+    fprintf(out, "};\n");
+
+    fprintf(out, "static const utz_u8 utz_tzdata_range_wall_flags_%zu[%zu] = {", (size_t)zi, (size_t)n);
+    put_integers(out, tz->range_wall_flags, n);
+    fprintf(out, "};\n");
+
+    if (tz->search_index_keys)
+    {
+        // Nodes are searched a cache line at a time, so the keys keep the alignment they were built with.
+        utz_usize slots = tz->search_index_node_count * 8;
+        fprintf(out, "alignas(64) static const utz_time_t utz_tzdata_search_index_keys_%zu[%zu] = {", (size_t)zi, (size_t)slots);
+        put_times(out, tz->search_index_keys, slots);
+        fprintf(out, "};\n");
+
+        fprintf(out, "static const utz_u32 utz_tzdata_search_index_ranks_%zu[%zu] = {", (size_t)zi, (size_t)slots + 1);
+        put_integers(out, tz->search_index_ranks, slots + 1);
+        fprintf(out, "};\n");
+    }
+
+    if (tz->bucket_first_range)
+    {
+        // Both halves in one array, the same way utz_build_bucket_index allocates them.
+        fprintf(out, "static const utz_u32 utz_tzdata_buckets_%zu[%zu] = {", (size_t)zi, (size_t)tz->bucket_count * 2);
+        put_integers(out, tz->bucket_first_range, tz->bucket_count * 2);
+        fprintf(out, "};\n");
+    }
+
+    fprintf(out, "\n");
+}
+
+static void put_zone_record(FILE* out, utz_timezones* tzs, utz_timezone* tz, utz_usize zi)
+{
+    // Links share the arrays of their zone.
+    utz_usize data = tz->alias_of ? (utz_usize)(tz->alias_of - tzs->timezones) : zi;
+    utz_usize n    = tz->range_count;
+
+    fprintf(out, "    { // %s\n", tz->name);
+    fprintf(out, "        .name = ");
+    put_string(out, tz->name);
+    fprintf(out, ",\n");
+    if (tz->alias_of)
+        fprintf(out, "        .alias_of = (utz_timezone*) &utz_tzdata_timezones[%zu],\n", (size_t)data);
+    fprintf(out, "        .coordinate_latitude_seconds  = %d,\n", (int)tz->coordinate_latitude_seconds);
+    fprintf(out, "        .coordinate_longitude_seconds = %d,\n", (int)tz->coordinate_longitude_seconds);
+
+    if (n)
+    {
+        fprintf(out, "        .ranges      = (utz_time_range*) utz_tzdata_ranges_%zu,\n", (size_t)data);
+        fprintf(out, "        .range_count = %zu,\n", (size_t)n);
+    }
+
+    fprintf(out, "        .tail_changes = {");
+    for (utz_usize i = 0; i < tz->tail_change_count; i++)
+    {
+        utz_tail_change* change = &tz->tail_changes[i];
+        fprintf(out, "%s{ %d, %d, %d, %d, %d, %d, %d }", i ? ", " : " ",
+                change->month, change->day_kind, change->day, change->weekday,
+                (int)change->at_seconds, (int)change->offset_seconds, change->abbreviation_index);
+    }
+    fprintf(out, " },\n");
+    fprintf(out, "        .tail_change_count = %zu,\n", (size_t)tz->tail_change_count);
+
+    fprintf(out, "        .kind = %d,\n", tz->kind);
+    fprintf(out, "        .settled_offset_seconds = %d,\n", (int)tz->settled_offset_seconds);
+    fprintf(out, "        .settled_since = ");
+    put_time(out, tz->settled_since);
+    fprintf(out, ",\n        .settled_wall_since = ");
+    put_time(out, tz->settled_wall_since);
+    fprintf(out, ",\n");
+
+    if (n)
+    {
+        fprintf(out, "        .range_since              = (utz_time_t*)    utz_tzdata_range_since_%zu,\n",              (size_t)data);
+        fprintf(out, "        .range_offset_seconds     = (utz_s32*)       utz_tzdata_range_offset_seconds_%zu,\n",     (size_t)data);
+        fprintf(out, "        .range_abbreviation_index = (utz_u8*)        utz_tzdata_range_abbreviation_index_%zu,\n", (size_t)data);
+        fprintf(out, "        .abbreviations            = (char(*)[5 + 1]) utz_tzdata_abbreviations_%zu,\n",            (size_t)data);
+        fprintf(out, "        .abbreviation_count       = %zu,\n", (size_t)tz->abbreviation_count);
+        fprintf(out, "        .range_wall_until         = (utz_time_t*)    utz_tzdata_range_wall_until_%zu,\n",         (size_t)data);
+        fprintf(out, "        .range_wall_flags         = (utz_u8*)        utz_tzdata_range_wall_flags_%zu,\n",         (size_t)data);
+    }
+
+    if (tz->search_index_keys)
+    {
+        fprintf(out, "        .search_index_keys        = (utz_time_t*) utz_tzdata_search_index_keys_%zu,\n",  (size_t)data);
+        fprintf(out, "        .search_index_ranks       = (utz_u32*)    utz_tzdata_search_index_ranks_%zu,\n", (size_t)data);
+        fprintf(out, "        .search_index_node_count  = %zu,\n", (size_t)tz->search_index_node_count);
+    }
+
+    if (tz->bucket_first_range)
+    {
+        fprintf(out, "        .bucket_first_range       = (utz_u32*) utz_tzdata_buckets_%zu,\n",        (size_t)data);
+        fprintf(out, "        .bucket_first_wall_range  = (utz_u32*) utz_tzdata_buckets_%zu + %zu,\n",  (size_t)data, (size_t)tz->bucket_count);
+        fprintf(out, "        .bucket_count             = %zu,\n", (size_t)tz->bucket_count);
+        fprintf(out, "        .bucket_shift             = %u,\n",  (unsigned)tz->bucket_shift);
+    }
+
+    fprintf(out, "    },\n");
+}
+
+static void generate(FILE* out, utz_timezones* tzs, const char* include_path, unsigned flags)
+{
+    fprintf(out, "// Generated by tools/generate_tzdata.cpp from IANA tzdata %s, don't edit.\n", tzs->iana_version);
+    fprintf(out, "//\n");
+    fprintf(out, "// Defines `utz_timezones utz_tzdata`, declared in utz.h. Everything it points to is static const data,\n");
+    fprintf(out, "// so it needs no parsing or heap and must never be passed to utz_free_timezones.\n\n");
+    fprintf(out, "#define UTZ_NO_IMPLEMENTATION\n");
+    fprintf(out, "#include \"%s\"\n\n", include_path);
+
+    // The flags only decide what was built, the header has to agree on the struct layout.
+    fprintf(out, "static_assert(sizeof(utz_timezone) == %zu, \"utz.h doesn't match the one this file was generated with\");\n",  sizeof(utz_timezone));
+    fprintf(out, "static_assert(sizeof(utz_timezones) == %zu, \"utz.h doesn't match the one this file was generated with\");\n\n", sizeof(utz_timezones));
+    fprintf(out, "// Parse flags: %s%s\n\n",
+            (flags & UTZ_PARSE_SEARCH_INDEX) ? "UTZ_PARSE_SEARCH_INDEX " : "",
+            (flags & UTZ_PARSE_BUCKET_INDEX) ? "UTZ_PARSE_BUCKET_INDEX " : "");
+
+    for (utz_usize zi = 0; zi < tzs->timezone_count; zi++)
+        if (!tzs->timezones[zi].alias_of)
+            put_zone_arrays(out, &tzs->timezones[zi], zi);
+
+    fprintf(out, "static const utz_timezone utz_tzdata_timezones[%zu] = {\n", (size_t)tzs->timezone_count);
+    for (utz_usize zi = 0; zi < tzs->timezone_count; zi++)
+        put_zone_record(out, tzs, &tzs->timezones[zi], zi);
+    fprintf(out, "};\n\n");
+
+    for (utz_usize ci = 0; ci < tzs->country_count; ci++)
+    {
+        utz_country* country = &tzs->countries[ci];
+        if (!country->timezone_count) continue;
+
+        fprintf(out, "static utz_timezone* const utz_tzdata_country_timezones_%zu[%zu] = {\n", (size_t)ci, (size_t)country->timezone_count);
+        for (utz_usize i = 0; i < country->timezone_count; i++)
+            fprintf(out, "    (utz_timezone*) &utz_tzdata_timezones[%zu],\n", (size_t)(country->timezones[i] - tzs->timezones));
+        fprintf(out, "};\n");
+    }
+    fprintf(out, "\n");
+
+    fprintf(out, "static const utz_country utz_tzdata_countries[%zu] = {\n", (size_t)tzs->country_count);
+    for (utz_usize ci = 0; ci < tzs->country_count; ci++)
+    {
+        utz_country* country = &tzs->countries[ci];
+        fprintf(out, "    { ");
+        put_string(out, country->code);
+        fprintf(out, ", ");
+        put_string(out, country->name);
+        if (country->timezone_count) fprintf(out, ", (utz_timezone**) utz_tzdata_country_timezones_%zu, %zu },\n", (size_t)ci, (size_t)country->timezone_count);
+        else                         fprintf(out, ", NULL, 0 },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const utz_u32 utz_tzdata_name_hash_seeds[%zu] = {", (size_t)tzs->name_hash_seed_count);
+    put_integers(out, tzs->name_hash_seeds, tzs->name_hash_seed_count);
+    fprintf(out, "};\n");
+    fprintf(out, "static const utz_u32 utz_tzdata_name_hash_slots[%zu] = {", (size_t)tzs->timezone_count);
+    put_integers(out, tzs->name_hash_slots, tzs->timezone_count);
+    fprintf(out, "};\n\n");
+
+    // The only non-const object. Lookups take a utz_timezones*, but none of them write through it.
+    fprintf(out, "utz_timezones utz_tzdata = {\n");
+    fprintf(out, "    .parsing_error  = NULL,\n");
+    fprintf(out, "    .iana_version   = ");
+    put_string(out, tzs->iana_version);
+    fprintf(out, ",\n");
+    fprintf(out, "    .snapshot       = NULL,\n");
+    fprintf(out, "    .countries      = (utz_country*) utz_tzdata_countries,\n");
+    fprintf(out, "    .country_count  = %zu,\n", (size_t)tzs->country_count);
+    fprintf(out, "    .country_default_timezones = {");
+    for (utz_usize i = 0; i < 26 * 26; i++)
+    {
+        utz_timezone* tz = tzs->country_default_timezones[i];
+        fprintf(out, (i % 26) ? " " : "\n        ");
+        if (tz) fprintf(out, "(utz_timezone*) &utz_tzdata_timezones[%zu],", (size_t)(tz - tzs->timezones));
+        else    fprintf(out, "NULL,");
+    }
+    fprintf(out, "\n    },\n");
+    fprintf(out, "    .timezones      = (utz_timezone*) utz_tzdata_timezones,\n");
+    fprintf(out, "    .timezone_count = %zu,\n", (size_t)tzs->timezone_count);
+    fprintf(out, "    .name_hash_seeds      = (utz_u32*) utz_tzdata_name_hash_seeds,\n");
+    fprintf(out, "    .name_hash_slots      = (utz_u32*) utz_tzdata_name_hash_slots,\n");
+    fprintf(out, "    .name_hash_seed_count = %zu,\n", (size_t)tzs->name_hash_seed_count);
+    fprintf(out, "};\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* input        = NULL;
+    const char* output       = NULL;
+    const char* include_path = "utz.h";
+    unsigned    flags        = UTZ_PARSE_DEFAULT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if      (!strcmp(argv[i], "--search-index"))         flags |= UTZ_PARSE_SEARCH_INDEX;
+        else if (!strcmp(argv[i], "--bucket-index"))         flags |= UTZ_PARSE_BUCKET_INDEX;
+        else if (!strcmp(argv[i], "--include") && i + 1 < argc) include_path = argv[++i];
+        else if (!input)                                     input  = argv[i];
+        else if (!output)                                    output = argv[i];
+        else                                                 input  = NULL, i = argc;
+    }
+
+    if (!input || !output)
+    {
+        fprintf(stderr, "usage: %s <tzdata.tar.gz> <out.cpp> [--search-index] [--bucket-index] [--include <path to utz.h>]\n", argv[0]);
+        return 1;
+    }
+
+    int   targz_size = 0;
+    void* targz      = read_file(input, &targz_size);
+    if (!targz)
+    {
+        fprintf(stderr, "ERROR: can't read %s\n", input);
+        return 1;
+    }
+
+    utz_timezones tzs;
+    if (!utz_parse_iana_tzdb_targz(&tzs, targz, targz_size, NULL, 2500, flags))
+    {
+        fprintf(stderr, "ERROR: %s\n", tzs.parsing_error);
+        return 1;
+    }
+
+    FILE* out = fopen(output, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "ERROR: can't write %s\n", output);
+        return 1;
+    }
+    generate(out, &tzs, include_path, flags);
+    int failed = ferror(out);
+    fclose(out);
+
+    utz_free_timezones(&tzs);
+    free(targz);
+    if (failed)
+    {
+        fprintf(stderr, "ERROR: failed writing %s\n", output);
+        remove(output);
+        return 1;
+    }
+    return 0;
+}
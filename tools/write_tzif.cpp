@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include "../utz.h"
+
+// Compiles the IANA tarball once and writes every zone as a TZif file, in the same layout as a zoneinfo directory.
+// The result can be loaded with utz_load_tzif_directory, or pointed to with TZDIR / TZ by the system libc.
+//
+//   write_tzif <tzdata.tar.gz> <out directory>
+//
+// Zones utz_write_tzif can't express are reported and skipped, the rest are still written.
+
+static void* read_file(const char* path, int* out_size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* data = malloc(size > 0 ? size : 1);
+    if (fread(data, 1, size, file) != (size_t)size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *out_size = (int)size;
+    return data;
+}
+
+// Creates every directory leading up to the file at `path`.
+static bool make_parent_directories(char* path)
+{
+    for (char* c = path + 1; *c; c++)
+    {
+        if (*c != '/') continue;
+        *c = 0;
+        bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *c = '/';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <tzdata.tar.gz> <out directory>\n", argv[0]);
+        return 1;
+    }
+
+    int   targz_size = 0;
+    void* targz      = read_file(argv[1], &targz_size);
+    if (!targz)
+    {
+        fprintf(stderr, "ERROR: can't read %s\n", argv[1]);
+        return 1;
+    }
+
+    utz_timezones tzs;
+    if (!utz_parse_iana_tzdb_targz(&tzs, targz, targz_size))
+    {
+        fprintf(stderr, "ERROR: %s\n", tzs.parsing_error);
+        free(targz);
+        return 1;
+    }
+
+    int       failed   = 0;
+    void*     buffer   = NULL;
+    utz_usize capacity = 0;
+    for (int i = 0; i < tzs.timezone_count; i++)
+    {
+        utz_timezone* tz   = &tzs.timezones[i];
+        utz_usize     size = utz_write_tzif(tz, NULL, 0);
+        if (!size)
+        {
+            fprintf(stderr, "SKIPPED: %s can't be written as TZif\n", tz->name);
+            continue;
+        }
+        if (size > capacity)
+        {
+            free(buffer);
+            buffer   = malloc(size);
+            capacity = size;
+        }
+        utz_write_tzif(tz, buffer, size);
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", argv[2], tz->name);
+        FILE* out = make_parent_directories(path) ? fopen(path, "wb") : NULL;
+        if (!out || fwrite(buffer, 1, size, out) != size)
+        {
+            fprintf(stderr, "ERROR: can't write %s\n", path);
+            failed = 1;
+        }
+        if (out) fclose(out);
+    }
+
+    free(buffer);
+    utz_free_timezones(&tzs);
+    free(targz);
+    return failed;
+}
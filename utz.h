@@ -19,11 +19,21 @@
 #endif
 
 
+// The default allocator ignores allocator_userdata, unless it's utz_arena_userdata(arena) to allocate from arena.
 #ifndef UTZ_OVERRIDE_ALLOCATOR
   #include <stdlib.h>
-  #define UtzCalloc(userdata_ptr, type, count)       ((type*) calloc((count), sizeof(type)))
-  #define UtzRealloc(userdata_ptr, ptr, type, count) ((type*) realloc((ptr), sizeof(type) * (count)))
-  #define UtzFree(userdata_ptr, ptr)                 (free(ptr))
+  #define UtzCalloc(userdata_ptr, type, count)       ((type*) (utz_userdata_arena(userdata_ptr) ? utz_arena_calloc(utz_userdata_arena(userdata_ptr), sizeof(type) * (count)) \
+                                                                                            : calloc((count), sizeof(type))))
+  #define UtzRealloc(userdata_ptr, ptr, type, count) ((type*) (utz_userdata_arena(userdata_ptr) ? utz_arena_realloc(utz_userdata_arena(userdata_ptr), (ptr), sizeof(type) * (count)) \
+                                                                                            : realloc((ptr), sizeof(type) * (count))))
+  #define UtzFree(userdata_ptr, ptr)                 (utz_userdata_arena(userdata_ptr) ? utz_arena_free(utz_userdata_arena(userdata_ptr), (ptr)) : free(ptr))
+#endif
+
+// Where a utz_arena gets its blocks from, userdata_ptr is the arena's block_userdata. Override for huge pages and such.
+#ifndef UTZ_OVERRIDE_ARENA_BLOCKS
+  #include <stdlib.h>
+  #define UtzArenaAllocateBlock(userdata_ptr, size) (malloc(size))
+  #define UtzArenaFreeBlock(userdata_ptr, ptr, size) (free(ptr))
 #endif
 
 #ifndef UTZ_OVERRIDE_ASSERT
@@ -36,6 +46,57 @@
   #define UtzSprintf(buffer, size, fmt, ...) snprintf((buffer), (size), fmt, ##__VA_ARGS__)
 #endif
 
+// Nanoseconds since any fixed point in time, only read for utz_parse_stats.
+#ifndef UTZ_OVERRIDE_CLOCK
+  #if defined(_WIN32)
+    #include <windows.h>
+    static inline utz_u64 utz_clock_nanoseconds(void)
+    {
+        LARGE_INTEGER frequency, counter;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&counter);
+        return (utz_u64)((double) counter.QuadPart * (1e9 / (double) frequency.QuadPart));
+    }
+  #else
+    #include <time.h>
+    static inline utz_u64 utz_clock_nanoseconds(void)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (utz_u64) now.tv_sec * 1000000000u + (utz_u64) now.tv_nsec;
+    }
+  #endif
+  #define UtzNanoseconds() utz_clock_nanoseconds()
+#endif
+
+// Only used on utz_u32, by zones of UTZ_PARSE_LAZY that get compiled on first use, by UTZ_PARSE_PARALLEL, arenas and
+// the batch functions (picking a kernel).
+#ifndef UTZ_OVERRIDE_ATOMICS
+  #if defined(__GNUC__)
+    #define UtzAtomicLoadAcquire(ptr)                         __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    #define UtzAtomicStoreRelease(ptr, value)                 __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+    #define UtzAtomicCompareExchange(ptr, expected, desired)  __sync_bool_compare_and_swap((ptr), (expected), (desired))
+    #define UtzAtomicFetchAdd(ptr, value)                     __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+  #elif defined(_MSC_VER)
+    #include <intrin.h>
+    #if defined(_M_ARM64)
+      #define UtzAtomicLoadAcquire(ptr)                       __ldar32((unsigned __int32 volatile*)(ptr))
+    #else
+      #define UtzAtomicLoadAcquire(ptr)                       (*(volatile utz_u32*)(ptr)) // acquire with /volatile:ms, the x86 default
+    #endif
+    #define UtzAtomicStoreRelease(ptr, value)                 ((void)_InterlockedExchange((volatile long*)(ptr), (long)(value)))
+    #define UtzAtomicCompareExchange(ptr, expected, desired)  (_InterlockedCompareExchange((volatile long*)(ptr), (long)(desired), (long)(expected)) == (long)(expected))
+    #define UtzAtomicFetchAdd(ptr, value)                     ((utz_u32)_InterlockedExchangeAdd((volatile long*)(ptr), (long)(value)))
+  #else
+    // Not atomic, lazy zones can only be used from one thread and UTZ_PARSE_PARALLEL needs UTZ_NO_THREADS.
+    // Define UTZ_OVERRIDE_ATOMICS and these with your compiler's atomics instead.
+    #define UtzAtomicLoadAcquire(ptr)                         (*(ptr))
+    #define UtzAtomicStoreRelease(ptr, value)                 ((void)(*(ptr) = (value)))
+    #define UtzAtomicCompareExchange(ptr, expected, desired)  ((*(ptr) == (expected)) ? (*(ptr) = (desired), 1) : 0)
+    #define UtzAtomicFetchAdd(ptr, value)                     ((*(ptr) += (value)) - (value))
+  #endif
+#endif
+
 
 
 
@@ -66,6 +127,21 @@ typedef struct utz_time_range
     utz_s32     offset_seconds;
 } utz_time_range;
 
+// One of the two clock changes a zone repeats every year after its last range, like the rules of a POSIX TZ string ("M3.2.0/2").
+typedef struct utz_tail_change
+{
+    utz_u8  month;              // January is 1
+    utz_u8  day_kind;           // utz_day_rule_kind
+    utz_u8  day;                // 1 - 31, for "last weekday" rules it's 31
+    utz_u8  weekday;            // Sunday is 0, unused for day_kind == DAY_RULE_EQUAL_TO_DATE
+    utz_s32 at_seconds;         // UTC time of the change, relative to the start of the day selected above
+    utz_s32 offset_seconds;     // offset in effect after the change
+    utz_u8  abbreviation_index; // index into utz_timezone.abbreviations
+} utz_tail_change;
+
+typedef struct utz_lazy_zone   utz_lazy_zone;
+typedef struct utz_lazy_source utz_lazy_source;
+
 typedef struct utz_timezone
 {
     char          name[32 + 1];
@@ -76,6 +152,55 @@ typedef struct utz_timezone
 
     utz_time_range* ranges;
     utz_usize       range_count;
+
+    // Zones that still observe daylight saving time only store ranges up to the point their rules stop changing.
+    // Times at or after range_since[range_count - 1] are resolved with tail_changes, ordered by when they happen in a year.
+    // tail_change_count is 0 for zones that don't change clocks anymore.
+    utz_tail_change tail_changes[2];
+    utz_usize       tail_change_count;
+
+    // utz_timezone_kind. UTC times at or after settled_since, and wall times at or after settled_wall_since,
+    // all convert with settled_offset_seconds. Both are the end of time in zones with a tail.
+    utz_u8     kind;
+    utz_s32    settled_offset_seconds;
+    utz_time_t settled_since;
+    utz_time_t settled_wall_since;
+
+    // The same data as `ranges`, split into parallel arrays so that searches only pull `range_since` into cache.
+    // All arrays have range_count elements (abbreviations has abbreviation_count) and live in one allocation starting at range_since.
+    utz_time_t* range_since;
+    utz_s32*    range_offset_seconds;
+    utz_u8*     range_abbreviation_index;   // index into abbreviations
+    char      (*abbreviations)[5 + 1];
+    utz_usize   abbreviation_count;
+
+    // Wall clock keyed view used by utz_utc_from_wall_time. range_wall_until[i] is the last wall time that
+    // resolves to range i (or an earlier one), it never decreases. range_wall_flags marks gaps and overlaps.
+    utz_time_t* range_wall_until;
+    utz_u8*     range_wall_flags;           // utz_wall_flags
+
+    // Optional static B-tree over range_since, only built with UTZ_PARSE_SEARCH_INDEX.
+    // Every node is 8 keys (one cache line), padded with the end of time. search_index_ranks maps keys back to range indices.
+    utz_time_t* search_index_keys;
+    utz_u32*    search_index_ranks;
+    utz_usize   search_index_node_count;
+
+    // Optional bucket index, only built with UTZ_PARSE_BUCKET_INDEX. Bucket b covers [b << bucket_shift, (b + 1) << bucket_shift).
+    // bucket_first_range[b] is the range containing the start of bucket b, bucket_first_wall_range[b] the same for
+    // range_wall_until. The shift is picked per zone so that a bucket holds at most a couple of range boundaries.
+    // Times in or past the last bucket go straight to the last range.
+    utz_u32*    bucket_first_range;
+    utz_u32*    bucket_first_wall_range;
+    utz_usize   bucket_count;
+    utz_u32     bucket_shift;
+
+    // Why a zone of UTZ_PARSE_LAZY couldn't be compiled, NULL when it could. Its links share it.
+    const char* compile_error;
+
+    // Zones of UTZ_PARSE_LAZY only have a name (and coordinates) until they are first looked up or converted with,
+    // that compiles everything from `ranges` up to here. lazy_state is a utz_lazy_state, only accessed atomically.
+    utz_lazy_zone* lazy;
+    utz_u32        lazy_state;
 } utz_timezone;
 
 struct utz_country
@@ -91,15 +216,51 @@ struct utz_timezones
     const char* parsing_error;
     char iana_version[6 + 1];
 
+    // Set by utz_load_snapshot, timezone data points into it instead of being owned.
+    const void* snapshot;
+
     utz_country* countries;
     utz_usize    country_count;
 
+    // Default timezone of every country, indexed by utz_country_code_index ("AA" is 0, "ZZ" is 26 * 26 - 1).
+    // NULL for codes that aren't countries, or countries without timezones.
+    utz_timezone* country_default_timezones[26 * 26];
+
     utz_timezone* timezones;
     utz_usize     timezone_count;
+
+    // Minimal perfect hash over timezone names (links included), used by utz_find_timezone.
+    // A name picks a seed, the seed picks its slot, the slot holds an index into timezones.
+    utz_u32*  name_hash_seeds;
+    utz_u32*  name_hash_slots;      // timezone_count of them
+    utz_usize name_hash_seed_count;
+
+    // Set by UTZ_PARSE_LAZY, the lines of zones that aren't compiled yet.
+    utz_lazy_source* lazy_source;
+};
+
+
+static const utz_timezone* UTZ_TIMEZONE_UTC = NULL;
+
+enum utz_timezone_kind
+{
+    UTZ_TIMEZONE_FIXED,      // One offset since UNIX_EPOCH.
+    UTZ_TIMEZONE_HISTORICAL, // Changed clocks in the past, but not anymore.
+    UTZ_TIMEZONE_RECURRING,  // Still changes clocks every year, see tail_changes.
 };
 
+enum utz_lazy_state
+{
+    UTZ_LAZY_COMPILED,      // Also every zone that didn't come from UTZ_PARSE_LAZY.
+    UTZ_LAZY_PENDING,
+    UTZ_LAZY_COMPILING,
+};
 
-const utz_timezone* UTZ_TIMEZONE_UTC = NULL;
+enum utz_wall_flags
+{
+    UTZ_WALL_GAP_BEFORE    = 1 << 0, // Clocks jumped forward when this range started, some wall times before it are invalid.
+    UTZ_WALL_OVERLAP_AFTER = 1 << 1, // Clocks jump backwards (or stay) when the next range starts, some wall times are ambiguous.
+};
 
 enum utz_conversion_status
 {
@@ -141,12 +302,215 @@ typedef struct utz_conversion
 } utz_conversion;
 
 
-int  utz_parse_iana_tzdb_targz(utz_timezones* tzs, void* targz, int targz_size, void* allocator_userdata = NULL, unsigned max_year = 2500);
+enum utz_parse_flags
+{
+    UTZ_PARSE_DEFAULT      = 0,
+    UTZ_PARSE_SEARCH_INDEX = 1 << 0, // Build search_index_* for every zone. Costs memory, makes utz_wall_time_from_utc branchless.
+    UTZ_PARSE_BUCKET_INDEX = 1 << 1, // Build bucket_* for every zone. Costs memory, makes range lookups a jump and a couple of compares.
+
+    // Only index zones by name, and compile each one the first time it's looked up or converted with (from any thread,
+    // the allocator has to be thread safe). Zones whose lines turn out to be bad only show up then, they convert like UTC
+    // and have the error in compile_error.
+    UTZ_PARSE_LAZY         = 1 << 2,
+
+    // Parse and compile the source files (africa, asia, europe, ...) on a thread each, the allocator has to be thread safe.
+    // Same result as parsing them one by one. Ignored with UTZ_PARSE_LAZY or UTZ_PARSE_STREAMING, and when utz is compiled
+    // with UTZ_NO_THREADS.
+    UTZ_PARSE_PARALLEL     = 1 << 3,
+
+    // Inflate the tarball a deflate block at a time and parse each source file as soon as it's out, instead of inflating
+    // all of it (1.3 MB) up front. Memory used while parsing goes down to a 64 KB window plus the biggest source file.
+    UTZ_PARSE_STREAMING    = 1 << 4,
+};
+
+// Where utz_parse_iana_tzdb_targz spent its time, to keep an eye on how long loading takes (across tzdata versions,
+// say). Phases add up over files and zones. With UTZ_PARSE_PARALLEL they add up over the threads too, so together
+// they can be more than total_nanoseconds. Zones of UTZ_PARSE_LAZY compile after parsing, that's not in here.
+enum utz_parse_phase
+{
+    UTZ_PARSE_PHASE_INFLATE,    // the .tar.gz, while taking files out of it with UTZ_PARSE_STREAMING
+    UTZ_PARSE_PHASE_TAR,        // indexing the members of the tarball and finding files in it
+    UTZ_PARSE_PHASE_TOKENIZE,   // the lines of a source file, into rules, zone lines and links (or the lazy index)
+    UTZ_PARSE_PHASE_RULES,      // the rules of a zone, expanded into clock changes year by year
+    UTZ_PARSE_PHASE_RANGES,     // the clock changes of a zone, into its range arrays and indices
+    UTZ_PARSE_PHASE_LINKS,      // sorting zones, resolving links and the name hash
+    UTZ_PARSE_PHASE_COUNTRIES,  // iso3166.tab and zone1970.tab
+    UTZ_PARSE_PHASE_COUNT,
+};
+
+typedef struct utz_parse_file_stats
+{
+    const char* name;                   // "africa", "antarctica", ... in the order they're parsed
+    utz_u64     tokenize_nanoseconds;
+    utz_u64     compile_nanoseconds;    // rules and ranges of its zones
+    utz_u64     zones;
+} utz_parse_file_stats;
+
+typedef struct utz_parse_stats
+{
+    utz_u64 total_nanoseconds;
+    utz_u64 phase_nanoseconds[UTZ_PARSE_PHASE_COUNT];
+
+    utz_parse_file_stats files[16];
+    utz_usize            file_count;
+
+    utz_u64 rules_expanded;     // a rule applied to a year
+    utz_u64 ranges_emitted;     // by expanding rules, before dropping the ones that don't change anything
+    utz_u64 ranges;             // what's left of them
+    utz_u64 zones;
+    utz_u64 links;
+    utz_u64 allocations;        // allocations and reallocations, temporaries included
+    utz_u64 bytes_allocated;    // what they asked for
+
+    // Called at the end of every phase of every file or zone (name isn't zero terminated), unless it's NULL. With
+    // UTZ_PARSE_PARALLEL, from the parsing threads at the same time. Parsing keeps these two, and zeroes the rest.
+    void (*trace)(void* userdata, utz_parse_phase phase, const char* name, utz_usize name_length, utz_u64 nanoseconds);
+    void* trace_userdata;
+} utz_parse_stats;
+
+// max_year is deprecated, rules that never end are kept as the zone's tail_changes instead of being expanded up to it.
+// It's still how far they're expanded in the odd zone where there aren't exactly two of them (which can't be a tail).
+int  utz_parse_iana_tzdb_targz(utz_timezones* tzs, void* targz, int targz_size, void* allocator_userdata = NULL, unsigned max_year = 2500,
+                               unsigned flags = UTZ_PARSE_DEFAULT, utz_parse_stats* stats = NULL);
 void utz_free_timezones(utz_timezones* tzs, void* allocator_userdata = NULL);
 
+// A bump allocator, used by passing utz_arena_userdata(arena) as allocator_userdata. Nothing allocated from an arena is freed on its own,
+// utz_free_timezones doesn't do anything for timezones in an arena and utz_free_arena releases all of it at once.
+// Parsing into an arena keeps its temporaries (the tarball, rules, ...) in a second arena with the same block_size
+// and block_userdata, which goes away when parsing is done, so only the result stays in the arena.
+//
+// Blocks are at least block_size bytes (64 KB when it's 0), from UtzArenaAllocateBlock. An arena can be used from
+// multiple threads, as it is by UTZ_PARSE_PARALLEL and by zones of UTZ_PARSE_LAZY compiling on first use.
+// With UTZ_OVERRIDE_ALLOCATOR, UtzCalloc/UtzRealloc/UtzFree can call utz_arena_calloc/realloc/free to use one.
+typedef struct utz_arena_block utz_arena_block;
+typedef struct utz_arena
+{
+    utz_arena_block* block;             // the one being allocated from, the others are behind it
+    utz_usize        block_size;
+    void*            block_userdata;
+    utz_u32          lock;              // only accessed atomically
+} utz_arena;
+
+void* utz_arena_calloc (utz_arena* arena, utz_usize size);
+void* utz_arena_realloc(utz_arena* arena, void* ptr, utz_usize size);
+void  utz_arena_free   (utz_arena* arena, void* ptr);
+void  utz_free_arena   (utz_arena* arena);
+
+// allocator_userdata that makes the default allocator use arena. It's tagged in the lowest bit (a utz_arena is aligned),
+// so that any other allocator_userdata isn't mistaken for an arena.
+static inline void* utz_arena_userdata(utz_arena* arena)
+{
+    return (void*)((utz_usize) arena | 1);
+}
+
+// A .tar.gz inflated once, with a directory of its members to look them up by name. The tzdb tarball has more in it
+// than utz parses, like leapseconds, zone.tab or backzone.
+typedef struct utz_tar_member
+{
+    const char* name;           // not zero terminated
+    utz_usize   name_length;
+    const char* content;
+    utz_usize   size;
+} utz_tar_member;
+
+typedef struct utz_tarball
+{
+    char*           data;           // the whole .tar, members point into it
+    utz_usize       size;
+    utz_tar_member* members;        // in archive order
+    utz_usize       member_count;
+
+    // Open addressing hash of member names, member index + 1 or 0 for an empty slot. slot_count is a power of two.
+    utz_u32*        slots;
+    utz_usize       slot_count;
+} utz_tarball;
+
+// Returns 0 if targz isn't a .tar.gz, the tarball is then empty. Cut off archives keep the members that are complete.
+int                   utz_open_targz(utz_tarball* tarball, const void* targz, int targz_size, void* allocator_userdata = NULL);
+void                  utz_free_tarball(utz_tarball* tarball, void* allocator_userdata = NULL);
+
+// Returns NULL when there is no such member. name doesn't have to be zero terminated. If the archive has a name more
+// than once, this finds the first one.
+const utz_tar_member* utz_find_tar_member(const utz_tarball* tarball, const char* name, utz_usize length);
+
+// Finds a timezone (or a link to one) by its IANA name, like "Europe/Berlin". name doesn't have to be zero terminated.
+// Returns NULL when there is no such timezone.
+utz_timezone* utz_find_timezone(utz_timezones* tzs, const char* name, utz_usize length);
+
+// A snapshot is everything in utz_timezones in one position independent block, with offsets instead of pointers.
+// Loading one doesn't parse or copy any timezone data, the block is meant to be written to a file once and mmap'd.
+//
+// utz_write_snapshot returns the size of the snapshot, and only writes it if that fits into buffer_size.
+// utz_load_snapshot keeps pointers into the snapshot, so it must stay alive (and mapped) until utz_free_timezones.
+// It has to be aligned to 64 bytes, which mmap'd memory always is. Fails with tzs->parsing_error for snapshots
+// written by a different version of utz (or on a different kind of machine), or ones that are cut short.
+utz_usize utz_write_snapshot(utz_timezones* tzs, void* buffer, utz_usize buffer_size);
+int       utz_load_snapshot (utz_timezones* tzs, const void* snapshot, utz_usize snapshot_size, void* allocator_userdata = NULL);
+
+// TZif (RFC 8536) is what zic compiles the database into, like the files in /usr/share/zoneinfo. Loading those skips
+// the rule engine, and only the zones that are asked for get loaded. Version 1 files are read too, but they end in 2037.
+// TZif has no countries, so tzs->countries stays empty and iana_version is "". Files with leap seconds are refused.
+typedef struct utz_tzif_file
+{
+    const char* name;   // IANA name, like "Europe/Berlin"
+    const void* data;
+    utz_usize   size;
+} utz_tzif_file;
+
+int utz_load_tzif(utz_timezones* tzs, const utz_tzif_file* files, utz_usize file_count, void* allocator_userdata = NULL, unsigned flags = UTZ_PARSE_DEFAULT);
+
+// Writes tz as a TZif file, version 2 (3 if its rules need it) with a POSIX TZ string for the tail. Works like
+// utz_write_snapshot: returns the size, and only writes the file if that fits into buffer_size. Returns 0 for zones
+// without ranges, or whose tail rules can't be written as a TZ string. utz doesn't keep which ranges are daylight
+// saving time, so is-DST flags are a guess. Conversions read back from the file are exactly the same.
+utz_usize utz_write_tzif(utz_timezone* tz, void* buffer, utz_usize buffer_size);
+
+#ifndef UTZ_NO_FILESYSTEM
+// Same as utz_load_tzif, reading "<directory>/<name>" for each name. With names == NULL it loads every TZif file
+// in the tree (except the posix/ and right/ copies of it), which isn't supported on Windows.
+int utz_load_tzif_directory(utz_timezones* tzs, const char* directory, const char* const* names, utz_usize name_count,
+                            void* allocator_userdata = NULL, unsigned flags = UTZ_PARSE_DEFAULT);
+#endif
+
+// The whole database compiled ahead of time, defined in the source file tools/generate_tzdata.cpp writes (`make tzdata`).
+// Only exists when that file is linked in. It's static data: nothing to parse or allocate, never utz_free_timezones it.
+extern utz_timezones utz_tzdata;
+
 utz_time_t     utz_wall_time_from_utc(utz_timezone* tz, utz_time_t utc);
 utz_conversion utz_utc_from_wall_time(utz_timezone* tz, utz_time_t wall_time);
 
+// Same as calling the functions above for every element, out may not alias in.
+// Sorted (or nearly sorted) input is detected and swept with a moving cursor instead of searching for every element.
+void utz_wall_time_from_utc_batch(utz_timezone* tz, const utz_time_t* utc,       utz_time_t*     out_wall_time, utz_usize count);
+void utz_utc_from_wall_time_batch(utz_timezone* tz, const utz_time_t* wall_time, utz_conversion* out_result,    utz_usize count);
+
+// Converts rows of (timezones[i], utc[i]) where every row can use a different zone (NULL is UTC).
+// Rows are grouped by zone internally, converted with the batch kernels and written back in input order.
+// Rows using many different zones go row by row, grouping them would cost more than it saves.
+void utz_wall_time_from_utc_multi(utz_timezone** timezones, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count);
+
+// Remembers the range of the previous conversion, so that the next conversion close to it in time
+// (log lines within the same hour) is a couple of compares instead of a search.
+// Initialize with utz_cursor_init, a cursor must not be shared between threads.
+typedef struct utz_cursor
+{
+    utz_timezone* tz;
+
+    // utc in [utc_from, utc_to) converts with utc_offset_seconds.
+    utz_time_t utc_from;
+    utz_time_t utc_to;
+    utz_s32    utc_offset_seconds;
+
+    // Wall times in [wall_from, wall_to] convert with wall_offset_seconds and UTZ_TIMESTAMP_CONVERSION_OK.
+    utz_time_t wall_from;
+    utz_time_t wall_to;
+    utz_s32    wall_offset_seconds;
+} utz_cursor;
+
+void           utz_cursor_init(utz_cursor* cursor, utz_timezone* tz);
+utz_time_t     utz_cursor_wall_time_from_utc(utz_cursor* cursor, utz_time_t utc);
+utz_conversion utz_cursor_utc_from_wall_time(utz_cursor* cursor, utz_time_t wall_time);
+
 
 // Returns UTC_TIMEZONE if the given country can't be found.
 utz_timezone* utz_default_tz_for_country(utz_timezones* tzs, const char* country_code);
@@ -159,7 +523,10 @@ int utz_utc_from_wall_time_default_tz(utz_timezones* tzs, const char* country_co
 #endif // UTZ_H_INCLUDE
 
 
+// Define UTZ_NO_IMPLEMENTATION to only get the declarations above, like the file tools/generate_tzdata.cpp emits does.
+#ifndef UTZ_NO_IMPLEMENTATION
 #define UTZ_IMPLEMENTATION // @Temporary
+#endif
 #ifdef UTZ_IMPLEMENTATION
 
 
@@ -173,6 +540,8 @@ typedef int utz_bool;
 #define UTZ_FALSE 0
 
 #define UtzArrayCount(arr) (sizeof(arr)/sizeof((arr)[0]))
+#define UtzCopyArray(dst, src) do { for (utz_usize _utz__i = 0; _utz__i < UtzArrayCount(dst); _utz__i++) (dst)[_utz__i] = (src)[_utz__i]; } while (0)
+#define UtzOffsetOf(type, member) ((utz_usize)((unsigned char*)&((type*)0)->member - (unsigned char*)0))
 
 #ifdef __cplusplus
 #define UtzInit {}
@@ -190,6 +559,36 @@ typedef int utz_bool;
 #define UTZ_BEGINNING_OF_TIME UtzMinValue(utz_time_t)
 #define UTZ_END_OF_TIME       UtzMaxValue(utz_time_t)
 
+// x86-64 builds with GCC, Clang or MSVC compile the AVX2/AVX-512 kernels regardless of
+// compiler flags and pick one at runtime, define UTZ_NO_SIMD to only use scalar code.
+#if !defined(UTZ_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+  #define UTZ_SIMD_DISPATCH
+#endif
+
+#if !defined(UTZ_NO_SIMD) && (defined(__AVX2__) || defined(__SSE4_2__) || defined(UTZ_SIMD_DISPATCH))
+  #include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+  #define UtzPrefetch(address) __builtin_prefetch((const void*)(address))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #include <xmmintrin.h>
+  #define UtzPrefetch(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+  #define UtzPrefetch(address) ((void)(address))
+#endif
+
+#ifdef UTZ_SIMD_DISPATCH
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define UTZ_TARGET_AVX2
+    #define UTZ_TARGET_AVX512
+  #else
+    #define UTZ_TARGET_AVX2   __attribute__((target("avx2")))
+    #define UTZ_TARGET_AVX512 __attribute__((target("avx512f")))
+  #endif
+#endif
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Dynamic arrays
@@ -203,7 +602,7 @@ typedef int utz_bool;
 
 #define UtzMakeDynArray(T, arrptr, init_cap) do {                                       \
     utz_usize _utz__s = sizeof(T) * (init_cap) + 2 * sizeof(utz_usize);                 \
-    *(arrptr) = (T*)(UtzCalloc((allocator_userdata), utz_u8, _utz__s) + 2 * sizeof(utz_usize)); \
+    *(arrptr) = (T*)(UtzAllocate((allocator_userdata), utz_u8, _utz__s) + 2 * sizeof(utz_usize)); \
     *UtzDynCapacityPtr(*(arrptr)) = (init_cap);                                         \
     *UtzDynCountPtr(*(arrptr)) = 0;                                                     \
 } while (0)
@@ -212,7 +611,17 @@ typedef int utz_bool;
     utz_usize _utz__c = (UtzDynCapacity(*(arrptr)) * 2);                                \
     utz_usize _utz__s = sizeof(T) * _utz__c + 2 * sizeof(utz_usize);                    \
     utz_u8*   _utz__old_raw = (utz_u8*)(*(arrptr)) - 2 * sizeof(utz_usize);             \
-    *(arrptr) = (T*)(((utz_u8*)UtzRealloc((allocator_userdata), _utz__old_raw, utz_u8, _utz__s)) \
+    *(arrptr) = (T*)(((utz_u8*)UtzReallocate((allocator_userdata), _utz__old_raw, utz_u8, _utz__s)) \
+              + 2 * sizeof(utz_usize));                                                 \
+    *UtzDynCapacityPtr(*(arrptr)) = (_utz__c);                                          \
+} while (0)
+
+// Gives back the capacity past the count, keeping at least 1 so the array can still grow.
+#define UtzShrinkDynArray(T, arrptr) do {                                               \
+    utz_usize _utz__c = UtzDynCount(*(arrptr)) ? UtzDynCount(*(arrptr)) : 1;            \
+    utz_usize _utz__s = sizeof(T) * _utz__c + 2 * sizeof(utz_usize);                    \
+    utz_u8*   _utz__old_raw = (utz_u8*)(*(arrptr)) - 2 * sizeof(utz_usize);             \
+    *(arrptr) = (T*)(((utz_u8*)UtzReallocate((allocator_userdata), _utz__old_raw, utz_u8, _utz__s)) \
               + 2 * sizeof(utz_usize));                                                 \
     *UtzDynCapacityPtr(*(arrptr)) = (_utz__c);                                          \
 } while (0)
@@ -232,6 +641,192 @@ typedef int utz_bool;
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Threads
+///////////////////////////////////////////////////////////////////////////////
+
+// Define UTZ_NO_THREADS to never start threads, everything then runs on the calling thread.
+#ifndef UTZ_NO_THREADS
+  #if defined(_WIN32)
+    #include <windows.h>
+    typedef HANDLE utz_thread;
+    #define UtzThreadProc(name)                static DWORD WINAPI name(LPVOID data)
+    #define UtzThreadReturn                    return 0
+    #define UtzStartThread(thread, proc, data) ((*(thread) = CreateThread(NULL, 0, (proc), (data), 0, NULL)) != NULL)
+    #define UtzJoinThread(thread)              (WaitForSingleObject((thread), INFINITE), CloseHandle(thread))
+  #else
+    #include <pthread.h>
+    typedef pthread_t utz_thread;
+    #define UtzThreadProc(name)                static void* name(void* data)
+    #define UtzThreadReturn                    return NULL
+    #define UtzStartThread(thread, proc, data) (pthread_create((thread), NULL, (proc), (data)) == 0)
+    #define UtzJoinThread(thread)              pthread_join((thread), NULL)
+  #endif
+  #define UTZ_THREAD_LOCAL thread_local
+#else
+  #define UTZ_THREAD_LOCAL
+#endif
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+///////////////////////////////////////////////////////////////////////////////
+
+// utz allocates with these instead of UtzCalloc/UtzRealloc. While parsing with utz_parse_stats, each thread of
+// the parse counts into the stats it's set to here.
+static UTZ_THREAD_LOCAL utz_parse_stats* utz_allocation_stats;
+
+static inline void utz_count_allocation(utz_usize size)
+{
+    utz_parse_stats* stats = utz_allocation_stats;
+    if (!stats) return;
+    stats->allocations++;
+    stats->bytes_allocated += size;
+}
+
+#define UtzAllocate(userdata_ptr, type, count) \
+    (utz_count_allocation(sizeof(type) * (count)), UtzCalloc((userdata_ptr), type, (count)))
+#define UtzReallocate(userdata_ptr, ptr, type, count) \
+    (utz_count_allocation(sizeof(type) * (count)), UtzRealloc((userdata_ptr), (ptr), type, (count)))
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Arena
+///////////////////////////////////////////////////////////////////////////////
+
+// The arena of allocator_userdata made by utz_arena_userdata, NULL for anything else.
+static inline utz_arena* utz_userdata_arena(void* allocator_userdata)
+{
+    utz_usize bits = (utz_usize) allocator_userdata;
+    return (bits & 1) ? (utz_arena*)(bits & ~(utz_usize)1) : NULL;
+}
+
+// Allocations are 16-byte aligned and have their size in the 16 bytes before them, which realloc needs. Growing or
+// freeing the last allocation of the block is done in place, that's what dynamic arrays being appended to do.
+#define UTZ_ARENA_ALIGN              16
+#define UTZ_ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+struct utz_arena_block
+{
+    utz_arena_block* previous;
+    utz_usize        size;      // including this header
+    utz_usize        used;      // from the start of the block
+    utz_usize        padding;   // keeps allocations aligned
+};
+
+static inline utz_usize utz_arena_round(utz_usize size)
+{
+    return (size + UTZ_ARENA_ALIGN - 1) & ~(utz_usize)(UTZ_ARENA_ALIGN - 1);
+}
+
+static inline utz_usize* utz_arena_size_of(void* ptr)
+{
+    return (utz_usize*)((utz_u8*) ptr - UTZ_ARENA_ALIGN);
+}
+
+static inline utz_bool utz_arena_is_last(utz_arena* arena, void* ptr)
+{
+    utz_arena_block* block = arena->block;
+    return block && (utz_u8*) ptr + utz_arena_round(*utz_arena_size_of(ptr)) == (utz_u8*) block + block->used;
+}
+
+static void utz_arena_lock(utz_arena* arena)
+{
+    // Held for a bump of a pointer, or a copy when a block runs out.
+    while (!UtzAtomicCompareExchange(&arena->lock, 0, 1)) {}
+}
+
+static void utz_arena_unlock(utz_arena* arena)
+{
+    UtzAtomicStoreRelease(&arena->lock, 0);
+}
+
+// Not zeroed. Needs the lock.
+static void* utz_arena_push(utz_arena* arena, utz_usize size)
+{
+    utz_usize        needed = UTZ_ARENA_ALIGN + utz_arena_round(size);
+    utz_arena_block* block  = arena->block;
+    if (!block || block->used + needed > block->size)
+    {
+        utz_usize block_size = arena->block_size ? arena->block_size : UTZ_ARENA_DEFAULT_BLOCK_SIZE;
+        if (block_size < sizeof(utz_arena_block) + needed) block_size = sizeof(utz_arena_block) + needed;
+
+        block = (utz_arena_block*) UtzArenaAllocateBlock(arena->block_userdata, block_size);
+        if (!block) return NULL;
+        block->previous = arena->block;
+        block->size     = block_size;
+        block->used     = sizeof(utz_arena_block);
+        arena->block    = block;
+    }
+
+    utz_u8* result = (utz_u8*) block + block->used + UTZ_ARENA_ALIGN;
+    block->used += needed;
+    *utz_arena_size_of(result) = size;
+    return result;
+}
+
+void* utz_arena_calloc(utz_arena* arena, utz_usize size)
+{
+    utz_arena_lock(arena);
+    utz_u8* result = (utz_u8*) utz_arena_push(arena, size);
+    utz_arena_unlock(arena);
+
+    for (utz_usize i = 0; result && i < size; i++) result[i] = 0;
+    return result;
+}
+
+void* utz_arena_realloc(utz_arena* arena, void* ptr, utz_usize size)
+{
+    if (!ptr) return utz_arena_calloc(arena, size);
+
+    utz_arena_lock(arena);
+    utz_usize old_size = *utz_arena_size_of(ptr);
+    if (utz_arena_is_last(arena, ptr))
+    {
+        utz_arena_block* block = arena->block;
+        utz_usize        used  = block->used - utz_arena_round(old_size) + utz_arena_round(size);
+        if (used <= block->size)
+        {
+            block->used = used;
+            *utz_arena_size_of(ptr) = size;
+            utz_arena_unlock(arena);
+            return ptr;
+        }
+    }
+
+    utz_u8* result = (utz_u8*) utz_arena_push(arena, size);
+    utz_arena_unlock(arena);
+
+    // Whoever reallocs owns ptr, nobody else writes to it meanwhile.
+    for (utz_usize i = 0; result && i < old_size && i < size; i++) result[i] = ((utz_u8*) ptr)[i];
+    return result;
+}
+
+void utz_arena_free(utz_arena* arena, void* ptr)
+{
+    if (!ptr) return;
+
+    // Only the last allocation can be given back, everything else stays until utz_free_arena.
+    utz_arena_lock(arena);
+    if (utz_arena_is_last(arena, ptr))
+        arena->block->used -= UTZ_ARENA_ALIGN + utz_arena_round(*utz_arena_size_of(ptr));
+    utz_arena_unlock(arena);
+}
+
+void utz_free_arena(utz_arena* arena)
+{
+    while (arena->block)
+    {
+        utz_arena_block* block = arena->block;
+        arena->block = block->previous;
+        UtzArenaFreeBlock(arena->block_userdata, block, block->size);
+    }
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // zlib decoding
 // Copied almost verbatim from stb_image, http://nothings.org/stb
@@ -240,9 +835,12 @@ typedef int utz_bool;
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
 //      - all input must be provided in an upfront buffer
-//      - all output is written to a single output buffer (can malloc/realloc)
+//      - all output is written to a single output buffer (can malloc/realloc),
+//        or streamed a block at a time through a small window (utz_zlib_stream_*)
 //    performance
 //      - fast huffman
+//      - 64-bit bit buffer refilled a word at a time, literal runs and word-sized match copies
+//        while there's enough input and output left (utz_zlib_parse_huffman_block)
 
 static int utz_zlib_err(const char *strm, const char* str2)
 {
@@ -340,17 +938,30 @@ static int utz_zlib_zbuild_huffman(utz_zlib_zhuffman *z, const utz_u8 *sizelist,
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
 
+// Gets the output of a stream as it's inflated, returns 0 to stop with an error.
+typedef int utz_zlib_flush_proc(void *userdata, const char *data, utz_usize size);
+
+#define UTZ_ZLIB_WINDOW_SIZE 32768 // how far back matches can reach
+
 typedef struct
 {
    utz_u8 *zbuffer, *zbuffer_end;
    int num_bits;
-   utz_u32 code_buffer;
+   utz_u64 code_buffer;
+   int zeof_padding_bits; // zero bits put in the buffer past the end of the input, see utz_zlib_fill_bits
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
 
+   // Streaming: output up to zout_flushed was handed to flush, and a full buffer is flushed and
+   // then drops everything but the window instead of growing.
+   utz_zlib_flush_proc *flush;
+   void *flush_userdata;
+   char *zout_flushed;
+   int   final_block_done;
+
    utz_zlib_zhuffman z_length, z_distance;
 } utz_zlib_zbuf;
 
@@ -364,23 +975,66 @@ inline static utz_u8 utz_zlib_zget8(utz_zlib_zbuf *z)
    return utz_zlib_zeof(z) ? 0 : *z->zbuffer++;
 }
 
+// Unaligned little-endian loads and stores for the fast paths.
+inline static utz_u64 utz_zlib_load64(const utz_u8 *p)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   utz_u64 v;
+   __builtin_memcpy(&v, p, 8);
+   return v;
+#else
+   return  (utz_u64) p[0]        | ((utz_u64) p[1] <<  8) | ((utz_u64) p[2] << 16) | ((utz_u64) p[3] << 24) |
+          ((utz_u64) p[4] << 32) | ((utz_u64) p[5] << 40) | ((utz_u64) p[6] << 48) | ((utz_u64) p[7] << 56);
+#endif
+}
+
+inline static void utz_zlib_copy8(char *dst, const char *src)
+{
+#if defined(__GNUC__)
+   __builtin_memcpy(dst, src, 8);
+#else
+   for (int i = 0; i < 8; ++i) dst[i] = src[i];
+#endif
+}
+
+// Tops the bit buffer up to 56..63 bits with one load, needs 8 bytes of input.
+inline static void utz_zlib_refill_word(utz_zlib_zbuf *z)
+{
+   z->code_buffer |= utz_zlib_load64(z->zbuffer) << z->num_bits;
+   z->zbuffer += (63 - z->num_bits) >> 3;
+   z->num_bits |= 56;
+   z->code_buffer &= ((utz_u64) 1 << z->num_bits) - 1; // drop the bits of the byte that wasn't consumed
+}
+
 static void utz_zlib_fill_bits(utz_zlib_zbuf *z)
 {
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      utz_zlib_refill_word(z);
+      return;
+   }
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
-        z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
-        return;
+      if (utz_zlib_zeof(z)) {
+         // Past the end the input reads as zeros so the last codes can be decoded speculatively, but only for
+         // a few bytes. A corrupt stream that keeps going runs out of bits (num_bits goes negative) and fails.
+         if (z->zeof_padding_bits >= 64) return;
+         z->zeof_padding_bits += 8;
       }
-      z->code_buffer |= (unsigned int) utz_zlib_zget8(z) << z->num_bits;
+      z->code_buffer |= (utz_u64) utz_zlib_zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
+}
+
+// The padding is on top of the buffer, below it only if some of it was used.
+inline static int utz_zlib_read_past_end(utz_zlib_zbuf *z)
+{
+   return z->num_bits < z->zeof_padding_bits;
 }
 
 inline static unsigned int utz_zlib_zreceive(utz_zlib_zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) utz_zlib_fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -391,7 +1045,7 @@ static int utz_zlib_zhuffman_decode_slowpath(utz_zlib_zbuf *a, utz_zlib_zhuffman
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = utz_zlib_bit_reverse(a->code_buffer, 16);
+   k = utz_zlib_bit_reverse((int) (a->code_buffer & 0xFFFF), 16);
    for (s=UTZ_ZLIB_ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -405,15 +1059,10 @@ static int utz_zlib_zhuffman_decode_slowpath(utz_zlib_zbuf *a, utz_zlib_zhuffman
    return z->value[b];
 }
 
-inline static int utz_zlib_zhuffman_decode(utz_zlib_zbuf *a, utz_zlib_zhuffman *z)
+// Decodes from the bits already in the buffer, there have to be at least 15 of them.
+inline static int utz_zlib_zhuffman_decode_buffered(utz_zlib_zbuf *a, utz_zlib_zhuffman *z)
 {
    int b,s;
-   if (a->num_bits < 16) {
-      if (utz_zlib_zeof(a)) {
-         return -1;   /* report error for unexpected end of data. */
-      }
-      utz_zlib_fill_bits(a);
-   }
    b = z->fast[a->code_buffer & UTZ_ZLIB_ZFAST_MASK];
    if (b) {
       s = b >> 9;
@@ -424,12 +1073,49 @@ inline static int utz_zlib_zhuffman_decode(utz_zlib_zbuf *a, utz_zlib_zhuffman *
    return utz_zlib_zhuffman_decode_slowpath(a, z);
 }
 
+inline static int utz_zlib_zhuffman_decode(utz_zlib_zbuf *a, utz_zlib_zhuffman *z)
+{
+   int v;
+   if (a->num_bits < 16) utz_zlib_fill_bits(a);
+   v = utz_zlib_zhuffman_decode_buffered(a, z);
+   return a->num_bits < 0 ? -1 : v;   /* report error for unexpected end of data. */
+}
+
+// Takes n bits that are known to be in the buffer.
+inline static unsigned int utz_zlib_zreceive_buffered(utz_zlib_zbuf *z, int n)
+{
+   unsigned int k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
+   z->code_buffer >>= n;
+   z->num_bits -= n;
+   return k;
+}
+
+static int utz_zlib_flush_output(utz_zlib_zbuf *z)
+{
+   utz_usize size = (utz_usize) (z->zout - z->zout_flushed);
+   if (size && !z->flush(z->flush_userdata, z->zout_flushed, size)) return utz_zlib_err("flush","Stopped");
+   z->zout_flushed = z->zout;
+   return 1;
+}
+
 static int utz_zlib_zexpand(utz_zlib_zbuf *z, char *zout, int n, void* allocator_userdata)  // need to make room for n bytes
 {
    char *q;
    unsigned int cur, limit;
    z->zout = zout;
    if (!z->z_expandable) return utz_zlib_err("output buffer limit","Corrupt PNG");
+   if (z->flush) {
+      // Keep only what matches can still reach, the buffer is twice the window so this doesn't overlap.
+      utz_usize keep = z->zout - z->zout_start < UTZ_ZLIB_WINDOW_SIZE ? (utz_usize) (z->zout - z->zout_start) : UTZ_ZLIB_WINDOW_SIZE;
+      if (!utz_zlib_flush_output(z)) return 0;
+      utz_usize i = 0;
+      for (; i + 8 <= keep; i += 8) utz_zlib_copy8(z->zout_start + i, z->zout - keep + i);
+      for (; i < keep; ++i) z->zout_start[i] = z->zout[i - keep];
+      z->zout         = z->zout_start + keep;
+      z->zout_flushed = z->zout;
+      if (z->zout + n > z->zout_end) return utz_zlib_err("output buffer limit","Corrupt PNG");
+      return 1;
+   }
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = (unsigned) (z->zout_end - z->zout_start);
    if (UtzMaxValue(unsigned) - cur < (unsigned) n) return utz_zlib_err("outofmem", "Out of memory");
@@ -437,7 +1123,7 @@ static int utz_zlib_zexpand(utz_zlib_zbuf *z, char *zout, int n, void* allocator
       if(limit > UtzMaxValue(unsigned) / 2) return utz_zlib_err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) UtzRealloc(allocator_userdata, z->zout_start, char, limit);
+   q = (char *) UtzReallocate(allocator_userdata, z->zout_start, char, limit);
    if (q == NULL) return utz_zlib_err("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -459,10 +1145,75 @@ static const int utz_zlib_zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,
 static const int utz_zlib_zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// Output the fast loop may write per symbol: two literals, the longest match and the overshoot of word copies.
+#define UTZ_ZLIB_FAST_OUTPUT_SLACK (2 + 258 + 8)
+
+// Copies a match of len bytes at distance dist, writing up to 7 bytes past the end of it.
+inline static void utz_zlib_copy_match_fast(char *zout, int len, int dist)
+{
+   const char *p   = zout - dist;
+   char       *end = zout + len;
+   if (dist >= 8) {
+      // Every word read is complete before it's written, also when the match overlaps itself.
+      do {
+         utz_zlib_copy8(zout, p);
+         zout += 8;
+         p    += 8;
+      } while (zout < end);
+   } else if (dist == 1) {
+      utz_u64 v = (utz_u8) *p * 0x0101010101010101ull;
+      do {
+         utz_zlib_copy8(zout, (const char *) &v);
+         zout += 8;
+      } while (zout < end);
+   } else {
+      do *zout++ = *p++; while (zout < end);
+   }
+}
+
 static int utz_zlib_parse_huffman_block(utz_zlib_zbuf *a, void* allocator_userdata)
 {
    char *zout = a->zout;
    for(;;) {
+      // Fast loop, as long as there are 16 bytes of input and room for a match in the output. One refill
+      // covers a length/distance pair (at most 48 bits) or three literals, a second one is only needed
+      // for a match after literals.
+      while (a->zbuffer_end - a->zbuffer >= 16) {
+         int z, len, dist, run;
+         if (a->zout_end - zout < UTZ_ZLIB_FAST_OUTPUT_SLACK) {
+            if (!a->z_expandable) break;
+            if (!utz_zlib_zexpand(a, zout, UTZ_ZLIB_FAST_OUTPUT_SLACK, allocator_userdata)) return 0;
+            zout = a->zout;
+         }
+         utz_zlib_refill_word(a);
+         z = utz_zlib_zhuffman_decode_buffered(a, &a->z_length);
+         for (run = 1; run < 3 && (unsigned) z < 256; ++run) {
+            *zout++ = (char) z;
+            z = utz_zlib_zhuffman_decode_buffered(a, &a->z_length);
+         }
+         if (z < 256) {
+            if (z < 0) return utz_zlib_err("bad huffman code","Corrupt PNG");
+            *zout++ = (char) z;
+            continue;
+         }
+         if (z == 256) {
+            a->zout = zout;
+            return 1;
+         }
+         if (z >= 286) return utz_zlib_err("bad huffman code","Corrupt PNG");
+         if (a->num_bits < 48 - 15) utz_zlib_refill_word(a);
+         z -= 257;
+         len = utz_zlib_zlength_base[z];
+         if (utz_zlib_zlength_extra[z]) len += utz_zlib_zreceive_buffered(a, utz_zlib_zlength_extra[z]);
+         z = utz_zlib_zhuffman_decode_buffered(a, &a->z_distance);
+         if (z < 0 || z >= 30) return utz_zlib_err("bad huffman code","Corrupt PNG");
+         dist = utz_zlib_zdist_base[z];
+         if (utz_zlib_zdist_extra[z]) dist += utz_zlib_zreceive_buffered(a, utz_zlib_zdist_extra[z]);
+         if (zout - a->zout_start < dist) return utz_zlib_err("bad dist","Corrupt PNG");
+         utz_zlib_copy_match_fast(zout, len, dist);
+         zout += len;
+      }
+
       int z = utz_zlib_zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return utz_zlib_err("bad huffman code","Corrupt PNG"); // error in huffman codes
@@ -476,6 +1227,7 @@ static int utz_zlib_parse_huffman_block(utz_zlib_zbuf *a, void* allocator_userda
          int len,dist;
          if (z == 256) {
             a->zout = zout;
+            if (utz_zlib_read_past_end(a)) return utz_zlib_err("unexpected end","Corrupt PNG");
             return 1;
          }
          if (z >= 286) return utz_zlib_err("bad huffman code","Corrupt PNG"); // per DEFLATE, length codes 286 and 287 must not appear in compressed data
@@ -551,32 +1303,46 @@ static int utz_zlib_compute_huffman_codes(utz_zlib_zbuf *a)
    return 1;
 }
 
+// Takes the next byte from the bit buffer while it has some, then from the input.
+inline static utz_u8 utz_zlib_zget8_aligned(utz_zlib_zbuf *a)
+{
+   utz_u8 b;
+   if (a->num_bits <= 0) return utz_zlib_zget8(a);
+   b = (utz_u8) (a->code_buffer & 255); // suppress MSVC run-time check
+   a->code_buffer >>= 8;
+   a->num_bits -= 8;
+   return b;
+}
+
 static int utz_zlib_parse_uncompressed_block(utz_zlib_zbuf *a, void* allocator_userdata)
 {
    utz_u8 header[4];
    int len,nlen,k;
    if (a->num_bits & 7)
       utz_zlib_zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (utz_u8) (a->code_buffer & 255); // suppress MSVC run-time check
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
    if (a->num_bits < 0) return utz_zlib_err("zlib corrupt","Corrupt PNG");
-   // now fill header the normal way
-   while (k < 4)
-      header[k++] = utz_zlib_zget8(a);
+   // the bit buffer holds up to 7 bytes, the header and maybe the start of the data.
+   for (k = 0; k < 4; ++k)
+      header[k] = utz_zlib_zget8_aligned(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return utz_zlib_err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return utz_zlib_err("read past buffer","Corrupt PNG");
+   if (len - a->num_bits / 8 > a->zbuffer_end - a->zbuffer) return utz_zlib_err("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
-      if (!utz_zlib_zexpand(a, a->zout, len, allocator_userdata)) return 0;
-   for (utz_usize i = 0; i < len; i++) a->zout[i] = a->zbuffer[i];
-   a->zbuffer += len;
-   a->zout += len;
+      if (!utz_zlib_zexpand(a, a->zout, a->flush ? 1 : len, allocator_userdata)) return 0;
+   // a streaming buffer can be too small for the whole block, copy what fits and flush.
+   while (len > 0) {
+      int n = a->zout_end - a->zout < len ? (int) (a->zout_end - a->zout) : len;
+      if (n == 0) {
+         if (!utz_zlib_zexpand(a, a->zout, 1, allocator_userdata)) return 0;
+         continue;
+      }
+      for (k = 0; k < n && a->num_bits > 0; ++k) a->zout[k] = (char) utz_zlib_zget8_aligned(a);
+      for (; k < n; ++k) a->zout[k] = (char) *a->zbuffer++;
+      a->zout += n;
+      len     -= n;
+   }
+   if (utz_zlib_read_past_end(a)) return utz_zlib_err("unexpected end","Corrupt PNG");
    return 1;
 }
 
@@ -623,31 +1389,39 @@ Init algorithm:
 }
 */
 
+static int utz_zlib_parse_block(utz_zlib_zbuf *a, void* allocator_userdata)
+{
+   int type;
+   a->final_block_done = utz_zlib_zreceive(a,1);
+   type = utz_zlib_zreceive(a,2);
+   if (type == 0) {
+      if (!utz_zlib_parse_uncompressed_block(a, allocator_userdata)) return 0;
+   } else if (type == 3) {
+      return 0;
+   } else {
+      if (type == 1) {
+         // use fixed code lengths
+         if (!utz_zlib_zbuild_huffman(&a->z_length  , utz_zlib_zdefault_length  , UTZ_ZLIB_ZNSYMS)) return 0;
+         if (!utz_zlib_zbuild_huffman(&a->z_distance, utz_zlib_zdefault_distance,  32)) return 0;
+      } else {
+         if (!utz_zlib_compute_huffman_codes(a)) return 0;
+      }
+      if (!utz_zlib_parse_huffman_block(a, allocator_userdata)) return 0;
+   }
+   return 1;
+}
+
 static int utz_zlib_parse_zlib(utz_zlib_zbuf *a, int parse_header, void* allocator_userdata)
 {
-   int final, type;
    if (parse_header)
       if (!utz_zlib_parse_zlib_header(a)) return 0;
    a->num_bits = 0;
    a->code_buffer = 0;
+   a->zeof_padding_bits = 0;
+   a->final_block_done = 0;
    do {
-      final = utz_zlib_zreceive(a,1);
-      type = utz_zlib_zreceive(a,2);
-      if (type == 0) {
-         if (!utz_zlib_parse_uncompressed_block(a, allocator_userdata)) return 0;
-      } else if (type == 3) {
-         return 0;
-      } else {
-         if (type == 1) {
-            // use fixed code lengths
-            if (!utz_zlib_zbuild_huffman(&a->z_length  , utz_zlib_zdefault_length  , UTZ_ZLIB_ZNSYMS)) return 0;
-            if (!utz_zlib_zbuild_huffman(&a->z_distance, utz_zlib_zdefault_distance,  32)) return 0;
-         } else {
-            if (!utz_zlib_compute_huffman_codes(a)) return 0;
-         }
-         if (!utz_zlib_parse_huffman_block(a, allocator_userdata)) return 0;
-      }
-   } while (!final);
+      if (!utz_zlib_parse_block(a, allocator_userdata)) return 0;
+   } while (!a->final_block_done);
    return 1;
 }
 
@@ -657,14 +1431,51 @@ static int utz_zlib_do_zlib(utz_zlib_zbuf *a, char *obuf, int olen, int exp, int
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->flush = NULL;
 
    return utz_zlib_parse_zlib(a, parse_header, allocator_userdata);
 }
 
+// Streaming inflate of a raw deflate stream, the output goes to flush a block at a time and only a window of
+// twice UTZ_ZLIB_WINDOW_SIZE is allocated. Call utz_zlib_stream_next_block until it's done, then utz_zlib_stream_end.
+static int utz_zlib_stream_begin(utz_zlib_zbuf *a, const char *buffer, int len, utz_zlib_flush_proc *flush, void *flush_userdata, void* allocator_userdata)
+{
+   char *p = (char *) UtzAllocate(allocator_userdata, char, 2 * UTZ_ZLIB_WINDOW_SIZE);
+   if (p == NULL) return utz_zlib_err("outofmem", "Out of memory");
+   a->zbuffer           = (utz_u8 *) buffer;
+   a->zbuffer_end       = (utz_u8 *) buffer + len;
+   a->num_bits          = 0;
+   a->code_buffer       = 0;
+   a->zeof_padding_bits = 0;
+   a->final_block_done  = 0;
+   a->zout_start        = p;
+   a->zout              = p;
+   a->zout_end          = p + 2 * UTZ_ZLIB_WINDOW_SIZE;
+   a->zout_flushed      = p;
+   a->z_expandable      = 1;
+   a->flush             = flush;
+   a->flush_userdata    = flush_userdata;
+   return 1;
+}
+
+// Inflates the next block and flushes all of it, does nothing after the final block.
+static int utz_zlib_stream_next_block(utz_zlib_zbuf *a, void* allocator_userdata)
+{
+   if (a->final_block_done) return 1;
+   if (!utz_zlib_parse_block(a, allocator_userdata)) return 0;
+   return utz_zlib_flush_output(a);
+}
+
+static void utz_zlib_stream_end(utz_zlib_zbuf *a, void* allocator_userdata)
+{
+   UtzFree(allocator_userdata, a->zout_start);
+   a->zout_start = a->zout = a->zout_end = a->zout_flushed = NULL;
+}
+
 static char *utz_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header, void* allocator_userdata)
 {
    utz_zlib_zbuf a;
-   char *p = (char *) UtzCalloc(allocator_userdata, char, initial_size);
+   char *p = (char *) UtzAllocate(allocator_userdata, char, initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (utz_u8 *) buffer;
    a.zbuffer_end = (utz_u8 *) buffer + len;
@@ -807,6 +1618,24 @@ void utz_utc_date_from_unix_timestamp(utz_date* date, utz_time_t timestamp)
 #undef DAYS_PER_4Y
 }
 
+// Days since UNIX_EPOCH of a proleptic Gregorian date, January is 1.
+// From Howard Hinnant's date algorithms, http://howardhinnant.github.io/date_algorithms.html
+static inline utz_time_t utz_days_from_civil(utz_time_t year, utz_u32 month, utz_u32 day)
+{
+    year -= (month <= 2);
+    utz_time_t era = (year >= 0 ? year : year - 399) / 400;
+    utz_u32    yoe = (utz_u32)(year - era * 400);
+    utz_u32    doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    utz_u32    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (utz_time_t)doe - 719468;
+}
+
+// Sunday is 0, UNIX_EPOCH was a Thursday.
+static inline utz_u32 utz_weekday_from_days(utz_time_t days)
+{
+    return (utz_u32)((days % 7 + 11) % 7);
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -853,7 +1682,7 @@ static utz_string utz_allocate_string(void* allocator_userdata, utz_string strin
 {
     utz_string result;
     result.length = string.length + (valid_cstr ? 1 : 0);
-    result.data   = UtzCalloc(allocator_userdata, char, result.length);
+    result.data   = UtzAllocate(allocator_userdata, char, result.length);
     for (utz_usize i = 0; i < string.length; i++)
         result.data[i] = string.data[i];
     return result;
@@ -965,6 +1794,33 @@ static utz_u32 utz_u32_from_string(utz_string string)
     return utz_consume_u32(&string);
 }
 
+// Names are short, so this mixes 8 bytes at a time and leaves the rest to the slot hash.
+static inline utz_u64 utz_mix_name_word(utz_u64 hash, utz_u64 word)
+{
+    hash  = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
+
+static utz_u64 utz_hash_name(const char* name, utz_usize length)
+{
+    utz_u64 hash = 0xCBF29CE484222325ull ^ length;
+    for (; length >= 8; name += 8, length -= 8)
+    {
+        // Fixed size, compilers turn this into a single load.
+        utz_u64 word = 0;
+        for (utz_usize i = 0; i < 8; i++) word |= (utz_u64)(utz_u8) name[i] << (8 * i);
+        hash = utz_mix_name_word(hash, word);
+    }
+
+    if (length)
+    {
+        utz_u64 word = 0;
+        for (utz_usize i = 0; i < length; i++) word |= (utz_u64)(utz_u8) name[i] << (8 * i);
+        hash = utz_mix_name_word(hash, word);
+    }
+    return hash;
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -992,47 +1848,253 @@ typedef struct utz_tar_header
                         // 500
 } utz_tar_header;
 
-typedef struct utz_tar_item
-{
-    utz_string name;
-    utz_string content;
-} utz_tar_item;
+#define UTZ_TAR_BLOCK_SIZE 512
 
-static utz_string utz_get_tar_item(utz_string data, utz_string item_name)
+// Name and content size of the member a header block starts.
+static void utz_parse_tar_header(const utz_tar_header* header, utz_string* name, utz_usize* size)
 {
-#define UTZ_TAR_BLOCK_SIZE 512
+    *name = UtzCtor2(utz_string, 0, (char*) header->name);
+    while (name->length < UtzArrayCount(header->name) && header->name[name->length] != '\0')
+        name->length++;
 
-    utz_string empty = UtzInit;
-    while (data.length)
-    {
-        if (data.length < UTZ_TAR_BLOCK_SIZE) return empty;
+    *size = 0;
+    for (utz_usize i = 0; i < UtzArrayCount(header->size) && UtzIsNumeric(header->size[i]); i++)
+        *size = *size * 8 + (header->size[i] - '0');
+}
 
-        utz_string chunk = utz_take(&data, UTZ_TAR_BLOCK_SIZE);
+// utz_open_targz is these two, they're timed separately for utz_parse_stats.
+static utz_bool utz_inflate_targz(utz_tarball* tarball, const void* targz, int targz_size, void* allocator_userdata)
+{
+    *tarball = UtzInit;
+
+    // We only care about the deflate stream inside of the .gzip file.
+    // Skip the header (10 bytes) and footer (8 bytes) and only process the stream.
+    if (targz_size < 10 + 8) return UTZ_FALSE;
 
-        struct utz_tar_header* header = (struct utz_tar_header*) chunk.data;
+    int tar_size = 0;
+    tarball->data = utz_zlib_decode_malloc_guesssize_headerflag(
+        (const char*) targz + 10, targz_size - 10 - 8,
+        1332000 /* estimated size of the tzdb tarball */, &tar_size, 0 /* don't parse zlib header */,
+        allocator_userdata
+    );
+    if (!tarball->data) return UTZ_FALSE;
+    tarball->size = (utz_usize) tar_size;
+    return UTZ_TRUE;
+}
 
-        utz_string name = { 0, header->name };
-        while (name.length < UtzArrayCount(header->name) && header->name[name.length] != '\0')
-            name.length++;
+static void utz_index_tarball(utz_tarball* tarball, void* allocator_userdata)
+{
+    // One pass over the headers, the archive ends with an empty one (or when it's cut short).
+    UtzMakeDynArray(utz_tar_member, &tarball->members, 32);
+    utz_string data = { tarball->size, tarball->data };
+    while (data.length >= UTZ_TAR_BLOCK_SIZE)
+    {
+        utz_string chunk = utz_take(&data, UTZ_TAR_BLOCK_SIZE);
 
-        utz_usize size = 0;
-        for (utz_usize i = 0; i < UtzArrayCount(header->size) && UtzIsNumeric(header->size[i]); i++)
-            size = size * 8 + (header->size[i] - '0');
+        utz_string name;
+        utz_usize  size;
+        utz_parse_tar_header((utz_tar_header*) chunk.data, &name, &size);
+        if (!name.length) break;
 
         utz_usize block_count = (size + UTZ_TAR_BLOCK_SIZE - 1) / UTZ_TAR_BLOCK_SIZE;
-        if (data.length < block_count * UTZ_TAR_BLOCK_SIZE) return empty;
+        if (data.length < block_count * UTZ_TAR_BLOCK_SIZE) break;
+
+        utz_tar_member member = { name.data, name.length, utz_take(&data, block_count * UTZ_TAR_BLOCK_SIZE).data, size };
+        UtzDynAppend(utz_tar_member, &tarball->members, &member);
+    }
+    tarball->member_count = UtzDynCount(tarball->members);
+
+    tarball->slot_count = 16;
+    while (tarball->slot_count < 2 * tarball->member_count) tarball->slot_count *= 2;
+    tarball->slots = UtzAllocate(allocator_userdata, utz_u32, tarball->slot_count);
 
-        utz_string blocks = utz_take(&data, block_count * UTZ_TAR_BLOCK_SIZE);
-        blocks.length = size;
+    utz_usize mask = tarball->slot_count - 1;
+    for (utz_usize i = 0; i < tarball->member_count; i++)
+    {
+        utz_tar_member* member = &tarball->members[i];
+        if (utz_find_tar_member(tarball, member->name, member->name_length)) continue;
 
-        if (utz_equals(item_name, name)) return blocks;
+        utz_usize slot = (utz_usize) utz_hash_name(member->name, member->name_length) & mask;
+        while (tarball->slots[slot]) slot = (slot + 1) & mask;
+        tarball->slots[slot] = (utz_u32) (i + 1);
     }
+}
 
-    return empty;
+int utz_open_targz(utz_tarball* tarball, const void* targz, int targz_size, void* allocator_userdata)
+{
+    if (!utz_inflate_targz(tarball, targz, targz_size, allocator_userdata)) return 0;
+    utz_index_tarball(tarball, allocator_userdata);
+    return 1;
+}
 
-#undef UTZ_TAR_BLOCK_SIZE
+const utz_tar_member* utz_find_tar_member(const utz_tarball* tarball, const char* name, utz_usize length)
+{
+    if (!tarball->slot_count) return NULL;
+
+    utz_string wanted = { length, (char*) name };
+    utz_usize  mask   = tarball->slot_count - 1;
+    for (utz_usize slot = (utz_usize) utz_hash_name(name, length) & mask; tarball->slots[slot]; slot = (slot + 1) & mask)
+    {
+        const utz_tar_member* member = &tarball->members[tarball->slots[slot] - 1];
+        if (utz_equals(wanted, UtzCtor2(utz_string, member->name_length, (char*) member->name))) return member;
+    }
+    return NULL;
+}
+
+void utz_free_tarball(utz_tarball* tarball, void* allocator_userdata)
+{
+    UtzFree(allocator_userdata, tarball->data);
+    UtzFreeDynArray(&tarball->members);
+    UtzFree(allocator_userdata, tarball->slots);
+    *tarball = UtzInit;
+}
+
+
+// Reads a .tar.gz while it's being inflated, without ever having all of it in memory. Only the content of
+// wanted members is kept, from when they're complete until they're taken (utz_tar_stream_take).
+typedef struct utz_tar_stream_member
+{
+    utz_string name;            // one of utz_tar_stream.wanted
+    char*      content;         // dynamic array
+} utz_tar_stream_member;
+
+typedef struct utz_tar_stream
+{
+    utz_zlib_zbuf          inflate;
+    const utz_string*      wanted;
+    utz_usize              wanted_count;
+    utz_tar_stream_member* members;         // dynamic array, complete and not taken yet
+    char*                  taken;           // content last returned by utz_tar_stream_take, freed by the next call
+
+    char                   header[UTZ_TAR_BLOCK_SIZE];
+    utz_usize              header_fill;
+    utz_usize              content_left;    // of the member being read
+    utz_usize              padding_left;    // up to the next header
+    utz_tar_stream_member  member;          // being read, if it's wanted
+    utz_bool               failed;          // the .gz is corrupt
+    void*                  allocator_userdata;
+} utz_tar_stream;
+
+static int utz_tar_stream_feed(void* userdata, const char* data, utz_usize size)
+{
+    utz_tar_stream* stream = (utz_tar_stream*) userdata;
+    void* allocator_userdata = stream->allocator_userdata;
+
+    while (size)
+    {
+        if (stream->content_left)
+        {
+            utz_usize n = size < stream->content_left ? size : stream->content_left;
+            if (stream->member.content)
+            {
+                utz_usize* count = UtzDynCountPtr(stream->member.content);
+                for (utz_usize i = 0; i < n; i++) stream->member.content[*count + i] = data[i];
+                *count += n;
+            }
+            stream->content_left -= n;
+            data += n;
+            size -= n;
+
+            if (!stream->content_left && stream->member.content)
+            {
+                UtzDynAppend(utz_tar_stream_member, &stream->members, &stream->member);
+                stream->member.content = NULL;
+            }
+        }
+        else if (stream->padding_left)
+        {
+            utz_usize n = size < stream->padding_left ? size : stream->padding_left;
+            stream->padding_left -= n;
+            data += n;
+            size -= n;
+        }
+        else
+        {
+            utz_usize n = UTZ_TAR_BLOCK_SIZE - stream->header_fill;
+            if (n > size) n = size;
+            for (utz_usize i = 0; i < n; i++) stream->header[stream->header_fill + i] = data[i];
+            stream->header_fill += n;
+            data += n;
+            size -= n;
+            if (stream->header_fill < UTZ_TAR_BLOCK_SIZE) break;
+            stream->header_fill = 0;
+
+            // The end of the archive is a couple of empty headers, they're empty members here.
+            utz_string name;
+            utz_usize  content_size;
+            utz_parse_tar_header((utz_tar_header*) stream->header, &name, &content_size);
+            stream->content_left = content_size;
+            stream->padding_left = (UTZ_TAR_BLOCK_SIZE - content_size % UTZ_TAR_BLOCK_SIZE) % UTZ_TAR_BLOCK_SIZE;
+
+            for (utz_usize i = 0; content_size && i < stream->wanted_count; i++)
+            {
+                if (!utz_equals(stream->wanted[i], name)) continue;
+                stream->member.name = stream->wanted[i];
+                UtzMakeDynArray(char, &stream->member.content, content_size);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+static utz_bool utz_tar_stream_begin(utz_tar_stream* stream, const char* deflate_stream, int deflate_stream_size,
+                                     const utz_string* wanted, utz_usize wanted_count, void* allocator_userdata)
+{
+    *stream = UtzInit;
+    stream->wanted             = wanted;
+    stream->wanted_count       = wanted_count;
+    stream->allocator_userdata = allocator_userdata;
+    UtzMakeDynArray(utz_tar_stream_member, &stream->members, 4);
+    return utz_zlib_stream_begin(&stream->inflate, deflate_stream, deflate_stream_size, utz_tar_stream_feed, stream, allocator_userdata);
+}
+
+// Inflates until the wanted member with this name is complete, and returns its content. It's valid until the next
+// call. Returns UTZ_FALSE if the member isn't in the rest of the archive, or if the archive is corrupt (stream->failed).
+static utz_bool utz_tar_stream_take(utz_tar_stream* stream, utz_string name, utz_string* out_content)
+{
+    void* allocator_userdata = stream->allocator_userdata;
+
+    UtzFreeDynArray(&stream->taken);
+    *out_content = UtzInit;
+
+    while (UTZ_TRUE)
+    {
+        utz_usize count = UtzDynCount(stream->members);
+        for (utz_usize i = 0; i < count; i++)
+        {
+            if (!utz_equals(stream->members[i].name, name)) continue;
+
+            stream->taken = stream->members[i].content;
+            *out_content  = UtzCtor2(utz_string, UtzDynCount(stream->taken), stream->taken);
+            for (utz_usize j = i + 1; j < count; j++) stream->members[j - 1] = stream->members[j];
+            *UtzDynCountPtr(stream->members) = count - 1;
+            return UTZ_TRUE;
+        }
+
+        if (stream->failed || stream->inflate.final_block_done) return UTZ_FALSE;
+        if (!utz_zlib_stream_next_block(&stream->inflate, allocator_userdata))
+        {
+            stream->failed = UTZ_TRUE;
+            return UTZ_FALSE;
+        }
+    }
 }
 
+static void utz_tar_stream_end(utz_tar_stream* stream)
+{
+    void* allocator_userdata = stream->allocator_userdata;
+
+    utz_zlib_stream_end(&stream->inflate, allocator_userdata);
+    for (utz_usize i = 0; i < UtzDynCount(stream->members); i++)
+        UtzFreeDynArray(&stream->members[i].content);
+    UtzFreeDynArray(&stream->members);
+    UtzFreeDynArray(&stream->taken);
+    UtzFreeDynArray(&stream->member.content);
+}
+
+#undef UTZ_TAR_BLOCK_SIZE
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1126,6 +2188,9 @@ static void* utz_find_by_char_array(unsigned char* base, utz_usize count, utz_us
             }
         }
 
+        // Keys are zero terminated char arrays, a longer key with `what` as its prefix comes after it.
+        if (cmp == 0 && what_size < key_size && base[mid * size + key_offset + what_size] != 0) cmp = 1;
+
         if (cmp == 0) return (void*) &base[mid * size];
 
         if (cmp < 0) lo = mid + 1;
@@ -1530,89 +2595,68 @@ static utz_bool maybe_next_day_rule(utz_string* string, utz_day_rule* rule)
     return UTZ_TRUE;
 }
 
-static utz_bool utz_apply_day_rule_to_year_and_month(utz_day_rule rule, utz_u32 year, utz_u32 month, utz_time_t* out_date_timestamp)
+// Days since UNIX_EPOCH of the day rule picks in month, for count years starting at first_year. Works the day out
+// from the weekday of the rule's date instead of trying days one by one. Fails with the first year the day doesn't
+// exist in (only rule.date that's past the end of the month for DAY_RULE_EQUAL_TO_DATE and ">=" rules).
+static utz_bool utz_day_rule_days(utz_day_rule rule, utz_u32 month, utz_u32 first_year, utz_usize count, utz_time_t* out_days, utz_u32* out_bad_year)
 {
-    utz_date date = {};
-    date.year  = year;
-    date.month = month;
+    static const utz_u8 days_in_month[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month < 1 || month > 12 || rule.date < 1) return *out_bad_year = first_year, UTZ_FALSE;
 
-    if (rule.kind == DAY_RULE_EQUAL_TO_DATE)
-    {
-        date.day = rule.date;
-        return (utz_bool) utz_maybe_unix_timestamp_from_utc_date(&date, out_date_timestamp);
-    }
-    else if (rule.kind == DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE)
+    for (utz_usize i = 0; i < count; i++)
     {
-        date.day = rule.date;
-
-        utz_time_t t = 0;
-        if (!utz_maybe_unix_timestamp_from_utc_date(&date, &t))
-            return UTZ_FALSE;
-
-        for (utz_usize i = 0; i < 7; i++)
-        {
-            utz_time_t offseted = t + i * 24 * 60 * 60;
-            utz_date with_weekday  = {};
-            utz_utc_date_from_unix_timestamp(&with_weekday, offseted);
-
-            if (with_weekday.week_day == rule.weekday)
-            {
-                *out_date_timestamp = offseted;
-                return UTZ_TRUE;
-            }
-        }
+        utz_u32  year = first_year + (utz_u32) i;
+        utz_bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        utz_u32  last = days_in_month[month - 1] + (month == 2 && leap);
+
+        // "lastSun" is Sun<=31, clamped to the end of shorter months.
+        utz_u32 date = rule.date < last ? rule.date : last;
+        if (date != rule.date && rule.kind != DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE) return *out_bad_year = year, UTZ_FALSE;
+
+        utz_time_t day = utz_days_from_civil(year, month, date);
+        if      (rule.kind == DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE)  day += (rule.weekday + 7 - utz_weekday_from_days(day)) % 7;
+        else if (rule.kind == DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE) day -= (utz_weekday_from_days(day) + 7 - rule.weekday) % 7;
+        out_days[i] = day;
     }
-    else if (rule.kind == DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE)
-    {
-        // Set date.day.
-        // rule.date can be bigger than the maximum date for this month (example: month=Feb, rule.date=31)
-        // If that's the case, seek until we get to the valid end of month.
-        utz_time_t t = 0;
-        utz_bool end_of_month_ok = UTZ_FALSE;
-        for (utz_usize i = 0; i <= 3; i++) // test 31, 30, 29, 28
-        {
-            date.day = (utz_u32)(rule.date - i);
-            if (utz_maybe_unix_timestamp_from_utc_date(&date, &t))
-            {
-                end_of_month_ok = UTZ_TRUE;
-                break;
-            }
-        }
-        if (!end_of_month_ok) return UTZ_FALSE;
-
-        for (utz_usize i = 0; i < 7; i++)
-        {
-            utz_time_t offseted = t - i * 24 * 60 * 60;
-            utz_date with_weekday  = {};
-            utz_utc_date_from_unix_timestamp(&with_weekday, offseted);
+    return UTZ_TRUE;
+}
 
-            if (with_weekday.week_day == rule.weekday)
-            {
-                *out_date_timestamp = offseted;
-                return UTZ_TRUE;
-            }
-        }
-    }
-    else UtzAssert(0 && "Unreachable code");
+static utz_bool utz_apply_day_rule_to_year_and_month(utz_day_rule rule, utz_u32 year, utz_u32 month, utz_time_t* out_date_timestamp)
+{
+    utz_time_t day      = 0;
+    utz_u32    bad_year = 0;
+    if (!utz_day_rule_days(rule, month, year, 1, &day, &bad_year)) return UTZ_FALSE;
 
-    return UTZ_FALSE;
+    *out_date_timestamp = day * 24 * 60 * 60;
+    return UTZ_TRUE;
 }
 
 
+// One rule line, rules aren't expanded into years up front.
 typedef struct utz_parsed_savings_rule
 {
-    utz_time_t    active_since;
+    utz_u32       from_year;
+    utz_u32       to_year;              // UTZ_RULE_YEAR_MAX when the rule is still in effect ("max")
+    utz_u32       month;
+    utz_day_rule  day_rule;
+    utz_u32       active_since;         // time of day
     utz_date_kind active_since_kind;
     utz_s32       offset_from_base_offset_seconds;
     utz_string    abbreviation_substitution;
-    utz_time_t    sorted_by; // timestamp offseted by UTZ_BEGINNING_OF_TIME
+
+    // The day (since UNIX_EPOCH) the rule changes clocks in from_year and on, see utz_rule_day.
+    utz_time_t*   days;
+    utz_u32       day_count;
 } utz_parsed_savings_rule;
 
+#define UTZ_RULE_YEAR_MAX UtzMaxValue(utz_u32)
+
 typedef struct utz_parsed_zone
 {
     utz_time_t    until;
     utz_date_kind until_kind;
     utz_s32       standard_offset_seconds;
+    utz_s32       savings_seconds;      // set when the RULES column is a fixed amount instead of a rule name
     utz_string    rule;
     utz_string    abbreviation_format;
 } utz_parsed_zone;
@@ -1625,7 +2669,8 @@ typedef struct utz_parsed_link
 
 
 // range->zone_abbreviation must be zeroed.
-static utz_bool utz_get_abbreviation(utz_time_range* range, utz_parsed_zone* zone, utz_parsed_savings_rule* rule)
+// letters.data == NULL means the letters aren't known, which fails for formats that need them.
+static utz_bool utz_get_abbreviation(utz_time_range* range, utz_parsed_zone* zone, utz_s32 savings_seconds, utz_string letters)
 {
     // Handle CET/CEST case.
     utz_string fmt = zone->abbreviation_format;
@@ -1635,7 +2680,7 @@ static utz_bool utz_get_abbreviation(utz_time_range* range, utz_parsed_zone* zon
         if (fmt.data[i] != '/') continue;
 
         utz_usize from = 0, to = i;
-        if (rule && rule->offset_from_base_offset_seconds != 0)
+        if (savings_seconds != 0)
             from = i + 1, to = fmt.length;
 
         if (to - from > UtzArrayCount(range->zone_abbreviation) - 1) return UTZ_FALSE;
@@ -1651,7 +2696,8 @@ static utz_bool utz_get_abbreviation(utz_time_range* range, utz_parsed_zone* zon
     {
         if (fmt.data[i] != '%' || fmt.data[i + 1] != 's') continue;
 
-        utz_string substitution = rule ? rule->abbreviation_substitution : UtzStr("");
+        utz_string substitution = letters;
+        if (!substitution.data) return UTZ_FALSE;
 
         if (fmt.length - 2 + substitution.length > UtzArrayCount(range->zone_abbreviation) - 1)
             return UTZ_FALSE;
@@ -1674,916 +2720,4149 @@ static utz_bool utz_get_abbreviation(utz_time_range* range, utz_parsed_zone* zon
 }
 
 
-int utz_parse_iana_tzdb_targz(utz_timezones* tzs, void* targz, int targz_size, void* allocator_userdata, unsigned max_year)
+// Builds the structure-of-arrays view of tz->ranges. tz->ranges must be final.
+static void utz_build_range_arrays(utz_timezone* tz, void* allocator_userdata)
 {
-    //
-    // helper macros
-    //
+    utz_usize count = tz->range_count;
 
-#define CopyToCharArray(str, arr, doing_what) do {                      \
-    if ((str).length + 1 > UtzArrayCount(arr))                          \
-        ReportError("String '%.*s' didn't fit in char array while doing %s", \
-        UtzStringArgs(str), (doing_what));                              \
-    for (utz_usize _utz__i = 0; _utz__i < (str).length; _utz__i++)      \
-        (arr)[_utz__i] = (str).data[_utz__i];                           \
-    (arr)[(str).length] = '\0';                                         \
-} while (0)
+    // Deduplicate abbreviations first, there are only a handful per zone.
+    char      abbreviations[256][5 + 1];
+    utz_usize abbreviation_count = 0;
+    for (utz_usize i = 0; i < count; i++)
+    {
+        utz_usize a = 0;
+        while (a < abbreviation_count && !utz_equals(UtzStr(tz->ranges[i].zone_abbreviation), abbreviations[a]))
+            a++;
+        if (a < abbreviation_count) continue;
+
+        UtzAssert(abbreviation_count < UtzArrayCount(abbreviations));
+        for (utz_usize c = 0; c < UtzArrayCount(abbreviations[a]); c++)
+            abbreviations[a][c] = tz->ranges[i].zone_abbreviation[c];
+        abbreviation_count++;
+    }
 
-#define UtzOffsetOf(type, member) ((utz_usize)((unsigned char*)&((type*)0)->member - (unsigned char*)0))
+    utz_usize since_size   = count * sizeof(utz_time_t);
+    utz_usize offsets_size = count * sizeof(utz_s32);
+    utz_usize abbrevs_size = abbreviation_count * sizeof(abbreviations[0]);
+    utz_usize index_size   = count * sizeof(utz_u8);
 
-#define SortByCharArray(type, field, arr) utz_radix_sort( \
-    (utz_u8*)(arr), UtzDynCount(arr), sizeof(type), UtzOffsetOf(type, field), sizeof((UtzCtor1(type, 0)).field), UTZ_TRUE)
+    utz_u8* block = UtzAllocate(allocator_userdata, utz_u8, 2 * since_size + offsets_size + abbrevs_size + 2 * index_size);
+    tz->range_since              = (utz_time_t*)     (block);
+    tz->range_wall_until         = (utz_time_t*)     (block + since_size);
+    tz->range_offset_seconds     = (utz_s32*)        (block + 2 * since_size);
+    tz->abbreviations            = (char(*)[5 + 1])  (block + 2 * since_size + offsets_size);
+    tz->range_abbreviation_index = (utz_u8*)         (block + 2 * since_size + offsets_size + abbrevs_size);
+    tz->range_wall_flags         = (utz_u8*)         (block + 2 * since_size + offsets_size + abbrevs_size + index_size);
+    tz->abbreviation_count       = abbreviation_count;
 
-#define FindByCharArray(type, field, arr, what) \
-    ((type*) utz_find_by_char_array( \
-        (unsigned char*)(arr), UtzDynCount(arr), \
-        sizeof(type), UtzOffsetOf(type, field), sizeof((UtzCtor1(type, 0)).field), \
-        (unsigned char*)(what).data, (what).length))
+    for (utz_usize a = 0; a < abbreviation_count; a++)
+        for (utz_usize c = 0; c < UtzArrayCount(abbreviations[a]); c++)
+            tz->abbreviations[a][c] = abbreviations[a][c];
 
-#define FreeNestedDynArray(arrptr, member) do {        \
-    for (utz_usize _utz__i = 0; _utz__i < UtzDynCount(*(arrptr)); _utz__i++) \
-        UtzFreeDynArray(&(*(arrptr))[_utz__i].member); \
-    UtzFreeDynArray(arrptr);                           \
-} while (0)
+    for (utz_usize i = 0; i < count; i++)
+    {
+        utz_usize a = 0;
+        while (!utz_equals(UtzStr(tz->ranges[i].zone_abbreviation), tz->abbreviations[a]))
+            a++;
 
-    //
-    // macros for error reporting and tar handling.
-    //
+        tz->range_since[i]              = tz->ranges[i].since;
+        tz->range_offset_seconds[i]     = tz->ranges[i].offset_seconds;
+        tz->range_abbreviation_index[i] = (utz_u8) a;
+    }
 
-    utz_string current_file = UtzStr("N/A");
-    utz_string current_line = UtzStr("N/A");
+    // A wall time belongs to the first range whose end, read on that range's clock, is not before it.
+    // Those ends aren't monotonic in general (an offset change can be larger than a range), so keep a running maximum.
+    // The first range with wall_time <= range_wall_until[i] is still exactly the first one with wall_time <= its own end.
+    for (utz_usize i = 0; i < count; i++)
+    {
+        utz_time_t until = UTZ_END_OF_TIME;
+        if (i + 1 < count)
+        {
+            until = tz->range_since[i + 1] + tz->range_offset_seconds[i];
+            if (i > 0 && until < tz->range_wall_until[i - 1])
+                until = tz->range_wall_until[i - 1];
+        }
+        tz->range_wall_until[i] = until;
 
-#ifndef UTZ_NO_SPRINTF
-#define ReportError(fmt, ...) do {                                      \
-    char* buf = UtzCalloc(allocator_userdata, char, 2048);                        \
-    UtzSprintf(buf, 2048, "Error: " fmt "\nFile: %.*s\nLine: %.*s\n",   \
-               __VA_ARGS__, UtzStringArgs(current_file), UtzStringArgs(current_line)); \
-    tzs->parsing_error = buf;                                           \
-    return UTZ_FALSE;                                                   \
-} while (0)
-#else
-#define ReportError(fmt, ...) do { \
-    tzs->parsing_error = "Compile utz with sprintf support for a more detailed error."; \
-    goto cleanup;                  \
-} while (0)
-#endif
+        utz_u8 wall_flags = 0;
+        if (i > 0         && tz->range_offset_seconds[i]     >  tz->range_offset_seconds[i - 1]) wall_flags |= UTZ_WALL_GAP_BEFORE;
+        if (i + 1 < count && tz->range_offset_seconds[i + 1] <= tz->range_offset_seconds[i])     wall_flags |= UTZ_WALL_OVERLAP_AFTER;
+        tz->range_wall_flags[i] = wall_flags;
+    }
+}
 
-#define ReportStaticError(str) do {                                       \
-    tzs->parsing_error = utz_allocate_string(allocator_userdata, UtzStr(str)).data; \
-    goto cleanup;                                                         \
-} while (0)
 
-#define MustFindFile(filename) do {                      \
-    current_file = utz_get_tar_item(tar_data, filename); \
-    if (!current_file.length) {                          \
-        utz_string _utz__s = (filename);                 \
-        ReportError("Missing file '%.*s' in iana tarball.", UtzStringArgs(_utz__s)); \
-    } \
-} while (0)
+#define UTZ_SEARCH_INDEX_NODE_KEYS 8
 
-    typedef struct utz_rules_bundle
-    {
-        utz_string               name;
-        utz_parsed_savings_rule* rules;
-        utz_bool                 sorted_previously;
-    } utz_rules_bundle;
+// Fills the implicit B-tree in key order. Children of node k are k * (NODE_KEYS + 1) + 1 + i.
+static void utz_fill_search_index_node(utz_timezone* tz, utz_usize node, utz_usize* next_range)
+{
+    if (node >= tz->search_index_node_count) return;
 
-    typedef struct utz_zones_bundle
+    for (utz_usize i = 0; i < UTZ_SEARCH_INDEX_NODE_KEYS; i++)
     {
-        utz_string       name;
-        utz_parsed_zone* zones;
-    } utz_zones_bundle;
+        utz_fill_search_index_node(tz, node * (UTZ_SEARCH_INDEX_NODE_KEYS + 1) + 1 + i, next_range);
 
-    utz_parsed_link*  last_parsed_links = NULL;
-    utz_rules_bundle* last_rule_bundles = NULL;
-    utz_zones_bundle* last_zone_bundles = NULL;
+        utz_usize slot = node * UTZ_SEARCH_INDEX_NODE_KEYS + i;
+        if (*next_range < tz->range_count)
+        {
+            tz->search_index_keys [slot] = tz->range_since[*next_range];
+            tz->search_index_ranks[slot] = (utz_u32) *next_range;
+            (*next_range)++;
+        }
+        else
+        {
+            tz->search_index_keys [slot] = UTZ_END_OF_TIME;
+            tz->search_index_ranks[slot] = (utz_u32) tz->range_count;
+        }
+    }
 
+    utz_fill_search_index_node(tz, node * (UTZ_SEARCH_INDEX_NODE_KEYS + 1) + 1 + UTZ_SEARCH_INDEX_NODE_KEYS, next_range);
+}
 
-    *tzs = UtzInit;
+// Requires utz_build_range_arrays and the tail.
+static void utz_classify_timezone(utz_timezone* tz)
+{
+    utz_usize count = tz->range_count;
+    if (count == 0)
+    {
+        tz->kind                   = UTZ_TIMEZONE_FIXED;
+        tz->settled_offset_seconds = 0;
+        tz->settled_since          = 0;
+        tz->settled_wall_since     = 0;
+        return;
+    }
 
-    { // nedless scope to avoid "goto over variable initializations" error
+    // Ranges go back before UNIX_EPOCH, but conversions pretend there are no timezones before it.
+    if      (tz->tail_change_count)            tz->kind = UTZ_TIMEZONE_RECURRING;
+    else if (tz->range_since[count - 1] <= 0)  tz->kind = UTZ_TIMEZONE_FIXED;
+    else                                       tz->kind = UTZ_TIMEZONE_HISTORICAL;
 
-    // We only care about the deflate stream inside of the .gzip file.
-    // Skip the header (10 bytes) and footer (8 bytes) and only process the stream.
+    if (tz->kind == UTZ_TIMEZONE_RECURRING)
+    {
+        tz->settled_offset_seconds = 0;
+        tz->settled_since          = UTZ_END_OF_TIME;
+        tz->settled_wall_since     = UTZ_END_OF_TIME;
+        return;
+    }
 
-    char* deflate_stream_start = (char*)targz + 10;
-    int   deflate_stream_size  = targz_size - 10 - 8;
+    // Wall times resolve to the last range after the previous range's wall times are over,
+    // and are valid once they are past a possible gap at the start of the last range.
+    tz->settled_offset_seconds = tz->range_offset_seconds[count - 1];
+    tz->settled_since          = (tz->range_since[count - 1] > 0) ? tz->range_since[count - 1] : 0;
+    tz->settled_wall_since     = (tz->range_since[count - 1] == UTZ_BEGINNING_OF_TIME) ? UTZ_BEGINNING_OF_TIME
+                                                                                       : tz->range_since[count - 1] + tz->settled_offset_seconds;
+    if (count > 1 && tz->range_wall_until[count - 2] + 1 > tz->settled_wall_since)
+        tz->settled_wall_since = tz->range_wall_until[count - 2] + 1;
+}
 
-    if (deflate_stream_size < 0 || deflate_stream_size > targz_size)
-        ReportStaticError("Invalid gzip file: doesn't contain header and/or footer.");
+// Requires utz_build_range_arrays.
+static void utz_build_search_index(utz_timezone* tz, void* allocator_userdata)
+{
+    tz->search_index_node_count = (tz->range_count + UTZ_SEARCH_INDEX_NODE_KEYS - 1) / UTZ_SEARCH_INDEX_NODE_KEYS;
 
-    int tar_size = 0;
-    char* tarball = utz_zlib_decode_malloc_guesssize_headerflag(
-        deflate_stream_start, deflate_stream_size,
-        1332000 /* estimated size */, &tar_size, 0 /* don't parse zlib header */,
-        allocator_userdata
-    );
-    if (!tarball) ReportStaticError("Failed to decompress .tar.gz");
+    utz_usize slots = tz->search_index_node_count * UTZ_SEARCH_INDEX_NODE_KEYS;
 
-    utz_string tar_data = { (utz_usize)tar_size, tarball };
+    // Keys are placed on a cache line boundary. The offset is stored right before the keys so the block can be freed.
+    // Ranks get one extra slot, the search reads one past a node when all of its keys are smaller.
+    utz_usize keys_size  = slots * sizeof(utz_time_t);
+    utz_usize ranks_size = (slots + 1) * sizeof(utz_u32);
+    utz_u8*   block      = UtzAllocate(allocator_userdata, utz_u8, 64 + keys_size + ranks_size);
+    utz_u8*   keys       = (utz_u8*)(((utz_usize)block + 64) & ~(utz_usize)63);
+    keys[-1] = (utz_u8)(keys - block);
 
+    tz->search_index_keys  = (utz_time_t*) keys;
+    tz->search_index_ranks = (utz_u32*)   (keys + keys_size);
 
-    //
-    // version and changelog.
-    //
+    utz_usize next_range = 0;
+    utz_fill_search_index_node(tz, 0, &next_range);
+    UtzAssert(next_range == tz->range_count);
+}
 
-    MustFindFile(UtzStr("version"));
+static void utz_free_search_index(utz_timezone* tz, void* allocator_userdata)
+{
+    if (!tz->search_index_keys) return;
+    utz_u8* keys = (utz_u8*) tz->search_index_keys;
+    UtzFree(allocator_userdata, keys - keys[-1]);
+}
 
-    // Trim trailing whitespace.
-    while (UtzIsSpaceByte(current_file.data[current_file.length - 1]))
-        current_file.length--;
 
-    CopyToCharArray(current_file, tzs->iana_version, "reading iana version");
+// Two uppercase letters map to [0, 26 * 26), anything else to 26 * 26 or more.
+static inline utz_usize utz_country_code_index(const char* code)
+{
+    utz_usize first = (utz_usize)((utz_u8) code[0] - 'A');
+    if (first >= 26) return 26 * 26;
 
+    utz_usize second = (utz_usize)((utz_u8) code[1] - 'A');
+    if (second >= 26 || code[2] != '\0') return 26 * 26;
 
-    //
-    // parse tzs.
-    //
+    return first * 26 + second;
+}
 
-    utz_string timezone_filenames[] = {
-        UtzStr("africa"),
-        UtzStr("antarctica"),
-        UtzStr("asia"),
-        UtzStr("australasia"),
-        UtzStr("europe"),
-        UtzStr("northamerica"),
-        UtzStr("southamerica"),
-    };
+// Maps x to [0, count) with a multiply instead of a division.
+static inline utz_usize utz_reduce(utz_u32 x, utz_usize count)
+{
+    return (utz_usize)(((utz_u64)x * (utz_u64)count) >> 32);
+}
 
-    UtzMakeDynArray(utz_timezone, &tzs->timezones, 128);
+static inline utz_usize utz_name_hash_bucket(utz_u64 hash, utz_usize seed_count)
+{
+    return utz_reduce((utz_u32) hash, seed_count);
+}
 
-    utz_parsed_link* links = NULL;
-    UtzMakeDynArray(utz_parsed_link, &links, 128);
-    last_parsed_links = links;
+static inline utz_usize utz_name_hash_slot(utz_u64 hash, utz_u32 seed, utz_usize slot_count)
+{
+    // splitmix64 finalizer, so that every seed gives an unrelated slot.
+    utz_u64 x = hash + (utz_u64)seed * 0x9E3779B97F4A7C15ull;
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return utz_reduce((utz_u32)(x >> 32), slot_count);
+}
 
-    for (utz_usize i = 0; i < UtzArrayCount(timezone_filenames); i++)
+#define UTZ_NAME_HASH_KEYS_PER_SEED 4
+#define UTZ_NAME_HASH_MAX_SEED      (1 << 20)
+
+// Hash and displace: names are split into buckets, then for every bucket (biggest first) we look for a seed
+// that puts all of its names into free slots. There are exactly as many slots as names.
+// Returns false if no seeds were found, utz_find_timezone then falls back to a binary search.
+static utz_bool utz_build_name_hash(utz_timezones* tzs, void* allocator_userdata)
+{
+    utz_usize count      = tzs->timezone_count;
+    utz_usize seed_count = count / UTZ_NAME_HASH_KEYS_PER_SEED + 1;
+    if (count == 0) return UTZ_FALSE;
+
+    utz_u32* table = UtzAllocate(allocator_userdata, utz_u32, seed_count + count);
+    tzs->name_hash_seeds      = table;
+    tzs->name_hash_slots      = table + seed_count;
+    tzs->name_hash_seed_count = seed_count;
+
+    // Scratch: hashes, names grouped by bucket (counting sort), and which slots are taken.
+    utz_usize scratch_size = count * sizeof(utz_u64) + (seed_count + 1) * sizeof(utz_usize) + count * sizeof(utz_usize) + count;
+    utz_u8*    scratch      = UtzAllocate(allocator_userdata, utz_u8, scratch_size);
+    utz_u64*   hashes       = (utz_u64*)   (scratch);
+    utz_usize* bucket_start = (utz_usize*) (scratch + count * sizeof(utz_u64));
+    utz_usize* by_bucket    = (utz_usize*) (scratch + count * sizeof(utz_u64) + (seed_count + 1) * sizeof(utz_usize));
+    utz_u8*    taken        = (utz_u8*)    (scratch + count * sizeof(utz_u64) + (seed_count + 1) * sizeof(utz_usize) + count * sizeof(utz_usize));
+
+    for (utz_usize i = 0; i < count; i++)
     {
-        utz_string filename = timezone_filenames[i];
-        MustFindFile(filename);
-        utz_string data = current_file;
+        utz_timezone* tz = &tzs->timezones[i];
+        utz_usize length = 0;
+        while (tz->name[length]) length++;
 
-        utz_rules_bundle* rule_bundles = NULL;
-        utz_zones_bundle* zone_bundles = NULL;
-        UtzMakeDynArray(utz_rules_bundle, &rule_bundles, 32);
-        UtzMakeDynArray(utz_zones_bundle, &zone_bundles, 32);
-        last_rule_bundles = rule_bundles;
-        last_zone_bundles = zone_bundles;
+        hashes[i] = utz_hash_name(tz->name, length);
+        bucket_start[utz_name_hash_bucket(hashes[i], seed_count) + 1]++;
+    }
 
-        // Add empty rule, simplifies lookup logic later.
-        {
-            utz_rules_bundle rule_bundle = UtzInit;
-            UtzDynAppend(utz_rules_bundle, &rule_bundles, &rule_bundle);
-            last_rule_bundles = rule_bundles;
-        }
+    utz_usize biggest = 0;
+    for (utz_usize b = 0; b < seed_count; b++)
+    {
+        if (bucket_start[b + 1] > biggest) biggest = bucket_start[b + 1];
+        bucket_start[b + 1] += bucket_start[b];
+    }
 
-        while (utz_maybe_next_line(&data, &current_line))
-        {
-            utz_string line = current_line;
+    // Place names using bucket_start as a cursor, which moves every start to the next bucket's. Then move them back.
+    for (utz_usize i = 0; i < count; i++)
+        by_bucket[bucket_start[utz_name_hash_bucket(hashes[i], seed_count)]++] = i;
+    for (utz_usize b = seed_count; b > 0; b--)
+        bucket_start[b] = bucket_start[b - 1];
+    bucket_start[0] = 0;
 
-            utz_string command = utz_next(&line);
-            if (!command.length) continue;
+    utz_bool ok = UTZ_TRUE;
+    for (utz_usize size = biggest; size > 0 && ok; size--)
+    {
+        for (utz_usize b = 0; b < seed_count && ok; b++)
+        {
+            utz_usize first = bucket_start[b];
+            if (bucket_start[b + 1] - first != size) continue;
 
-            if (utz_equals(command, UtzStr("Rule")))
+            utz_u32 seed = 0;
+            for (; seed < UTZ_NAME_HASH_MAX_SEED; seed++)
             {
-                utz_parsed_savings_rule rule = {};
+                // Take slots one by one, give them back if one is already taken.
+                utz_usize placed = 0;
+                while (placed < size)
+                {
+                    utz_usize slot = utz_name_hash_slot(hashes[by_bucket[first + placed]], seed, count);
+                    if (taken[slot]) break;
+                    taken[slot] = 1;
+                    placed++;
+                }
+                if (placed == size) break;
 
-                if (!utz_peek(line, UTZ_TOKEN_WORD))
-                    ReportStaticError("Failed to parse rule.name");
-                utz_string name = utz_next(&line);
+                for (utz_usize k = 0; k < placed; k++)
+                    taken[utz_name_hash_slot(hashes[by_bucket[first + k]], seed, count)] = 0;
+            }
 
-                if (!utz_peek(line, UTZ_TOKEN_YEAR))
-                    ReportStaticError("rule.from_year bad or not in valid range.");
-                utz_u32 from_year = utz_u32_from_string(utz_next(&line));
+            if (seed == UTZ_NAME_HASH_MAX_SEED) { ok = UTZ_FALSE; break; }
 
-                utz_u32 to_year = 0;
-                     if (utz_peek(line, UTZ_TOKEN_YEAR))        to_year = utz_u32_from_string(utz_next(&line));
-                else if (utz_maybe_next(&line, UtzStr("only"))) to_year = from_year;
-                else if (utz_maybe_next(&line, UtzStr("max")))  to_year = max_year;
-                else ReportStaticError("Invalid rule.to_year");
+            tzs->name_hash_seeds[b] = seed;
+            for (utz_usize k = 0; k < size; k++)
+                tzs->name_hash_slots[utz_name_hash_slot(hashes[by_bucket[first + k]], seed, count)] = (utz_u32) by_bucket[first + k];
+        }
+    }
 
-                if (!utz_maybe_next(&line, UtzStr("-")))
-                    ReportStaticError("Expected '-' between rule.to_year and rule.month");
+    UtzFree(allocator_userdata, scratch);
+    if (!ok)
+    {
+        UtzFree(allocator_userdata, table);
+        tzs->name_hash_seeds      = NULL;
+        tzs->name_hash_slots      = NULL;
+        tzs->name_hash_seed_count = 0;
+    }
+    return ok;
+}
 
-                if (!utz_peek(line, UTZ_TOKEN_MONTH))
-                    ReportStaticError("Bad rule.month");
-                utz_u32 month = utz_must_parse_month(utz_next(&line));
 
-                utz_day_rule day_rule = {};
-                if (!maybe_next_day_rule(&line, &day_rule))
-                    ReportStaticError("Bad rule.day_rule");
+#define UTZ_BUCKET_MAX_SHIFT          26 // ~2 years
+#define UTZ_BUCKET_MIN_SHIFT          16 // ~18 hours
+#define UTZ_BUCKET_MAX_BOUNDARIES      2 // per bucket, for both range_since and range_wall_until
+#define UTZ_BUCKET_MAX_PER_RANGE       4 // memory bound, buckets per range (plus a few)
 
-                utz_u32 hms_date_part = 0;
-                if (!utz_maybe_next_hms_date_part(&line, &hms_date_part, &rule.active_since_kind))
-                    ReportStaticError("Bad rule.change_at_hm");
+// Most boundaries that fall into one bucket, counting range_since and range_wall_until separately.
+static utz_usize utz_most_boundaries_per_bucket(const utz_timezone* tz, utz_u32 shift)
+{
+    utz_usize most = 0;
+    for (int wall = 0; wall < 2; wall++)
+    {
+        // Boundaries are range_since[1..count-1] and range_wall_until[0..count-2], both never decrease.
+        const utz_time_t* keys  = wall ? tz->range_wall_until : tz->range_since + 1;
+        utz_usize         count = tz->range_count - 1;
+        utz_usize         run   = 0;
+        for (utz_usize i = 0; i < count; i++)
+        {
+            run = (i > 0 && (keys[i] >> shift) == (keys[i - 1] >> shift)) ? run + 1 : 1;
+            if (run > most) most = run;
+        }
+    }
+    return most;
+}
 
-                if (!utz_maybe_next_hms_duration(&line, &rule.offset_from_base_offset_seconds))
-                    ReportStaticError("Bad rule.offset_from_standard_hm");
+// Requires utz_build_range_arrays.
+static void utz_build_bucket_index(utz_timezone* tz, void* allocator_userdata)
+{
+    utz_usize count = tz->range_count;
+    if (count < 2) return; // Nothing to search.
 
-                if (!utz_maybe_next(&line, UtzStr("-")))
-                {
-                    if (!utz_peek(line, UTZ_TOKEN_WORD))
-                        ReportStaticError("Bad rule.abbreviation_substitution");
-                    rule.abbreviation_substitution = utz_next(&line);
-                }
+    utz_time_t last_boundary = tz->range_since[count - 1];
+    if (tz->range_wall_until[count - 2] > last_boundary) last_boundary = tz->range_wall_until[count - 2];
+    if (last_boundary < 0) return;
 
-                if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+    // Go down from about a year per bucket until buckets are small enough, or until the index would get too big.
+    utz_u32 shift = UTZ_BUCKET_MAX_SHIFT;
+    while (shift > UTZ_BUCKET_MIN_SHIFT && utz_most_boundaries_per_bucket(tz, shift) > UTZ_BUCKET_MAX_BOUNDARIES)
+    {
+        utz_usize bucket_count = (utz_usize)(last_boundary >> (shift - 1)) + 1;
+        if (bucket_count > UTZ_BUCKET_MAX_PER_RANGE * count + 64) break;
+        shift--;
+    }
 
-                utz_rules_bundle* rule_bundle = NULL;
-                for (utz_usize i = 0; i < UtzDynCount(rule_bundles); i++)
-                {
-                    if (utz_equals(rule_bundles[i].name, name))
-                    {
-                        rule_bundle = &rule_bundles[i];
-                        break;
-                    }
-                }
-                if (!rule_bundle)
-                {
-                    utz_rules_bundle zero = UtzInit;
-                    UtzDynAppend(utz_rules_bundle, &rule_bundles, &zero);
-                    last_rule_bundles = rule_bundles;
+    tz->bucket_shift            = shift;
+    tz->bucket_count            = (utz_usize)(last_boundary >> shift) + 1;
+    tz->bucket_first_range      = UtzAllocate(allocator_userdata, utz_u32, 2 * tz->bucket_count);
+    tz->bucket_first_wall_range = tz->bucket_first_range + tz->bucket_count;
 
-                    rule_bundle = UtzDynGetLast(rule_bundles);
-                    rule_bundle->name = name;
-                    UtzMakeDynArray(utz_parsed_savings_rule, &rule_bundle->rules, 32);
-                }
-                UtzAssert(rule_bundle);
+    utz_usize range      = 0;
+    utz_usize wall_range = 0;
+    for (utz_usize b = 0; b < tz->bucket_count; b++)
+    {
+        utz_time_t start = (utz_time_t)b << shift;
+        while (range + 1 < count && tz->range_since[range + 1] <= start) range++;
+        while (tz->range_wall_until[wall_range] < start)                 wall_range++;
 
-                printf("DEBUG: year: %04u - %04u\n", from_year, to_year);
+        tz->bucket_first_range     [b] = (utz_u32) range;
+        tz->bucket_first_wall_range[b] = (utz_u32) wall_range;
+    }
+}
 
-                for (utz_u32 year = from_year; year <= to_year; year++)
-                {
-                    if (!utz_apply_day_rule_to_year_and_month(day_rule, year, month, &rule.active_since))
-                        ReportError("Bad rule '%.*s': Can't apply day_rule.kind=%d to year=%04u month=%02u", UtzStringArgs(name), day_rule.kind, year, month);
 
-                    rule.active_since += hms_date_part;
-                    UtzDynAppend(utz_parsed_savings_rule, &rule_bundle->rules, &rule);
-                }
-            }
-            else if (utz_equals(command, UtzStr("Zone")))
-            {
-                if (!utz_peek(line, UTZ_TOKEN_WORD))
-                    ReportStaticError("Missing zone.name.");
-                utz_string name = utz_next(&line);
+// What a parsing step needs to report an error. Steps return UTZ_FALSE after setting error.
+typedef struct utz_parse_context
+{
+    utz_string  file;       // what's being parsed, for the error message
+    utz_string  line;
+    const char* error;
+    void*       allocator_userdata;     // for the result (and error)
+    void*       scratch_userdata;       // for what's freed again before parsing is done, see utz_begin_scratch
+    unsigned    max_year;               // how far rules that never end are expanded when they can't be a tail
+
+    // Only set when parsing with utz_parse_stats. file_stats is for the source file named file_name.
+    utz_parse_stats*      stats;
+    utz_parse_file_stats* file_stats;
+    utz_string            file_name;
+} utz_parse_context;
+
+// The start of a phase for utz_phase_end, the clock is only read for utz_parse_stats.
+static inline utz_u64 utz_phase_begin(utz_parse_context* ctx)
+{
+    return ctx->stats ? UtzNanoseconds() : 0;
+}
 
-                utz_zones_bundle* zone_bundle = NULL;
-                for (utz_usize i = 0; i < UtzDynCount(zone_bundles); i++)
-                {
-                    if (utz_equals(zone_bundles[i].name, name))
-                    {
-                        zone_bundle = &zone_bundles[i];
-                        break;
-                    }
-                }
-                if (!zone_bundle)
-                {
-                    utz_zones_bundle zero = UtzInit;
-                    UtzDynAppend(utz_zones_bundle, &zone_bundles, &zero);
-                    last_zone_bundles = zone_bundles;
+// Adds the time since begin to phase (name is the file or zone it was for) and returns it.
+static utz_u64 utz_phase_end(utz_parse_context* ctx, utz_parse_phase phase, utz_u64 begin, utz_string name)
+{
+    utz_parse_stats* stats = ctx->stats;
+    if (!stats) return 0;
 
-                    zone_bundle = UtzDynGetLast(zone_bundles);
-                    zone_bundle->name = name;
-                    UtzMakeDynArray(utz_parsed_zone, &zone_bundle->zones, 32);
-                }
-                UtzAssert(zone_bundle);
+    utz_u64 nanoseconds = UtzNanoseconds() - begin;
+    stats->phase_nanoseconds[phase] += nanoseconds;
+    if (stats->trace) stats->trace(stats->trace_userdata, phase, name.data, name.length, nanoseconds);
+    return nanoseconds;
+}
 
-                utz_bool zone_closed = UTZ_FALSE;
-                while (UTZ_TRUE)
-                {
-                    utz_parsed_zone zone = {};
+// Counters and phases of a thread of UTZ_PARSE_PARALLEL, files are kept by the threads themselves.
+static void utz_add_parse_stats(utz_parse_stats* to, const utz_parse_stats* from)
+{
+    for (utz_usize i = 0; i < UTZ_PARSE_PHASE_COUNT; i++)
+        to->phase_nanoseconds[i] += from->phase_nanoseconds[i];
+    to->rules_expanded  += from->rules_expanded;
+    to->ranges_emitted  += from->ranges_emitted;
+    to->ranges          += from->ranges;
+    to->allocations     += from->allocations;
+    to->bytes_allocated += from->bytes_allocated;
+}
 
-                    if (!utz_maybe_next_hms_duration(&line, &zone.standard_offset_seconds))
-                        ReportStaticError("Bad zone.standard_offset_string.");
+// Temporaries go to an arena of their own when the result goes to one, so it ends up with only the result. Otherwise
+// they're allocated like everything else.
+static void utz_begin_scratch(utz_parse_context* ctx, utz_arena* scratch)
+{
+    ctx->scratch_userdata = ctx->allocator_userdata;
+#ifndef UTZ_OVERRIDE_ALLOCATOR
+    utz_arena* arena = utz_userdata_arena(ctx->allocator_userdata);
+    if (!arena) return;
 
-                    if (!utz_maybe_next(&line, UtzStr("-")))
-                    {
-                        if (!utz_peek(line, UTZ_TOKEN_WORD))
-                            ReportStaticError("Missing zone.rule.");
-
-                        utz_string maybe_rule = utz_next(&line);
-                        {
-                            utz_string maybe_hms = maybe_rule;
-
-                            utz_s32 constant_offset_from_base_offset = 0;
-                            if (utz_maybe_next_hms_duration(&maybe_hms, &constant_offset_from_base_offset))
-                                zone.standard_offset_seconds += constant_offset_from_base_offset;
-                            else
-                                zone.rule = maybe_rule;
-                        }
-                    }
+    *scratch = UtzInit;
+    scratch->block_size     = arena->block_size;
+    scratch->block_userdata = arena->block_userdata;
+    ctx->scratch_userdata   = utz_arena_userdata(scratch);
+#endif
+}
 
-                    if (!utz_peek(line, UTZ_TOKEN_WORD))
-                        ReportStaticError("Missing zone.abbreviation_format.");
-                    zone.abbreviation_format = utz_consume_until_whitespace(&line);
+static void utz_end_scratch(utz_parse_context* ctx, utz_arena* scratch)
+{
+    if (ctx->scratch_userdata == utz_arena_userdata(scratch)) utz_free_arena(scratch);
+    ctx->scratch_userdata = ctx->allocator_userdata;
+}
 
-                    utz_string check_format = zone.abbreviation_format;
-                    while (1)
-                    {
-                        utz_usize percent_idx = 0;
-                        for (; percent_idx < check_format.length; percent_idx++)
-                            if (check_format.data[percent_idx] == '%')
-                                break;
+#ifndef UTZ_NO_SPRINTF
+#define SetParseError(fmt, ...) do {                                    \
+    char* buf = UtzAllocate(ctx->allocator_userdata, char, 2048);         \
+    UtzSprintf(buf, 2048, "Error: " fmt "\nFile: %.*s\nLine: %.*s\n",   \
+               __VA_ARGS__, UtzStringArgs(ctx->file), UtzStringArgs(ctx->line)); \
+    ctx->error = buf;                                                   \
+} while (0)
+#else
+#define SetParseError(fmt, ...) (ctx->error = "Compile utz with sprintf support for a more detailed error.")
+#endif
 
-                        if (percent_idx == check_format.length) break;
+#define SetStaticParseError(str) (ctx->error = utz_allocate_string(ctx->allocator_userdata, UtzStr(str)).data)
 
-                        utz_bool fmt_ok = (
-                            percent_idx + 1 < zone.abbreviation_format.length &&
-                            (zone.abbreviation_format.data[percent_idx + 1] == 's' ||
-                             zone.abbreviation_format.data[percent_idx + 1] == '%')
-                        );
-                        if (!fmt_ok) ReportStaticError("Unrecognized zone.abbreviation_format. Only %%s and %%%% is allowed.");
+// utz_parse_iana_tzdb_targz redefines these to clean up instead of returning.
+#define ReportError(fmt, ...)  do { SetParseError(fmt, __VA_ARGS__); return UTZ_FALSE; } while (0)
+#define ReportStaticError(str) do { SetStaticParseError(str);        return UTZ_FALSE; } while (0)
 
-                        utz_consume(&check_format, percent_idx + 1 + 1);
-                    }
+#define CopyToCharArray(str, arr, doing_what) do {                      \
+    if ((str).length + 1 > UtzArrayCount(arr))                          \
+        ReportError("String '%.*s' didn't fit in char array while doing %s", \
+        UtzStringArgs(str), (doing_what));                              \
+    for (utz_usize _utz__i = 0; _utz__i < (str).length; _utz__i++)      \
+        (arr)[_utz__i] = (str).data[_utz__i];                           \
+    (arr)[(str).length] = '\0';                                         \
+} while (0)
 
-                    {
-                        utz_string peek = line;
-                        if (!utz_next(&peek).length) // UNTIL is blank.
-                        {
-                            zone.until      = UTZ_END_OF_TIME;
-                            zone.until_kind = UTZ_DATE_KIND_UTC;
-                            UtzDynAppend(utz_parsed_zone, &zone_bundle->zones, &zone);
-
-                            zone_closed = UTZ_TRUE;
-                            break;
-                        }
-                    }
+#define SortByCharArray(type, field, arr) utz_radix_sort( \
+    (utz_u8*)(arr), UtzDynCount(arr), sizeof(type), UtzOffsetOf(type, field), sizeof((UtzCtor1(type, 0)).field), UTZ_TRUE)
+
+#define FindByCharArray(type, field, arr, what) \
+    ((type*) utz_find_by_char_array( \
+        (unsigned char*)(arr), UtzDynCount(arr), \
+        sizeof(type), UtzOffsetOf(type, field), sizeof((UtzCtor1(type, 0)).field), \
+        (unsigned char*)(what).data, (what).length))
+
+#define FreeNestedDynArray(arrptr, member) do {        \
+    for (utz_usize _utz__i = 0; _utz__i < UtzDynCount(*(arrptr)); _utz__i++) \
+        UtzFreeDynArray(&(*(arrptr))[_utz__i].member); \
+    UtzFreeDynArray(arrptr);                           \
+} while (0)
 
-                    utz_date date = {};
-                    date.month = 1;
-                    date.day   = 1;
+typedef struct utz_rules_bundle
+{
+    utz_string               name;
+    utz_parsed_savings_rule* rules;
+} utz_rules_bundle;
 
-                    if (!utz_peek(line, UTZ_TOKEN_YEAR))
-                        ReportStaticError("Bad year for zone.until");
-                    date.year  = utz_u32_from_string(utz_next(&line));
+typedef struct utz_zones_bundle
+{
+    utz_string       name;
+    utz_parsed_zone* zones;
+} utz_zones_bundle;
 
-                    // dates like "2020", "2020 Jun" aren't parsed via utz_apply_day_rule_to_year_and_month().
-                    utz_bool date_parsed_via_day_rule = UTZ_FALSE;
-                    if (utz_peek(line, UTZ_TOKEN_MONTH))
-                    {
-                        date.month = utz_must_parse_month(utz_next(&line));
-
-                        utz_day_rule day_rule = {};
-                        if (maybe_next_day_rule(&line, &day_rule))
-                        {
-                            if (utz_apply_day_rule_to_year_and_month(day_rule, date.year, date.month, &zone.until))
-                                date_parsed_via_day_rule = UTZ_TRUE;
-                            else
-                                ReportError("Failed to parse zone.until. "
-                                            "Bad rule '%.*s': Can't apply day_rule.kind=%d to year=%04u month=%02u",
-                                            UtzStringArgs(name), day_rule.kind, date.year, date.month);
-                        }
-                    }
+// Bundles by name, like the members of a tarball: open addressed slots holding a bundle's index + 1. The names are
+// slices of the source file, so nothing is copied.
+typedef struct utz_bundle_index
+{
+    utz_u32*  slots;
+    utz_usize slot_count;   // a power of two, at least twice the bundles
+} utz_bundle_index;
+
+typedef struct utz_rules_table
+{
+    utz_rules_bundle* bundles;
+    utz_bundle_index  index;
+} utz_rules_table;
 
-                    if (!date_parsed_via_day_rule && !utz_maybe_unix_timestamp_from_utc_date(&date, &zone.until))
-                        ReportStaticError("Bad zone.until.");
+typedef struct utz_zones_table
+{
+    utz_zones_bundle* bundles;
+    utz_bundle_index  index;
+} utz_zones_table;
 
-                    utz_u32 hms_part = 0;
-                    utz_string hms = utz_next(&line);
-                    if (hms.length && !utz_maybe_next_hms_date_part(&hms, &hms_part, &zone.until_kind))
-                        ReportStaticError("Bad h:m:s for zone.until");
-                    zone.until += hms_part;
+// The slot with the bundle named name, or the empty one it goes in. Bundles are stride bytes apart and start with their name.
+static utz_u32* utz_bundle_slot(utz_bundle_index* index, const void* bundles, utz_usize stride, utz_string name)
+{
+    utz_usize mask = index->slot_count - 1;
+    utz_usize slot = (utz_usize) utz_hash_name(name.data, name.length) & mask;
+    for (; index->slots[slot]; slot = (slot + 1) & mask)
+    {
+        const utz_string* other = (const utz_string*) ((const utz_u8*) bundles + (index->slots[slot] - 1) * stride);
+        if (utz_equals(*other, name)) break;
+    }
+    return &index->slots[slot];
+}
 
-                    if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+// Indexes the last of count bundles, after it was appended. Appending can move the bundles, the index only keeps indices.
+static void utz_index_bundle(utz_bundle_index* index, const void* bundles, utz_usize stride, utz_usize count, void* allocator_userdata)
+{
+    if (2 * count > index->slot_count)
+    {
+        UtzFree(allocator_userdata, index->slots);
+        index->slot_count = index->slot_count ? 2 * index->slot_count : 64;
+        index->slots      = UtzAllocate(allocator_userdata, utz_u32, index->slot_count);
+        for (utz_usize i = 0; i + 1 < count; i++)
+            *utz_bundle_slot(index, bundles, stride, *(const utz_string*) ((const utz_u8*) bundles + i * stride)) = (utz_u32) (i + 1);
+    }
 
-                    UtzDynAppend(utz_parsed_zone, &zone_bundle->zones, &zone);
+    utz_string name = *(const utz_string*) ((const utz_u8*) bundles + (count - 1) * stride);
+    *utz_bundle_slot(index, bundles, stride, name) = (utz_u32) count;
+}
 
-                    if (!utz_maybe_next_line(&data, &current_line)) break;
-                    line = current_line;
-                }
+static utz_rules_bundle* utz_find_rules_bundle(utz_rules_table* table, utz_string name)
+{
+    if (!table->index.slot_count) return NULL;
+    utz_u32 slot = *utz_bundle_slot(&table->index, table->bundles, sizeof(utz_rules_bundle), name);
+    return slot ? &table->bundles[slot - 1] : NULL;
+}
 
-                if (!zone_closed) ReportStaticError("Zone not closed with an empty UNTIL column.");
-            }
-            else if (utz_equals(command, UtzStr("Link")))
-            {
-                utz_parsed_link link = {};
+static utz_zones_bundle* utz_find_zones_bundle(utz_zones_table* table, utz_string name)
+{
+    if (!table->index.slot_count) return NULL;
+    utz_u32 slot = *utz_bundle_slot(&table->index, table->bundles, sizeof(utz_zones_bundle), name);
+    return slot ? &table->bundles[slot - 1] : NULL;
+}
 
-                if (!utz_peek(line, UTZ_TOKEN_WORD))
-                    ReportStaticError("Missing zone.zone_main.");
+static void utz_free_rules_table(utz_rules_table* table, void* allocator_userdata)
+{
+    for (utz_usize i = 0; i < UtzDynCount(table->bundles); i++)
+        for (utz_usize j = 0; j < UtzDynCount(table->bundles[i].rules); j++)
+            UtzFree(allocator_userdata, table->bundles[i].rules[j].days);
+    FreeNestedDynArray(&table->bundles, rules);
+    UtzFree(allocator_userdata, table->index.slots);
+}
 
-                utz_string zm = utz_next(&line);
-                CopyToCharArray(zm, link.zone_main, "parsing link (zone_main)");
 
-                if (!utz_peek(line, UTZ_TOKEN_WORD))
-                    ReportStaticError("Missing zone.zone_alias.");
-                
-                utz_string za = utz_next(&line);
-                CopyToCharArray(za, link.zone_alias, "parsing link (zone_alias)");
+// Parses what follows "Rule" on a line, adding the rule to the bundle with its name.
+static utz_bool utz_parse_rule_line(utz_parse_context* ctx, utz_string line, utz_rules_table* rules)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
 
-                if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+    utz_parsed_savings_rule rule = {};
 
-                UtzDynAppend(utz_parsed_link, &links, &link);
-                last_parsed_links = links;
-            }
-            else
+    if (!utz_peek(line, UTZ_TOKEN_WORD))
+        ReportStaticError("Failed to parse rule.name");
+    utz_string name = utz_next(&line);
+
+    if (!utz_peek(line, UTZ_TOKEN_YEAR))
+        ReportStaticError("rule.from_year bad or not in valid range.");
+    utz_u32 from_year = utz_u32_from_string(utz_next(&line));
+
+    utz_u32 to_year = 0;
+         if (utz_peek(line, UTZ_TOKEN_YEAR))        to_year = utz_u32_from_string(utz_next(&line));
+    else if (utz_maybe_next(&line, UtzStr("only"))) to_year = from_year;
+    else if (utz_maybe_next(&line, UtzStr("max")))  to_year = UTZ_RULE_YEAR_MAX;
+    else ReportStaticError("Invalid rule.to_year");
+
+    if (!utz_maybe_next(&line, UtzStr("-")))
+        ReportStaticError("Expected '-' between rule.to_year and rule.month");
+
+    if (!utz_peek(line, UTZ_TOKEN_MONTH))
+        ReportStaticError("Bad rule.month");
+    rule.from_year = from_year;
+    rule.to_year   = to_year;
+    rule.month     = utz_must_parse_month(utz_next(&line));
+
+    if (!maybe_next_day_rule(&line, &rule.day_rule))
+        ReportStaticError("Bad rule.day_rule");
+
+    if (!utz_maybe_next_hms_date_part(&line, &rule.active_since, &rule.active_since_kind))
+        ReportStaticError("Bad rule.change_at_hm");
+
+    if (!utz_maybe_next_hms_duration(&line, &rule.offset_from_base_offset_seconds))
+        ReportStaticError("Bad rule.offset_from_standard_hm");
+
+    rule.abbreviation_substitution = UtzStr("");
+    if (!utz_maybe_next(&line, UtzStr("-")))
+    {
+        if (!utz_peek(line, UTZ_TOKEN_WORD))
+            ReportStaticError("Bad rule.abbreviation_substitution");
+        rule.abbreviation_substitution = utz_next(&line);
+    }
+
+    if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+
+    utz_rules_bundle* rule_bundle = utz_find_rules_bundle(rules, name);
+    if (!rule_bundle)
+    {
+        utz_rules_bundle zero = UtzInit;
+        zero.name = name;
+        UtzDynAppend(utz_rules_bundle, &rules->bundles, &zero);
+        utz_index_bundle(&rules->index, rules->bundles, sizeof(utz_rules_bundle), UtzDynCount(rules->bundles), allocator_userdata);
+
+        rule_bundle = UtzDynGetLast(rules->bundles);
+        UtzMakeDynArray(utz_parsed_savings_rule, &rule_bundle->rules, 32);
+    }
+    UtzAssert(rule_bundle);
+
+    utz_time_t unused = 0;
+    if (!utz_apply_day_rule_to_year_and_month(rule.day_rule, from_year, rule.month, &unused))
+        ReportError("Bad rule '%.*s': Can't apply day_rule.kind=%d to year=%04u month=%02u", UtzStringArgs(name), rule.day_rule.kind, from_year, rule.month);
+
+    UtzDynAppend(utz_parsed_savings_rule, &rule_bundle->rules, &rule);
+    return UTZ_TRUE;
+}
+
+// Parses what follows the name on a "Zone" line, and the continuation lines after it (taken from data).
+static utz_bool utz_parse_zone_lines(utz_parse_context* ctx, utz_string* data, utz_string line, utz_string name, utz_parsed_zone** zones)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
+
+    while (UTZ_TRUE)
+    {
+        utz_parsed_zone zone = {};
+
+        if (!utz_maybe_next_hms_duration(&line, &zone.standard_offset_seconds))
+            ReportStaticError("Bad zone.standard_offset_string.");
+
+        if (!utz_maybe_next(&line, UtzStr("-")))
+        {
+            if (!utz_peek(line, UTZ_TOKEN_WORD))
+                ReportStaticError("Missing zone.rule.");
+
+            utz_string maybe_rule = utz_next(&line);
             {
-                ReportStaticError("Unknown command type.");
+                utz_string maybe_hms = maybe_rule;
+
+                if (!utz_maybe_next_hms_duration(&maybe_hms, &zone.savings_seconds))
+                    zone.rule = maybe_rule;
             }
         }
-        current_file = {};
-        current_line = {};
 
-        SortByCharArray(utz_parsed_link, zone_alias, links);
+        if (!utz_peek(line, UTZ_TOKEN_WORD))
+            ReportStaticError("Missing zone.abbreviation_format.");
+        zone.abbreviation_format = utz_consume_until_whitespace(&line);
 
-        for (utz_usize zone_bundle_idx = 0; zone_bundle_idx < UtzDynCount(zone_bundles); zone_bundle_idx++)
+        utz_string check_format = zone.abbreviation_format;
+        while (1)
         {
-            utz_zones_bundle* it = &zone_bundles[zone_bundle_idx];
+            utz_usize percent_idx = 0;
+            for (; percent_idx < check_format.length; percent_idx++)
+                if (check_format.data[percent_idx] == '%')
+                    break;
+
+            if (percent_idx == check_format.length) break;
+
+            utz_bool fmt_ok = (
+                percent_idx + 1 < zone.abbreviation_format.length &&
+                (zone.abbreviation_format.data[percent_idx + 1] == 's' ||
+                 zone.abbreviation_format.data[percent_idx + 1] == '%')
+            );
+            if (!fmt_ok) ReportStaticError("Unrecognized zone.abbreviation_format. Only %%s and %%%% is allowed.");
+
+            utz_consume(&check_format, percent_idx + 1 + 1);
+        }
 
-            utz_parsed_link* alias_link = FindByCharArray(utz_parsed_link, zone_alias, links, it->name);
-            if (alias_link) continue;
-            
-            utz_timezone* timezone = NULL;
+        {
+            utz_string peek = line;
+            if (!utz_next(&peek).length) // UNTIL is blank.
             {
-                utz_timezone zero = UtzInit;
-                UtzDynAppend(utz_timezone, &tzs->timezones, &zero);
-                timezone = UtzDynGetLast(tzs->timezones);
-                CopyToCharArray(it->name, timezone->name, "making a new utz_timezone");
+                zone.until      = UTZ_END_OF_TIME;
+                zone.until_kind = UTZ_DATE_KIND_UTC;
+                UtzDynAppend(utz_parsed_zone, zones, &zone);
+                return UTZ_TRUE;
             }
+        }
 
-            utz_time_range* time_ranges = NULL;
-            UtzMakeDynArray(utz_time_range, &time_ranges, 64);
+        utz_date date = {};
+        date.month = 1;
+        date.day   = 1;
 
-            utz_time_t             cursor   = UTZ_BEGINNING_OF_TIME;
-            utz_parsed_savings_rule  previous = UtzInit; // no rule at the beginning, so previous is zero.
-            for (utz_usize zone_idx = 0; zone_idx < UtzDynCount(it->zones); zone_idx++)
-            {
-                utz_parsed_zone* zone = &it->zones[zone_idx];
+        if (!utz_peek(line, UTZ_TOKEN_YEAR))
+            ReportStaticError("Bad year for zone.until");
+        date.year  = utz_u32_from_string(utz_next(&line));
 
-                // @Reconsider binary search
-                utz_rules_bundle* rule_bundle = NULL;
-                for (utz_usize i = 0; i < UtzDynCount(rule_bundles); i++)
-                {
-                    if (utz_equals(rule_bundles[i].name, zone->rule))
-                    {
-                        rule_bundle = &rule_bundles[i];
-                        break;
-                    }
-                }
-                if (!rule_bundle) ReportError("Zone '%s' tried to use non existant rule '%.*s'", timezone->name, UtzStringArgs(zone->rule));
-
-                // Sort the rules. They aren't sorted because we expand each rule line into one rule object for each year it is valid.
-                // Rules need to be sorted chronologically. This can't be done unambigously in the general case.
-                //
-                // [0] We assume that we can sort the rules by just applying the current zone->standard_offset.
-                // This can be UTZ_FALSE only when standard offsets between zone entries differ by more than a day - this can affect day rules such as "lastSun".
-                // In that case we report that the rules have been resorted between zone lines because the situation is sussy.
-                //
-                // [1] Similarly, we need to report when a rule switch happens before 2 days have been elapsed; rouding rule starts to the day can be wrong in that case too.
-
-                if (!rule_bundle->sorted_previously)
-                {
-                    for (utz_usize i = 0; i < UtzDynCount(rule_bundle->rules); i++)
-                    {
-                        // @Reconsider @Reconsider @Reconsider @Reconsider @Reconsider remove div by days
-                        // and check div on negative numbers
-                        utz_parsed_savings_rule* r = &rule_bundle->rules[i];
-                        r->sorted_by = utz_utc_from_timestamp_with_date_kind(r->active_since_kind, r->active_since, zone->standard_offset_seconds, 0 /* see [0] */);// / (24 * 3600);
-                        r->sorted_by -= UtzMinValue(utz_time_t);
-                    }
+        // dates like "2020", "2020 Jun" aren't parsed via utz_apply_day_rule_to_year_and_month().
+        utz_bool date_parsed_via_day_rule = UTZ_FALSE;
+        if (utz_peek(line, UTZ_TOKEN_MONTH))
+        {
+            date.month = utz_must_parse_month(utz_next(&line));
 
-                    utz_radix_sort(
-                        rule_bundle->rules, UtzDynCount(rule_bundle->rules), sizeof(utz_parsed_savings_rule),
-                        UtzOffsetOf(utz_parsed_savings_rule, sorted_by), sizeof(utz_time_t), UTZ_FALSE
-                    );
-                    rule_bundle->sorted_previously = UTZ_TRUE;
-                }
+            utz_day_rule day_rule = {};
+            if (maybe_next_day_rule(&line, &day_rule))
+            {
+                if (utz_apply_day_rule_to_year_and_month(day_rule, date.year, date.month, &zone.until))
+                    date_parsed_via_day_rule = UTZ_TRUE;
                 else
-                {
-                    for (utz_usize i = 1; i < UtzDynCount(rule_bundle->rules); i++)
-                    {
+                    ReportError("Failed to parse zone.until. "
+                                "Bad rule '%.*s': Can't apply day_rule.kind=%d to year=%04u month=%02u",
+                                UtzStringArgs(name), day_rule.kind, date.year, date.month);
+            }
+        }
 
-                        // @Reconsider @Reconsider @Reconsider @Reconsider @Reconsider remove div by days
-                        // and check div on negative numbers
-                        utz_parsed_savings_rule* a = &rule_bundle->rules[i - 1];
-                        utz_parsed_savings_rule* b = &rule_bundle->rules[i];
-                        utz_time_t a_t = utz_utc_from_timestamp_with_date_kind(a->active_since_kind, a->active_since, zone->standard_offset_seconds, 0 /* see [0] */);// / (24 * 3600);
-                        utz_time_t b_t = utz_utc_from_timestamp_with_date_kind(b->active_since_kind, b->active_since, zone->standard_offset_seconds, 0 /* see [0] */);// / (24 * 3600);
+        if (!date_parsed_via_day_rule && !utz_maybe_unix_timestamp_from_utc_date(&date, &zone.until))
+            ReportStaticError("Bad zone.until.");
 
-                        if (b_t < a_t)
-                            ReportError("Savings rules were sorted differently when applying rule '%.*s' to zone '%.*s'. Zone line index was %u.",
-                                        UtzStringArgs(zone->rule), UtzStringArgs(it->name), (unsigned)zone_idx);
-                    }
-                }
+        // UNTIL without a time of day is midnight, wall clock.
+        zone.until_kind = UTZ_DATE_KIND_STANDARD_OFFSET_AND_SAVINGS_OFFSET;
 
-                // Insert a "sentinel" range before evaluating rules.
-                // Most of the time this rule will get squished when we remove redundant ranges.
-                // This is needed to always have a range starting at 1970-01-01.
-                // @Reconsider Abbreviation is just the minimally processed format string.
-                if (!UtzDynCount(time_ranges))
-                {
-                    utz_time_range sentinel = UtzInit;
-                    sentinel.since          = cursor;
-                    sentinel.offset_seconds = zone->standard_offset_seconds;
-                    if (!utz_get_abbreviation(&sentinel, zone, NULL))
-                        ReportError("Can't get abbreviation for zone '%.*s': %.*s.", UtzStringArgs(zone->rule), UtzStringArgs(zone->abbreviation_format));
+        utz_u32 hms_part = 0;
+        utz_string hms = utz_next(&line);
+        if (hms.length && !utz_maybe_next_hms_date_part(&hms, &hms_part, &zone.until_kind))
+            ReportStaticError("Bad h:m:s for zone.until");
+        zone.until += hms_part;
+
+        if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+
+        UtzDynAppend(utz_parsed_zone, zones, &zone);
+
+        if (!utz_maybe_next_line(data, &ctx->line)) break;
+        line = ctx->line;
+    }
+
+    ReportStaticError("Zone not closed with an empty UNTIL column.");
+}
+
+// Parses what follows "Link" on a line.
+static utz_bool utz_parse_link_line(utz_parse_context* ctx, utz_string line, utz_parsed_link** links)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
+
+    utz_parsed_link link = {};
+
+    if (!utz_peek(line, UTZ_TOKEN_WORD))
+        ReportStaticError("Missing zone.zone_main.");
 
-                    UtzDynAppend(utz_time_range, &time_ranges, &sentinel);
+    utz_string zm = utz_next(&line);
+    CopyToCharArray(zm, link.zone_main, "parsing link (zone_main)");
+
+    if (!utz_peek(line, UTZ_TOKEN_WORD))
+        ReportStaticError("Missing zone.zone_alias.");
+
+    utz_string za = utz_next(&line);
+    CopyToCharArray(za, link.zone_alias, "parsing link (zone_alias)");
+
+    if (utz_next(&line).length) ReportStaticError("Expected end of line but got garbage.");
+
+    UtzDynAppend(utz_parsed_link, links, &link);
+    return UTZ_TRUE;
+}
+
+// The day (in days since UNIX_EPOCH) rule changes clocks on in year (from_year <= year <= to_year), in *out_day.
+// Zones using a rule (often many of them, for rules like "EU") need about the same years, so the days are worked out
+// once for all years up to last_year and kept in the rule.
+static utz_bool utz_rule_day(utz_parse_context* ctx, utz_parsed_savings_rule* rule, utz_u32 year, utz_u32 last_year, utz_time_t* out_day, utz_u32* out_bad_year)
+{
+    void*   allocator_userdata = ctx->scratch_userdata;
+    utz_u32 index              = year - rule->from_year;
+
+    if (index >= rule->day_count)
+    {
+        utz_u32 to_year = rule->to_year < last_year ? rule->to_year : last_year;
+        utz_u32 count   = to_year - rule->from_year + 1;
+        rule->days = UtzReallocate(allocator_userdata, rule->days, utz_time_t, count);
+        if (!utz_day_rule_days(rule->day_rule, rule->month, rule->from_year + rule->day_count, count - rule->day_count,
+                               rule->days + rule->day_count, out_bad_year))
+            return UTZ_FALSE;
+        rule->day_count = count;
+    }
+
+    *out_day = rule->days[index];
+    return UTZ_TRUE;
+}
+
+// Fills everything in timezone except the name, from the lines of the zone and the rules of its file.
+// timezone->ranges is set (and owned by the timezone) even when this fails.
+static utz_bool utz_compile_zone(utz_parse_context* ctx, utz_timezone* timezone, utz_parsed_zone* zones, utz_rules_table* rules, unsigned flags)
+{
+    void*   allocator_userdata = ctx->allocator_userdata;
+    utz_u64 phase_begin        = utz_phase_begin(ctx);
+
+    UtzMakeDynArray(utz_time_range, &timezone->ranges, 64);
+
+    // Ranges are generated the way zic does it. Each zone line starts with whatever offset its rules gave at
+    // the line's start, then takes the rule changes of every year one by one (earliest first) until the line's
+    // UNTIL. When a change happens depends on the savings in effect right before it, which is tracked in `savings`
+    // starting from 0 at every line.
+    //
+    // The last line stops once its rules only repeat the same yearly changes ("max" rules), these are kept as
+    // the timezone's tail_changes instead of being expanded for every future year.
+    utz_time_t start   = UTZ_BEGINNING_OF_TIME;
+    utz_s32    savings = 0;
+    utz_parsed_savings_rule* tail_rules[2] = {};
+    utz_usize                tail_rule_count = 0;
+    for (utz_usize zone_idx = 0; zone_idx < UtzDynCount(zones); zone_idx++)
+    {
+        utz_parsed_zone* zone      = &zones[zone_idx];
+        utz_bool         last_line = (zone_idx + 1 == UtzDynCount(zones));
+        savings = 0;
+
+        // Range at the start of the line. Which rule's letters it uses may only be known after looking at later changes.
+        utz_usize                start_index = UtzDynCount(timezone->ranges);
+        utz_parsed_savings_rule* start_rule  = NULL;
+        utz_bool                 start_used  = UTZ_TRUE;  // a rule change can happen exactly at the start instead
+        utz_time_range           start_range = UtzInit;
+        start_range.since          = start;
+        start_range.offset_seconds = zone->standard_offset_seconds;
+        UtzDynAppend(utz_time_range, &timezone->ranges, &start_range);
+
+        if (!zone->rule.length)
+        {
+            savings = zone->savings_seconds;
+            start_range.offset_seconds += savings;
+            if (!utz_get_abbreviation(&start_range, zone, savings, UtzStr("")))
+                ReportError("Can't get abbreviation for zone '%s': %.*s.", timezone->name, UtzStringArgs(zone->abbreviation_format));
+        }
+        else
+        {
+            utz_rules_bundle* rule_bundle = utz_find_rules_bundle(rules, zone->rule);
+            if (!rule_bundle) ReportError("Zone '%s' tried to use non existant rule '%.*s'", timezone->name, UtzStringArgs(zone->rule));
+
+            // Rule changes before the start of the line still decide the savings it starts with, so go through all years.
+            // Past settled_year the only active rules are the "max" ones.
+            utz_u32   first_year   = UTZ_RULE_YEAR_MAX;
+            utz_u32   last_year    = 0;
+            utz_u32   settled_year = 0;
+            utz_usize max_rules    = 0;
+            for (utz_usize i = 0; i < UtzDynCount(rule_bundle->rules); i++)
+            {
+                utz_parsed_savings_rule* rule = &rule_bundle->rules[i];
+                if (rule->from_year < first_year) first_year = rule->from_year;
+
+                if (rule->to_year == UTZ_RULE_YEAR_MAX)
+                {
+                    if (rule->from_year > settled_year) settled_year = rule->from_year;
+                    if (max_rules < UtzArrayCount(tail_rules)) tail_rules[max_rules] = rule;
+                    max_rules++;
                 }
+                else
+                {
+                    if (rule->to_year + 1 > settled_year) settled_year = rule->to_year + 1;
+                    if (rule->to_year     > last_year)    last_year    = rule->to_year;
+                }
+            }
 
-                //if (utz_equals(it->name, UtzStr("Africa/Algiers"))) __debugbreak();
+            if (!last_line)
+            {
+                utz_date until_date = {};
+                utz_utc_date_from_unix_timestamp(&until_date, zone->until);
+                last_year = (utz_u32) until_date.year;
+            }
+            else if (max_rules != UtzArrayCount(tail_rules))
+            {
+                // Not a pair of yearly changes, so expand them like any other rule (up to max_year) and leave out the tail.
+                if (max_rules) last_year = ctx->max_year;
+            }
+            else
+            {
+                // Expand one settled year after the start, so the last range is a tail change.
+                utz_date start_date = {};
+                if (start != UTZ_BEGINNING_OF_TIME) utz_utc_date_from_unix_timestamp(&start_date, start);
+                last_year = (settled_year > (utz_u32)start_date.year ? settled_year : (utz_u32)start_date.year) + 1;
+                tail_rule_count = max_rules;
+            }
 
+            for (utz_u32 year = first_year; year <= last_year; year++)
+            {
+                utz_parsed_savings_rule* todo      [16];
+                utz_time_t               todo_local[16];
+                utz_usize                todo_count = 0;
                 for (utz_usize i = 0; i < UtzDynCount(rule_bundle->rules); i++)
                 {
                     utz_parsed_savings_rule* rule = &rule_bundle->rules[i];
+                    if (year < rule->from_year || year > rule->to_year) continue;
 
-                    // we can only determine when the current rule starts if we know what was the wall time during the previous rule.
-                    utz_time_t rule_since = utz_utc_from_timestamp_with_date_kind(rule->active_since_kind, rule->active_since, zone->standard_offset_seconds, previous.offset_from_base_offset_seconds);
-                    utz_time_t zone_until = utz_utc_from_timestamp_with_date_kind(zone->until_kind,        zone->until,        zone->standard_offset_seconds, previous.offset_from_base_offset_seconds);
+                    if (todo_count == UtzArrayCount(todo))
+                        ReportError("Rule '%.*s' changes clocks too many times in %04u.", UtzStringArgs(zone->rule), year);
 
-                    utz_bool rule_start_after_zone_ends = (rule_since >= zone_until);
-                    utz_bool rule_is_zero_length        = (rule_since <= cursor);
+                    utz_u32 bad_year = 0;
+                    if (!utz_rule_day(ctx, rule, year, last_year, &todo_local[todo_count], &bad_year))
+                        ReportError("Bad rule '%.*s': Can't apply day_rule.kind=%d to year=%04u month=%02u", UtzStringArgs(zone->rule), rule->day_rule.kind, bad_year, rule->month);
 
-                    if (rule_start_after_zone_ends || rule_is_zero_length)
+                    todo_local[todo_count]  = todo_local[todo_count] * 24 * 60 * 60 + rule->active_since;
+                    todo      [todo_count]  = rule;
+                    todo_count++;
+                    if (ctx->stats) ctx->stats->rules_expanded++;
+                }
+
+                while (todo_count)
+                {
+                    // Take the change that happens first, given the current savings.
+                    utz_usize  k        = 0;
+                    utz_time_t change_t = 0;
+                    for (utz_usize i = 0; i < todo_count; i++)
                     {
-                        previous = *rule; // :UpdatePrevRule
-                        break;
+                        utz_time_t t = utz_utc_from_timestamp_with_date_kind(todo[i]->active_since_kind, todo_local[i], zone->standard_offset_seconds, savings);
+                        if (i == 0 || t < change_t) k = i, change_t = t;
                     }
-
-                    UtzAssert(UtzDynCount(time_ranges) == 0 || rule_since >= UtzDynGetLast(time_ranges)->since);
-
-                    cursor = rule_since;
-
-                    utz_time_range new_range = UtzInit;
-                    new_range.since          = cursor;
-                    new_range.offset_seconds = zone->standard_offset_seconds + rule->offset_from_base_offset_seconds;
-                    if (!utz_get_abbreviation(&new_range, zone, rule))
-                        ReportError("Can't get abbreviation for zone '%.*s': %.*s (subs: '%.*s').",
-                                    UtzStringArgs(zone->rule), UtzStringArgs(zone->abbreviation_format), UtzStringArgs(rule->abbreviation_substitution));
-
-                    utz_usize inserted_so_far = UtzDynCount(time_ranges);
-                    if (inserted_so_far > 0)
+                    utz_parsed_savings_rule* rule = todo[k];
+                    todo      [k] = todo      [todo_count - 1];
+                    todo_local[k] = todo_local[todo_count - 1];
+                    todo_count--;
+
+                    utz_s32    offset     = zone->standard_offset_seconds + rule->offset_from_base_offset_seconds;
+                    utz_time_t zone_until = last_line ? UTZ_END_OF_TIME : utz_utc_from_timestamp_with_date_kind(zone->until_kind, zone->until, zone->standard_offset_seconds, savings);
+                    if (change_t >= zone_until)
                     {
-                        if (time_ranges[inserted_so_far - 1].offset_seconds == new_range.offset_seconds &&
-                            utz_equals(UtzStr(time_ranges[inserted_so_far - 1].zone_abbreviation), UtzStr(new_range.zone_abbreviation)))
-                        {
-                            previous = *rule; // :UpdatePrevRule
-                            break;
-                        }
+                        if (!start_rule && offset == start_range.offset_seconds) start_rule = rule;
+                        goto zone_line_done;
                     }
 
-                    UtzDynAppend(utz_time_range, &time_ranges, &new_range);
+                    savings = rule->offset_from_base_offset_seconds;
 
-                    // check for suspicious next_rule_since.
-                    if (i + 1 < UtzDynCount(rule_bundle->rules))
+                    if (change_t < start)
                     {
-                        utz_parsed_savings_rule* next = &rule_bundle->rules[i + 1];
-                        utz_time_t next_rule_since = utz_utc_from_timestamp_with_date_kind(next->active_since_kind, next->active_since, zone->standard_offset_seconds, rule->offset_from_base_offset_seconds);
-                        UtzAssert(next_rule_since > rule_since);
-                        if (next_rule_since - rule_since < 2 * (24 * 3600))
-                            ReportError("Rule '%.*s' switches to a new line faster than in 2 days. Switch between index %u and %u.",
-                                        UtzStringArgs(zone->rule), (unsigned)i, (unsigned)(i + 1));
+                        start_range.offset_seconds = offset;
+                        start_rule                 = rule;
+                        continue;
                     }
 
-                    previous = *rule; // :UpdatePrevRule
-                }
+                    if (change_t == start) start_used = UTZ_FALSE;
+                    else if (!start_rule && offset == start_range.offset_seconds) start_rule = rule;
 
-                // move the cursor up to zone's until date.
-                utz_time_t zone_until = utz_utc_from_timestamp_with_date_kind(zone->until_kind, zone->until, zone->standard_offset_seconds, previous.offset_from_base_offset_seconds);
+                    utz_time_range range = UtzInit;
+                    range.since          = change_t;
+                    range.offset_seconds = offset;
+                    if (!utz_get_abbreviation(&range, zone, rule->offset_from_base_offset_seconds, rule->abbreviation_substitution))
+                        ReportError("Can't get abbreviation for zone '%s': %.*s (subs: '%.*s').",
+                                    timezone->name, UtzStringArgs(zone->abbreviation_format), UtzStringArgs(rule->abbreviation_substitution));
 
-                if (cursor < zone_until)
-                    cursor = zone_until;
-                else
-                    UtzAssert(cursor == UTZ_BEGINNING_OF_TIME);
+                    UtzDynAppend(utz_time_range, &timezone->ranges, &range);
+                }
             }
+        }
+zone_line_done:
 
-            timezone->ranges      = time_ranges;
-            timezone->range_count = UtzDynCount(time_ranges);
+        if (!start_used)
+        {
+            for (utz_usize i = start_index + 1; i < UtzDynCount(timezone->ranges); i++)
+                timezone->ranges[i - 1] = timezone->ranges[i];
+            (*UtzDynCountPtr(timezone->ranges))--;
+        }
+        else
+        {
+            if (zone->rule.length)
+            {
+                utz_string letters = start_rule ? start_rule->abbreviation_substitution : UtzCtor2(utz_string, 0, NULL);
+                if (!utz_get_abbreviation(&start_range, zone, start_range.offset_seconds - zone->standard_offset_seconds, letters))
+                    ReportError("Can't determine the abbreviation at the start of a line of zone '%s'.", timezone->name);
+            }
+            timezone->ranges[start_index] = start_range;
         }
 
-        FreeNestedDynArray(&last_rule_bundles, rules);
-        FreeNestedDynArray(&last_zone_bundles, zones);
+        // The next line starts at this line's UNTIL, given the savings in effect at that time.
+        if (!last_line)
+            start = utz_utc_from_timestamp_with_date_kind(zone->until_kind, zone->until, zone->standard_offset_seconds, savings);
     }
 
-    // resolve timezones and links.
-    
-    SortByCharArray(utz_timezone, name, tzs->timezones);
-
-    utz_usize timezone_count_before_links = UtzDynCount(tzs->timezones);
-    for (utz_usize i = 0; i < UtzDynCount(links); i++)
-    {
-        
-        utz_timezone* main = FindByCharArray(utz_timezone, name, tzs->timezones, UtzStr(links[i].zone_main));
-        if (!main) ReportError("Can't resolve alias '%s' because main zone '%s' doesn't exist.",
-                               links[i].zone_alias, links[i].zone_main);
+    utz_string name         = UtzStr(timezone->name);
+    utz_u64    compile_time = utz_phase_end(ctx, UTZ_PARSE_PHASE_RULES, phase_begin, name);
+    phase_begin = utz_phase_begin(ctx);
+    if (ctx->stats) ctx->stats->ranges_emitted += UtzDynCount(timezone->ranges);
 
+    utz_time_range* time_ranges = timezone->ranges;
 
-        UtzDynAppend(utz_timezone, &tzs->timezones, main);
-        utz_timezone* newtz = UtzDynGetLast(tzs->timezones);
-        newtz->alias_of = main;
-        CopyToCharArray(UtzStr(links[i].zone_alias), newtz->name, "creating a link");
+    // Like zic, a change that doesn't move the wall clock past the previous change (a zone line ending
+    // right where a rule change happens) replaces the previous change instead of adding a new one.
+    {
+        utz_usize kept = UtzDynCount(time_ranges) ? 1 : 0;
+        for (utz_usize i = 1; i < UtzDynCount(time_ranges); i++)
+        {
+            utz_time_range* previous = &time_ranges[kept - 1];
+            if (kept > 1 && time_ranges[i].since + previous->offset_seconds <= previous->since + time_ranges[kept - 2].offset_seconds)
+            {
+                previous->offset_seconds = time_ranges[i].offset_seconds;
+                UtzCopyArray(previous->zone_abbreviation, time_ranges[i].zone_abbreviation);
+                continue;
+            }
+            time_ranges[kept++] = time_ranges[i];
+        }
+        *UtzDynCountPtr(time_ranges) = kept;
     }
 
-    for (utz_usize i = 0; i < UtzDynCount(tzs->timezones); i++)
+    // Drop changes that don't change anything.
     {
-        tzs->timezones[i].range_count = UtzDynCount(tzs->timezones[i].ranges);
-        UtzAssert(tzs->timezones[i].range_count > 0);
-        UtzAssert(tzs->timezones[i].ranges[0].since == UTZ_BEGINNING_OF_TIME);
-
-        for (utz_usize j = 1; j < tzs->timezones[i].range_count; j++)
+        utz_usize kept = 0;
+        for (utz_usize i = 0; i < UtzDynCount(time_ranges); i++)
         {
-            utz_time_range* a = &tzs->timezones[i].ranges[j - 1];
-            utz_time_range* b = &tzs->timezones[i].ranges[j];
-
-            UtzAssert(a->since < b->since);
-            UtzAssert(a->offset_seconds != b->offset_seconds ||
-                   !utz_equals(UtzStr(a->zone_abbreviation), UtzStr(b->zone_abbreviation)));
+            if (kept > 0 && time_ranges[kept - 1].offset_seconds == time_ranges[i].offset_seconds &&
+                utz_equals(UtzStr(time_ranges[kept - 1].zone_abbreviation), UtzStr(time_ranges[i].zone_abbreviation)))
+                continue;
+            time_ranges[kept++] = time_ranges[i];
         }
+        *UtzDynCountPtr(time_ranges) = kept;
     }
 
-    SortByCharArray(utz_timezone, name, tzs->timezones);
-    tzs->timezone_count = UtzDynCount(tzs->timezones);
-    
-
-    //
-    // parse countries.
-    //
+    // The last range is the later of the two changes in a year, order tail_changes the same way.
+    utz_parsed_zone* last_zone      = UtzDynGetLast(zones);
+    utz_time_range   tail_ranges[2] = {};
+    utz_usize        later_count    = 0;
+    for (utz_usize i = 0; i < tail_rule_count; i++)
+    {
+        utz_parsed_savings_rule* rule  = tail_rules[i];
+        utz_parsed_savings_rule* other = tail_rules[1 - i];
+
+        utz_tail_change change = UtzInit;
+        change.month          = (utz_u8) rule->month;
+        change.day_kind       = (utz_u8) rule->day_rule.kind;
+        change.day            = (utz_u8) rule->day_rule.date;
+        change.weekday        = (utz_u8) rule->day_rule.weekday;
+        change.at_seconds     = (utz_s32) utz_utc_from_timestamp_with_date_kind(rule->active_since_kind, rule->active_since, last_zone->standard_offset_seconds, other->offset_from_base_offset_seconds);
+        change.offset_seconds = last_zone->standard_offset_seconds + rule->offset_from_base_offset_seconds;
+
+        utz_time_range range = UtzInit;
+        range.offset_seconds = change.offset_seconds;
+        utz_get_abbreviation(&range, last_zone, rule->offset_from_base_offset_seconds, rule->abbreviation_substitution);
+
+        utz_time_range* last = UtzDynGetLast(time_ranges);
+        utz_usize order = (range.offset_seconds == last->offset_seconds && utz_equals(UtzStr(range.zone_abbreviation), UtzStr(last->zone_abbreviation)));
+        timezone->tail_changes[order] = change;
+        tail_ranges           [order] = range;
+        later_count += order;
+    }
 
-    MustFindFile(UtzStr("iso3166.tab"));
+    // When both changes end up the same, the zone doesn't really change clocks anymore.
+    if (tail_rule_count && later_count == 1)
+        timezone->tail_change_count = tail_rule_count;
+    else
+    {
+        utz_tail_change zero = UtzInit;
+        timezone->tail_changes[0] = timezone->tail_changes[1] = zero;
+    }
+
+    // Still the last allocation, an arena shrinks it in place.
+    UtzShrinkDynArray(utz_time_range, &timezone->ranges);
+    timezone->range_count = UtzDynCount(timezone->ranges);
+    utz_build_range_arrays(timezone, allocator_userdata);
+    utz_classify_timezone (timezone);
+
+    for (utz_usize i = 0; i < timezone->tail_change_count; i++)
+        for (utz_usize j = 0; j < timezone->abbreviation_count; j++)
+            if (utz_equals(UtzStr(timezone->abbreviations[j]), UtzStr(tail_ranges[i].zone_abbreviation)))
+                timezone->tail_changes[i].abbreviation_index = (utz_u8) j;
+    if (flags & UTZ_PARSE_SEARCH_INDEX)
+        utz_build_search_index(timezone, allocator_userdata);
+    if (flags & UTZ_PARSE_BUCKET_INDEX)
+        utz_build_bucket_index(timezone, allocator_userdata);
+
+    compile_time += utz_phase_end(ctx, UTZ_PARSE_PHASE_RANGES, phase_begin, name);
+    if (ctx->stats) ctx->stats->ranges += timezone->range_count;
+    if (ctx->file_stats)
+    {
+        ctx->file_stats->compile_nanoseconds += compile_time;
+        ctx->file_stats->zones++;
+    }
+    return UTZ_TRUE;
+}
+
+
+static void utz_free_timezone_data(utz_timezone* tz, void* allocator_userdata)
+{
+    UtzFreeDynArray(&tz->ranges);
+    UtzFree(allocator_userdata, tz->range_since);
+    utz_free_search_index(tz, allocator_userdata);
+    UtzFree(allocator_userdata, tz->bucket_first_range);
+#ifndef UTZ_NO_SPRINTF
+    UtzFree(allocator_userdata, (void*)tz->compile_error);
+#endif
+}
+
+static utz_bool utz_add_timezone(utz_parse_context* ctx, utz_timezone** timezones, utz_string name, utz_timezone** out_timezone)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
+
+    utz_timezone zero = UtzInit;
+    UtzDynAppend(utz_timezone, timezones, &zero);
+    *out_timezone = UtzDynGetLast(*timezones);
+    CopyToCharArray(name, (*out_timezone)->name, "making a new utz_timezone");
+    return UTZ_TRUE;
+}
+
+static utz_bool utz_parse_source_lines(utz_parse_context* ctx, utz_rules_table* rules, utz_zones_table* zones, utz_parsed_link** links)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
+
+    utz_string data = ctx->file;
+    while (utz_maybe_next_line(&data, &ctx->line))
+    {
+        utz_string line = ctx->line;
+
+        utz_string command = utz_next(&line);
+        if (!command.length) continue;
+
+        if (utz_equals(command, UtzStr("Rule")))
+        {
+            if (!utz_parse_rule_line(ctx, line, rules)) return UTZ_FALSE;
+        }
+        else if (utz_equals(command, UtzStr("Zone")))
+        {
+            if (!utz_peek(line, UTZ_TOKEN_WORD))
+                ReportStaticError("Missing zone.name.");
+            utz_string name = utz_next(&line);
+
+            utz_zones_bundle* zone_bundle = utz_find_zones_bundle(zones, name);
+            if (!zone_bundle)
+            {
+                utz_zones_bundle zero = UtzInit;
+                zero.name = name;
+                UtzDynAppend(utz_zones_bundle, &zones->bundles, &zero);
+                utz_index_bundle(&zones->index, zones->bundles, sizeof(utz_zones_bundle), UtzDynCount(zones->bundles), allocator_userdata);
+
+                zone_bundle = UtzDynGetLast(zones->bundles);
+                UtzMakeDynArray(utz_parsed_zone, &zone_bundle->zones, 32);
+            }
+            UtzAssert(zone_bundle);
+
+            if (!utz_parse_zone_lines(ctx, &data, line, name, &zone_bundle->zones)) return UTZ_FALSE;
+        }
+        else if (utz_equals(command, UtzStr("Link")))
+        {
+            if (!utz_parse_link_line(ctx, line, links)) return UTZ_FALSE;
+        }
+        else
+        {
+            ReportStaticError("Unknown command type.");
+        }
+    }
+    return UTZ_TRUE;
+}
+
+// Parses a source file like "europe" (ctx->file) and compiles its zones. They are appended to timezones, and its links to links.
+// Zones with the name of a link in links (including the links that were there before) are skipped.
+static utz_bool utz_parse_source_file(utz_parse_context* ctx, utz_timezone** timezones, utz_parsed_link** links, unsigned flags)
+{
+    void* allocator_userdata = ctx->scratch_userdata;
+
+    utz_rules_table rules = UtzInit;
+    utz_zones_table zones = UtzInit;
+    UtzMakeDynArray(utz_rules_bundle, &rules.bundles, 32);
+    UtzMakeDynArray(utz_zones_bundle, &zones.bundles, 32);
+
+    utz_u64  begin = utz_phase_begin(ctx);
+    utz_bool ok    = utz_parse_source_lines(ctx, &rules, &zones, links);
+    utz_u64  time  = utz_phase_end(ctx, UTZ_PARSE_PHASE_TOKENIZE, begin, ctx->file_name);
+    if (ctx->file_stats) ctx->file_stats->tokenize_nanoseconds += time;
+    if (ok)
+    {
+        ctx->file = {};
+        ctx->line = {};
+        SortByCharArray(utz_parsed_link, zone_alias, *links);
+    }
+
+    for (utz_usize zone_bundle_idx = 0; ok && zone_bundle_idx < UtzDynCount(zones.bundles); zone_bundle_idx++)
+    {
+        utz_zones_bundle* it = &zones.bundles[zone_bundle_idx];
+
+        utz_parsed_link* alias_link = FindByCharArray(utz_parsed_link, zone_alias, *links, it->name);
+        if (alias_link) continue;
+
+        utz_timezone* timezone = NULL;
+        ok = utz_add_timezone(ctx, timezones, it->name, &timezone) &&
+             utz_compile_zone(ctx, timezone, it->zones, &rules, flags);
+    }
+
+    utz_free_rules_table(&rules, allocator_userdata);
+    FreeNestedDynArray(&zones.bundles, zones);
+    UtzFree(allocator_userdata, zones.index.slots);
+    return ok;
+}
+
+#ifndef UTZ_NO_THREADS
+// A source file of UTZ_PARSE_PARALLEL, parsed into arrays of its own.
+typedef struct utz_parse_task
+{
+    utz_parse_context context;
+    utz_timezone*     timezones;
+    utz_parsed_link*  links;
+    utz_bool          ok;
+    utz_parse_stats   stats;            // context.stats points here when parsing with stats
+} utz_parse_task;
+
+typedef struct utz_parse_pool
+{
+    utz_parse_task* tasks;
+    utz_u32*        order;          // biggest files first, so the last ones to be picked up are quick
+    utz_u32         task_count;
+    utz_u32         next_task;      // only changed with UtzAtomicFetchAdd
+    unsigned        flags;
+} utz_parse_pool;
+
+UtzThreadProc(utz_parse_worker)
+{
+    utz_parse_pool* pool = (utz_parse_pool*) data;
+    for (utz_u32 i = UtzAtomicFetchAdd(&pool->next_task, 1); i < pool->task_count; i = UtzAtomicFetchAdd(&pool->next_task, 1))
+    {
+        utz_parse_task* task = &pool->tasks[pool->order[i]];
+        void* allocator_userdata = task->context.scratch_userdata;
+
+        // The calling thread is one of the workers, it gets its own allocation stats back after.
+        utz_parse_stats* allocation_stats = utz_allocation_stats;
+        utz_allocation_stats = task->context.stats;
+
+        UtzMakeDynArray(utz_timezone,    &task->timezones, 64);
+        UtzMakeDynArray(utz_parsed_link, &task->links,     64);
+        task->ok = utz_parse_source_file(&task->context, &task->timezones, &task->links, pool->flags);
+        utz_allocation_stats = allocation_stats;
+    }
+    UtzThreadReturn;
+}
+
+// Works on the tasks with a thread per task, the calling thread being one of them. Threads that can't be started
+// just leave more tasks to the others.
+static void utz_run_parse_pool(utz_parse_pool* pool)
+{
+    utz_thread threads[16];
+    utz_usize  thread_count = 0;
+    while (thread_count + 1 < pool->task_count && thread_count < UtzArrayCount(threads) &&
+           UtzStartThread(&threads[thread_count], utz_parse_worker, pool))
+        thread_count++;
+
+    utz_parse_worker(pool);
+    for (utz_usize i = 0; i < thread_count; i++)
+        UtzJoinThread(threads[i]);
+}
+#endif
+
+
+// With UTZ_PARSE_LAZY, zones keep their lines (comments dropped) in utz_lazy_source.text until they're compiled.
+// Lines are found by offset, text grows while indexing.
+struct utz_lazy_zone
+{
+    utz_lazy_source* source;
+    utz_usize        text_offset;   // the Zone line and its continuation lines
+    utz_usize        text_length;
+    utz_usize        rules_offset;  // every Rule line of the zone's file
+    utz_usize        rules_length;
+};
+
+struct utz_lazy_source
+{
+    char*          text;
+    utz_lazy_zone* zones;           // in the same order as the zones were added to tzs->timezones
+    void*          allocator_userdata;
+    unsigned       flags;
+    unsigned       max_year;
+};
+
+static void utz_lazy_append_line(utz_lazy_source* source, utz_string line)
+{
+    void* allocator_userdata = source->allocator_userdata;
+
+    char newline = '\n';
+    for (utz_usize i = 0; i < line.length && line.data[i] != '#'; i++)
+        UtzDynAppend(char, &source->text, &line.data[i]);
+    UtzDynAppend(char, &source->text, &newline);
+}
+
+static utz_usize utz_count_tokens(utz_string line)
+{
+    utz_usize count = 0;
+    while (utz_next(&line).length) count++;
+    return count;
+}
+
+// Copies the Rule lines of a file to source->text, then every Zone with its continuation lines (each getting a utz_lazy_zone).
+// Links are parsed like always, they decide which zones are links.
+static utz_bool utz_index_lazy_file(utz_parse_context* ctx, utz_lazy_source* source, utz_parsed_link** links)
+{
+    void* allocator_userdata = ctx->allocator_userdata;
+
+    utz_usize  rules_offset = UtzDynCount(source->text);
+    utz_string data         = ctx->file;
+    while (utz_maybe_next_line(&data, &ctx->line))
+    {
+        utz_string line = ctx->line;
+        if (utz_equals(utz_next(&line), UtzStr("Rule"))) utz_lazy_append_line(source, ctx->line);
+    }
+    utz_usize rules_length = UtzDynCount(source->text) - rules_offset;
+
+    data = ctx->file;
+    while (utz_maybe_next_line(&data, &ctx->line))
+    {
+        utz_string line    = ctx->line;
+        utz_string command = utz_next(&line);
+
+        if (utz_equals(command, UtzStr("Rule"))) continue;
+        else if (utz_equals(command, UtzStr("Link")))
+        {
+            if (!utz_parse_link_line(ctx, line, links)) return UTZ_FALSE;
+        }
+        else if (utz_equals(command, UtzStr("Zone")))
+        {
+            utz_lazy_zone zone = UtzInit;
+            zone.source       = source;
+            zone.text_offset  = UtzDynCount(source->text);
+            zone.rules_offset = rules_offset;
+            zone.rules_length = rules_length;
+
+            // The first line has "Zone" and the name before the columns of a continuation line. The last line has no UNTIL.
+            utz_lazy_append_line(source, ctx->line);
+            utz_bool closed = (utz_count_tokens(ctx->line) <= 5);
+            while (!closed && utz_maybe_next_line(&data, &ctx->line))
+            {
+                utz_lazy_append_line(source, ctx->line);
+                closed = (utz_count_tokens(ctx->line) <= 3);
+            }
+            if (!closed) ReportStaticError("Zone not closed with an empty UNTIL column.");
+
+            zone.text_length = UtzDynCount(source->text) - zone.text_offset;
+            UtzDynAppend(utz_lazy_zone, &source->zones, &zone);
+        }
+        else ReportStaticError("Unknown command type.");
+    }
+    return UTZ_TRUE;
+}
+
+static utz_string utz_lazy_zone_name(utz_lazy_zone* zone)
+{
+    utz_string text = { zone->text_length, zone->source->text + zone->text_offset };
+    utz_next(&text); // "Zone"
+    return utz_next(&text);
+}
+
+// Parses the lines of an indexed zone and only the rules it uses, then compiles it.
+static utz_bool utz_compile_lazy_zone(utz_parse_context* ctx, utz_timezone* timezone)
+{
+    void*            allocator_userdata = ctx->scratch_userdata;
+    utz_lazy_zone*   lazy               = timezone->lazy;
+    utz_lazy_source* source             = lazy->source;
+
+    utz_parsed_zone* zones     = NULL;
+    utz_rules_table  zone_rules = UtzInit;
+    UtzMakeDynArray(utz_parsed_zone,  &zones,              16);
+    UtzMakeDynArray(utz_rules_bundle, &zone_rules.bundles, 4);
+
+    utz_string data = { lazy->text_length, source->text + lazy->text_offset };
+    ctx->file = data;
+    utz_maybe_next_line(&data, &ctx->line);
+
+    utz_string line = ctx->line;
+    utz_next(&line); // "Zone"
+    utz_string name = utz_next(&line);
+    utz_bool   ok   = utz_parse_zone_lines(ctx, &data, line, name, &zones);
+
+    for (utz_usize i = 0; ok && i < UtzDynCount(zones); i++)
+    {
+        utz_string rule = zones[i].rule;
+        if (!rule.length || utz_find_rules_bundle(&zone_rules, rule)) continue;
+
+        utz_string rules = { lazy->rules_length, source->text + lazy->rules_offset };
+        ctx->file = rules;
+        while (ok && utz_maybe_next_line(&rules, &ctx->line))
+        {
+            utz_string rule_line = ctx->line;
+            utz_next(&rule_line); // "Rule"
+
+            utz_string peek = rule_line;
+            if (utz_equals(utz_next(&peek), rule)) ok = utz_parse_rule_line(ctx, rule_line, &zone_rules);
+        }
+    }
+
+    ctx->file = UtzCtor2(utz_string, lazy->text_length, source->text + lazy->text_offset);
+    ctx->line = UtzStr("--- compiling ---");
+    ok = ok && utz_compile_zone(ctx, timezone, zones, &zone_rules, source->flags);
+
+    utz_free_rules_table(&zone_rules, allocator_userdata);
+    UtzFreeDynArray(&zones);
+    return ok;
+}
+
+static utz_lazy_source* utz_make_lazy_source(void* allocator_userdata, unsigned max_year, unsigned flags)
+{
+    utz_lazy_source* source = UtzAllocate(allocator_userdata, utz_lazy_source, 1);
+    source->allocator_userdata = allocator_userdata;
+    source->flags              = flags;
+    source->max_year           = max_year;
+    UtzMakeDynArray(char,          &source->text,  256 * 1024);
+    UtzMakeDynArray(utz_lazy_zone, &source->zones, 512);
+    return source;
+}
+
+// Once every file is indexed.
+static void utz_shrink_lazy_source(utz_lazy_source* source)
+{
+    void* allocator_userdata = source->allocator_userdata;
+    UtzShrinkDynArray(char,          &source->text);
+    UtzShrinkDynArray(utz_lazy_zone, &source->zones);
+}
+
+static void utz_free_lazy_source(utz_lazy_source* source, void* allocator_userdata)
+{
+    if (!source) return;
+    UtzFreeDynArray(&source->text);
+    UtzFreeDynArray(&source->zones);
+    UtzFree(allocator_userdata, source);
+}
+
+
+// The arrays of tzs are built up in scratch memory with capacity to spare. This copies them to allocator_userdata
+// at their final size, and points everything at the copies.
+static void utz_copy_result(utz_timezones* tzs, void* allocator_userdata)
+{
+    utz_timezone* timezones = tzs->timezones;
+    utz_country*  countries = tzs->countries;
+
+    UtzMakeDynArray(utz_timezone, &tzs->timezones, tzs->timezone_count ? tzs->timezone_count : 1);
+    for (utz_usize i = 0; i < tzs->timezone_count; i++)
+    {
+        UtzDynAppend(utz_timezone, &tzs->timezones, &timezones[i]);
+        if (timezones[i].alias_of) tzs->timezones[i].alias_of = tzs->timezones + (timezones[i].alias_of - timezones);
+    }
+
+    UtzMakeDynArray(utz_country, &tzs->countries, tzs->country_count ? tzs->country_count : 1);
+    for (utz_usize ci = 0; ci < tzs->country_count; ci++)
+    {
+        utz_country country = countries[ci];
+        country.timezones = NULL;
+        if (country.timezone_count) UtzMakeDynArray(utz_timezone*, &country.timezones, country.timezone_count);
+        for (utz_usize i = 0; i < country.timezone_count; i++)
+        {
+            utz_timezone* tz = tzs->timezones + (countries[ci].timezones[i] - timezones);
+            UtzDynAppend(utz_timezone*, &country.timezones, &tz);
+        }
+        UtzDynAppend(utz_country, &tzs->countries, &country);
+    }
+
+    for (utz_usize i = 0; i < 26 * 26; i++)
+        if (tzs->country_default_timezones[i])
+            tzs->country_default_timezones[i] = tzs->timezones + (tzs->country_default_timezones[i] - timezones);
+}
+
+int utz_parse_iana_tzdb_targz(utz_timezones* tzs, void* targz, int targz_size, void* result_userdata, unsigned max_year, unsigned flags,
+                              utz_parse_stats* stats)
+{
+    //
+    // macros for error reporting and tar handling.
+    //
+
+    if (stats)
+    {
+        utz_parse_stats reset = UtzInit;
+        reset.trace          = stats->trace;
+        reset.trace_userdata = stats->trace_userdata;
+        *stats = reset;
+    }
+    utz_parse_stats* allocation_stats = utz_allocation_stats;
+    utz_allocation_stats = stats;
+
+    utz_parse_context context = UtzInit;
+    utz_parse_context* ctx    = &context;
+    utz_arena          scratch;
+    context.file               = UtzStr("N/A");
+    context.line               = UtzStr("N/A");
+    context.allocator_userdata = result_userdata;
+    context.max_year           = max_year;
+    context.stats              = stats;
+    utz_u64 parse_begin        = utz_phase_begin(ctx);
+    utz_begin_scratch(ctx, &scratch);
+
+    // Everything in here is built up in scratch, except the timezone data and the lazy source. At the end, what's
+    // part of tzs is copied to result_userdata (if that isn't scratch too).
+    void* allocator_userdata = context.scratch_userdata;
+
+#undef ReportError
+#undef ReportStaticError
+#define ReportError(fmt, ...)  do { SetParseError(fmt, __VA_ARGS__); goto cleanup; } while (0)
+#define ReportStaticError(str) do { SetStaticParseError(str);        goto cleanup; } while (0)
+
+#define MustFindFile(filename) do {                                              \
+    utz_string _utz__s     = (filename);                                         \
+    utz_u64    _utz__begin = utz_phase_begin(ctx);                               \
+    if (stream) {                                                                \
+        utz_bool _utz__taken = utz_tar_stream_take(stream, _utz__s, &context.file); \
+        utz_phase_end(ctx, UTZ_PARSE_PHASE_INFLATE, _utz__begin, _utz__s);       \
+        if (!_utz__taken && stream->failed)                                      \
+            ReportStaticError("Failed to decompress .tar.gz");                   \
+    } else {                                                                     \
+        const utz_tar_member* _utz__m = utz_find_tar_member(&tarball, _utz__s.data, _utz__s.length); \
+        context.file = _utz__m ? UtzCtor2(utz_string, _utz__m->size, (char*) _utz__m->content) : UtzCtor2(utz_string, 0, NULL); \
+        utz_phase_end(ctx, UTZ_PARSE_PHASE_TAR, _utz__begin, _utz__s);           \
+    }                                                                            \
+    if (!context.file.length)                                                    \
+        ReportError("Missing file '%.*s' in iana tarball.", UtzStringArgs(_utz__s)); \
+} while (0)
+
+    utz_tarball      tarball = UtzInit;
+    utz_tar_stream*  stream  = NULL;
+    utz_parsed_link* links   = NULL;
+
+
+    *tzs = UtzInit;
+
+    { // nedless scope to avoid "goto over variable initializations" error
+
+    // We only care about the deflate stream inside of the .gzip file.
+    // Skip the header (10 bytes) and footer (8 bytes) and only process the stream.
+
+    char* deflate_stream_start = (char*)targz + 10;
+    int   deflate_stream_size  = targz_size - 10 - 8;
+
+    if (deflate_stream_size < 0 || deflate_stream_size > targz_size)
+        ReportStaticError("Invalid gzip file: doesn't contain header and/or footer.");
+
+    utz_string timezone_filenames[] = {
+        UtzStr("africa"),
+        UtzStr("antarctica"),
+        UtzStr("asia"),
+        UtzStr("australasia"),
+        UtzStr("europe"),
+        UtzStr("northamerica"),
+        UtzStr("southamerica"),
+        UtzStr("etcetera"),
+        UtzStr("backward"),     // only links, old names that are still in use
+    };
+    static_assert(UtzArrayCount(timezone_filenames) <= UtzArrayCount(stats->files), "utz_parse_stats.files needs room for every source file.");
+
+    utz_string wanted_files[UtzArrayCount(timezone_filenames) + 3];
+    if (flags & UTZ_PARSE_STREAMING)
+    {
+        // Everything that's read below, the tarball has them in this order too.
+        utz_usize wanted_count = 0;
+        wanted_files[wanted_count++] = UtzStr("version");
+        for (utz_usize i = 0; i < UtzArrayCount(timezone_filenames); i++)
+            wanted_files[wanted_count++] = timezone_filenames[i];
+        wanted_files[wanted_count++] = UtzStr("iso3166.tab");
+        wanted_files[wanted_count++] = UtzStr("zone1970.tab");
+
+        utz_u64 begin = utz_phase_begin(ctx);
+        stream = UtzAllocate(allocator_userdata, utz_tar_stream, 1);
+        utz_bool started = utz_tar_stream_begin(stream, deflate_stream_start, deflate_stream_size, wanted_files, wanted_count, allocator_userdata);
+        utz_phase_end(ctx, UTZ_PARSE_PHASE_INFLATE, begin, UtzStr(""));
+        if (!started) ReportStaticError("Failed to decompress .tar.gz");
+    }
+    else
+    {
+        utz_u64  begin    = utz_phase_begin(ctx);
+        utz_bool inflated = utz_inflate_targz(&tarball, targz, targz_size, allocator_userdata);
+        utz_phase_end(ctx, UTZ_PARSE_PHASE_INFLATE, begin, UtzStr(""));
+        if (!inflated) ReportStaticError("Failed to decompress .tar.gz");
+
+        begin = utz_phase_begin(ctx);
+        utz_index_tarball(&tarball, allocator_userdata);
+        utz_phase_end(ctx, UTZ_PARSE_PHASE_TAR, begin, UtzStr(""));
+    }
+
+
+    //
+    // version and changelog.
+    //
+
+    MustFindFile(UtzStr("version"));
+
+    // Trim trailing whitespace.
+    while (UtzIsSpaceByte(context.file.data[context.file.length - 1]))
+        context.file.length--;
+
+    CopyToCharArray(context.file, tzs->iana_version, "reading iana version");
+
+
+    //
+    // parse tzs.
+    //
+
+    UtzMakeDynArray(utz_timezone, &tzs->timezones, 128);
+    UtzMakeDynArray(utz_parsed_link, &links, 128);
+
+    utz_lazy_source* lazy = NULL;
+    if (flags & UTZ_PARSE_LAZY)
+    {
+        lazy = utz_make_lazy_source(result_userdata, max_year, flags);
+        tzs->lazy_source = lazy;
+    }
+
+    utz_bool parallel = UTZ_FALSE;
+#ifndef UTZ_NO_THREADS
+    utz_parse_task tasks[UtzArrayCount(timezone_filenames)] = {};
+    parallel = (flags & UTZ_PARSE_PARALLEL) && !lazy && !stream;
+#endif
+
+    for (utz_usize i = 0; i < UtzArrayCount(timezone_filenames); i++)
+    {
+        utz_string filename = timezone_filenames[i];
+        MustFindFile(filename);
+
+        context.file_name = filename;
+        if (stats)
+        {
+            context.file_stats = &stats->files[stats->file_count++];
+            context.file_stats->name = filename.data;
+        }
+
+        // Zones are only indexed, everything else is the same.
+        if (lazy)
+        {
+            utz_usize first_zone = UtzDynCount(lazy->zones);
+            utz_u64   begin      = utz_phase_begin(ctx);
+            if (!utz_index_lazy_file(ctx, lazy, &links)) goto cleanup;
+            utz_u64   time       = utz_phase_end(ctx, UTZ_PARSE_PHASE_TOKENIZE, begin, filename);
+            if (stats) context.file_stats->tokenize_nanoseconds = time;
+            context.file = {};
+            context.line = {};
+
+            SortByCharArray(utz_parsed_link, zone_alias, links);
+
+            utz_usize kept = first_zone;
+            for (utz_usize zone_idx = first_zone; zone_idx < UtzDynCount(lazy->zones); zone_idx++)
+            {
+                utz_string name = utz_lazy_zone_name(&lazy->zones[zone_idx]);
+                if (FindByCharArray(utz_parsed_link, zone_alias, links, name)) continue;
+
+                utz_timezone* timezone = NULL;
+                if (!utz_add_timezone(ctx, &tzs->timezones, name, &timezone)) goto cleanup;
+                timezone->lazy_state = UTZ_LAZY_PENDING;
+
+                lazy->zones[kept++] = lazy->zones[zone_idx];
+            }
+            *UtzDynCountPtr(lazy->zones) = kept;
+            if (stats) context.file_stats->zones = kept - first_zone;
+            continue;
+        }
+
+#ifndef UTZ_NO_THREADS
+        // Only found here, parsed on the pool below.
+        if (parallel)
+        {
+            tasks[i].context = context;
+            if (stats)
+            {
+                tasks[i].stats.trace          = stats->trace;
+                tasks[i].stats.trace_userdata = stats->trace_userdata;
+                tasks[i].context.stats        = &tasks[i].stats;
+            }
+            continue;
+        }
+#endif
+
+        if (!utz_parse_source_file(ctx, &tzs->timezones, &links, flags)) goto cleanup;
+    }
+    context.file_stats = NULL;
+
+    utz_u64 links_begin = utz_phase_begin(ctx);
+#ifndef UTZ_NO_THREADS
+    if (parallel)
+    {
+        utz_u32 order[UtzArrayCount(timezone_filenames)];
+        for (utz_u32 i = 0; i < UtzArrayCount(order); i++) order[i] = i;
+        for (utz_u32 i = 1; i < UtzArrayCount(order); i++)
+            for (utz_u32 j = i; j > 0 && tasks[order[j]].context.file.length > tasks[order[j - 1]].context.file.length; j--)
+            {
+                utz_u32 swap = order[j]; order[j] = order[j - 1]; order[j - 1] = swap;
+            }
+
+        utz_parse_pool pool = UtzInit;
+        pool.tasks      = tasks;
+        pool.order      = order;
+        pool.task_count = UtzArrayCount(tasks);
+        pool.flags      = flags;
+        utz_run_parse_pool(&pool);
+
+        // Merged in file order, with the alias check of parsing them one by one. The first error wins.
+        for (utz_usize i = 0; i < UtzArrayCount(tasks); i++)
+        {
+            utz_parse_task* task = &tasks[i];
+            for (utz_usize j = 0; j < UtzDynCount(task->links); j++)
+                UtzDynAppend(utz_parsed_link, &links, &task->links[j]);
+            SortByCharArray(utz_parsed_link, zone_alias, links);
+
+            for (utz_usize j = 0; j < UtzDynCount(task->timezones); j++)
+            {
+                utz_timezone* timezone = &task->timezones[j];
+                if (FindByCharArray(utz_parsed_link, zone_alias, links, UtzStr(timezone->name)))
+                    utz_free_timezone_data(timezone, result_userdata);
+                else
+                    UtzDynAppend(utz_timezone, &tzs->timezones, timezone);
+            }
+            UtzFreeDynArray(&task->timezones);
+            UtzFreeDynArray(&task->links);
+            if (stats) utz_add_parse_stats(stats, &task->stats);
+
+            if (!task->ok && !context.error) context.error = task->context.error;
+#ifndef UTZ_NO_SPRINTF
+            else if (!task->ok) UtzFree(result_userdata, (void*)task->context.error);
+#endif
+        }
+        if (context.error) goto cleanup;
+    }
+#endif
+
+    // resolve timezones and links.
+
+    // Zones were added in the order they were indexed, before sorting moves them around.
+    if (lazy)
+    {
+        utz_shrink_lazy_source(lazy);
+        for (utz_usize i = 0; i < UtzDynCount(tzs->timezones); i++)
+            tzs->timezones[i].lazy = &lazy->zones[i];
+    }
+
+    SortByCharArray(utz_timezone, name, tzs->timezones);
+
+    utz_usize timezone_count_before_links = UtzDynCount(tzs->timezones);
+    for (utz_usize i = 0; i < UtzDynCount(links); i++)
+    {
+
+        // Only look at zones, links appended so far aren't sorted.
+        utz_string    main_name = UtzStr(links[i].zone_main);
+        utz_timezone* main      = (utz_timezone*) utz_find_by_char_array(
+            (unsigned char*) tzs->timezones, timezone_count_before_links, sizeof(utz_timezone),
+            UtzOffsetOf(utz_timezone, name), sizeof(tzs->timezones[0].name), (unsigned char*) main_name.data, main_name.length);
+        if (!main) ReportError("Can't resolve alias '%s' because main zone '%s' doesn't exist.",
+                               links[i].zone_alias, links[i].zone_main);
+
+
+        // Appending can move the array, alias_of is set properly after the final sort below.
+        utz_timezone copy = *main;
+        copy.alias_of = main;
+        UtzDynAppend(utz_timezone, &tzs->timezones, &copy);
+        utz_timezone* newtz = UtzDynGetLast(tzs->timezones);
+        CopyToCharArray(UtzStr(links[i].zone_alias), newtz->name, "creating a link");
+    }
+
+    for (utz_usize i = 0; i < UtzDynCount(tzs->timezones); i++)
+    {
+        if (tzs->timezones[i].lazy_state != UTZ_LAZY_COMPILED) continue;
+
+        tzs->timezones[i].range_count = UtzDynCount(tzs->timezones[i].ranges);
+        UtzAssert(tzs->timezones[i].range_count > 0);
+        UtzAssert(tzs->timezones[i].ranges[0].since == UTZ_BEGINNING_OF_TIME);
+
+        for (utz_usize j = 1; j < tzs->timezones[i].range_count; j++)
+        {
+            utz_time_range* a = &tzs->timezones[i].ranges[j - 1];
+            utz_time_range* b = &tzs->timezones[i].ranges[j];
+
+            UtzAssert(a->since < b->since);
+            UtzAssert(a->offset_seconds != b->offset_seconds ||
+                   !utz_equals(UtzStr(a->zone_abbreviation), UtzStr(b->zone_abbreviation)));
+        }
+    }
+
+    SortByCharArray(utz_timezone, name, tzs->timezones);
+    tzs->timezone_count = UtzDynCount(tzs->timezones);
+
+    for (utz_usize i = 0; i < UtzDynCount(links); i++)
+    {
+        utz_timezone* alias = FindByCharArray(utz_timezone, name, tzs->timezones, UtzStr(links[i].zone_alias));
+        utz_timezone* main  = FindByCharArray(utz_timezone, name, tzs->timezones, UtzStr(links[i].zone_main));
+        UtzAssert(alias && main && !main->alias_of);
+        alias->alias_of = main;
+    }
+
+    utz_build_name_hash(tzs, result_userdata);
+    if (stats)
+    {
+        stats->zones = timezone_count_before_links;
+        stats->links = UtzDynCount(links);
+    }
+    utz_phase_end(ctx, UTZ_PARSE_PHASE_LINKS, links_begin, UtzStr(""));
+
+
+    //
+    // parse countries.
+    //
+
+    MustFindFile(UtzStr("iso3166.tab"));
+    utz_u64 countries_begin = utz_phase_begin(ctx);
 
     UtzMakeDynArray(utz_country, &tzs->countries, 128);
 
-    utz_string countries = current_file;
-    while (utz_maybe_next_line(&countries, &current_line))
+    utz_string countries = context.file;
+    while (utz_maybe_next_line(&countries, &context.line))
+    {
+        utz_string line = context.line;
+
+        if (!utz_peek(line, UTZ_TOKEN_WORD)) ReportStaticError("Expected country.code");
+        utz_string code = utz_next(&line);
+
+        utz_string name = next_space_separated_string(&line);
+        if (!name.length)        ReportStaticError("Expected country.name");
+        if (utz_next(&line).length)  ReportStaticError("Expected end of line but got garbage.");
+
+        utz_country country = UtzInit;
+        CopyToCharArray(name, country.name, "parsing country name");
+        CopyToCharArray(code, country.code, "parsing country code");
+        if (utz_country_code_index(country.code) >= UtzArrayCount(tzs->country_default_timezones))
+            ReportStaticError("Expected a country code of two uppercase letters.");
+        UtzDynAppend(utz_country, &tzs->countries, &country);
+
+        // @Temporary
+        // // Insert an alias if one references this country.
+        // for (utz_usize i = 0; i < UtzArrayCount(the_country_aliases); i++)
+        // {
+        //     if (!utz_equals(the_country_aliases[i].main_country_code, code)) continue;
+        //     utz_country alias = UtzInit;
+        //     CopyToCharArray(the_country_aliases[i].alias_country_name, alias.name, "parsing alias country name");
+        //     CopyToCharArray(the_country_aliases[i].alias_country_code, alias.code, "parsing alias country code");
+        //     UtzDynAppend(utz_country, &tzs->countries, &alias);
+        // }
+    }
+
+    tzs->country_count = UtzDynCount(tzs->countries);
+    SortByCharArray(utz_country, code, tzs->countries);
+    utz_phase_end(ctx, UTZ_PARSE_PHASE_COUNTRIES, countries_begin, UtzStr("iso3166.tab"));
+
+    //
+    // Parse country to timezone relations.
+    //
+
+    MustFindFile(UtzStr("zone1970.tab"));
+    countries_begin = utz_phase_begin(ctx);
+
+    utz_string country_to_timezone = context.file;
+    while (utz_maybe_next_line(&country_to_timezone, &context.line))
+    {
+        utz_string line = context.line;
+
+        utz_string comma_separated_codes = utz_next(&line);
+        if (!comma_separated_codes.length) ReportStaticError("Expected a comma separated list of country codes.");
+
+        utz_string latlong = utz_next(&line);
+        if (!latlong.length) ReportStaticError("Expected latitude/longitude after country code.");
+
+        utz_string zone_name = utz_next(&line);
+        if (!zone_name.length) ReportStaticError("Expected timezone name after latitude/longitude.");
+
+        utz_timezone* zone = FindByCharArray(utz_timezone, name, tzs->timezones, zone_name);
+        if (!zone) ReportError("Can't find timezone '%.*s'", UtzStringArgs(zone_name));
+
+        if (!utz_parse_latitude_and_longitude(latlong, &zone->coordinate_latitude_seconds, &zone->coordinate_longitude_seconds))
+            ReportStaticError("Bad latitude/longitude.");
+
+        while (UTZ_TRUE)
+        {
+            utz_string code = { 0, comma_separated_codes.data };
+            while (comma_separated_codes.length && comma_separated_codes.data[0] != ',')
+            {
+                utz_consume(&comma_separated_codes, 1);
+                code.length++;
+            }
+            if (comma_separated_codes.length) utz_consume(&comma_separated_codes, 1);
+
+            if (!code.length) break;
+
+            utz_country* country = FindByCharArray(utz_country, code, tzs->countries, code);
+            if (!country) ReportError("Can't find country with code '%.*s", UtzStringArgs(code));
+
+            if (!country->timezones)
+                UtzMakeDynArray(utz_timezone*, &country->timezones, 1);
+            UtzDynAppend(utz_timezone*, &country->timezones, &zone);
+        }
+
+        // rest of `line` is comments
+    }
+
+    context.line = UtzStr("--- EOF (file already processed) ---");
+
+    for (utz_usize country_idx = 0; country_idx < UtzDynCount(tzs->countries); country_idx++)
+    {
+        utz_country* country = &tzs->countries[country_idx];
+
+        // We know that these countries don't have any timezone data, and we don't care.
+        if (!country->timezones && (!utz_equals(UtzStr("BV"), country->code) && !utz_equals(UtzStr("HM"), country->code)))
+            ReportError("No timezones for country '%s' (%s).", country->name, country->code);
+
+#if 0
+        // Resolve default timezone overrides. There should only be one override per country. I don't care to check this.
+        for (utz_usize i = 0; i < ArrayCount(the_default_timezone_overrides); i++)
+        {
+            Default_Timezone_Override* override = &the_default_timezone_overrides[i];
+            if (override->country_code != country->code) continue;
+
+            // Find the default timezone and insert it at index 0.
+            utz_bool found = UTZ_FALSE;
+            utz_timezone* previous = country->timezones.count ? country->timezones[0] : NULL;
+            for (utz_usize j = 1; j < country->timezones.count; j++)
+            {
+                if (previous->name == override->default_timezone_name)
+                {
+                    country->timezones[0] = previous;
+                    found = UTZ_TRUE;
+                    break;
+                }
+                else
+                {
+                    utz_timezone* temp = country->timezones[j];
+                    country->timezones[j] = previous;
+                    previous = temp;
+                }
+            }
+            if (previous->name == override->default_timezone_name)
+            {
+                country->timezones[0] = previous;
+                found = UTZ_TRUE;
+            }
+
+            if (!found)
+            {
+                utz_string_t_Concatenator cat = {};
+                FormatAdd(&cat, "Specified a default timezone override '%' for country '% (%)', but the country doesn't have this timezone. "
+                                "It has these timezones:",
+                                override->default_timezone_name, country->name, country->code);
+
+                For (country->timezones)
+                {
+                    add(&cat, "\n");
+                    add(&cat, (*it)->name);
+                }
+
+                return report_error(resolve_to_string_and_free(&cat, temp));
+            }
+        }
+#endif
+
+        // @Temporary
+        // // Resolve country aliases. These countries have already been inserted.
+        // for (utz_usize ai = 0; ai < UtzArrayCount(the_country_aliases); ai++)
+        // {
+        //     if (!utz_equals(the_country_aliases[ai].main_country_code, country->code)) continue;
+        //     for (utz_usize ci = 0; ci < UtzDynCount(tzs->countries); ci++)
+        //         if (utz_equals(the_country_aliases[ai].alias_country_code, tzs->countries[ci].code))
+        //         {
+        //             tzs->countries[ci].timezones = country->timezones;
+        //             break;
+        //         }
+        // }
+
+        country->timezone_count = UtzDynCount(country->timezones);
+        utz_usize code_index    = utz_country_code_index(country->code);
+        if (country->timezone_count && code_index < UtzArrayCount(tzs->country_default_timezones))
+            tzs->country_default_timezones[code_index] = country->timezones[0];
+    }
+    utz_phase_end(ctx, UTZ_PARSE_PHASE_COUNTRIES, countries_begin, UtzStr("zone1970.tab"));
+
+    if (allocator_userdata != result_userdata) utz_copy_result(tzs, result_userdata);
+
+    }
+cleanup:;
+    UtzFreeDynArray(&links);
+    utz_free_tarball(&tarball, allocator_userdata);
+    if (stream) utz_tar_stream_end(stream);
+    UtzFree(allocator_userdata, stream);
+
+    // Parts of tzs are still in scratch when this fails. The rest is in the result arena, which gets all of it back.
+    if (context.error && allocator_userdata != result_userdata) *tzs = UtzInit;
+    utz_end_scratch(ctx, &scratch);
+
+    utz_allocation_stats = allocation_stats;
+    if (stats) stats->total_nanoseconds = UtzNanoseconds() - parse_begin;
+
+    tzs->parsing_error = context.error;
+    return (tzs->parsing_error == NULL);
+
+#undef MustFindFile
+}
+
+
+#undef SetParseError
+#undef SetStaticParseError
+#undef ReportError
+#undef ReportStaticError
+#undef CopyToCharArray
+#undef SortByCharArray
+#undef FindByCharArray
+#undef FreeNestedDynArray
+
+// Compiles a zone of UTZ_PARSE_LAZY, or waits for the thread that's already compiling it.
+// Nothing else writes to the zone meanwhile: other threads only look at its name (lookups) and lazy_state.
+static void utz_compile_lazy_timezone(utz_timezone* tz)
+{
+    if (!UtzAtomicCompareExchange(&tz->lazy_state, UTZ_LAZY_PENDING, UTZ_LAZY_COMPILING))
+    {
+        // Compiling a zone takes microseconds, not worth sleeping for.
+        while (UtzAtomicLoadAcquire(&tz->lazy_state) != UTZ_LAZY_COMPILED) {}
+        return;
+    }
+
+    if (tz->alias_of)
+    {
+        // Links share the data of their zone. Everything from ranges up to lazy is compiled data.
+        utz_timezone* main = tz->alias_of;
+        if (UtzAtomicLoadAcquire(&main->lazy_state) != UTZ_LAZY_COMPILED) utz_compile_lazy_timezone(main);
+
+        utz_usize from = UtzOffsetOf(utz_timezone, ranges);
+        utz_usize to   = UtzOffsetOf(utz_timezone, lazy);
+        for (utz_usize i = from; i < to; i++) ((utz_u8*)tz)[i] = ((utz_u8*)main)[i];
+    }
+    else
+    {
+        void* allocator_userdata = tz->lazy->source->allocator_userdata;
+
+        utz_parse_context context = UtzInit;
+        utz_arena         scratch;
+        context.allocator_userdata = allocator_userdata;
+        context.max_year           = tz->lazy->source->max_year;
+        utz_begin_scratch(&context, &scratch);
+        utz_bool ok = utz_compile_lazy_zone(&context, tz);
+        utz_end_scratch(&context, &scratch);
+        if (!ok)
+        {
+            // Bad lines only show up now. All the compiled fields are still zero, except ranges, which makes the zone UTC.
+            UtzFreeDynArray(&tz->ranges);
+            tz->compile_error = context.error;
+        }
+    }
+
+    tz->lazy = NULL;
+    UtzAtomicStoreRelease(&tz->lazy_state, UTZ_LAZY_COMPILED);
+}
+
+// Every function taking a utz_timezone calls this before reading it.
+static inline void utz_ensure_compiled(utz_timezone* tz)
+{
+    if (tz && UtzAtomicLoadAcquire(&tz->lazy_state) != UTZ_LAZY_COMPILED) utz_compile_lazy_timezone(tz);
+}
+
+void utz_free_timezones(utz_timezones* tzs, void* allocator_userdata)
+{
+#ifndef UTZ_OVERRIDE_ALLOCATOR
+    // All of it goes with the arena.
+    if (utz_userdata_arena(allocator_userdata)) return;
+#endif
+
+    for (utz_usize ci = 0; ci < UtzDynCount(tzs->countries); ci++)
+    {
+        utz_country* country = &tzs->countries[ci];
+        UtzFreeDynArray(&country->timezones);
+    }
+
+    // Everything except the arrays of timezones and countries is part of the snapshot.
+    for (utz_usize zi = 0; zi < UtzDynCount(tzs->timezones) && !tzs->snapshot; zi++)
+    {
+        utz_timezone* timezone = &tzs->timezones[zi];
+        if (timezone->alias_of) continue;
+        utz_free_timezone_data(timezone, allocator_userdata);
+    }
+
+    UtzFreeDynArray(&tzs->countries);
+    UtzFreeDynArray(&tzs->timezones);
+    if (!tzs->snapshot) UtzFree(allocator_userdata, tzs->name_hash_seeds);
+    utz_free_lazy_source(tzs->lazy_source, allocator_userdata);
+
+#ifndef UTZ_NO_SPRINTF
+    UtzFree(allocator_userdata, (void*)tzs->parsing_error);
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Snapshot
+
+// Bump whenever the layout below or the meaning of the timezone data changes.
+#define UTZ_SNAPSHOT_VERSION    1
+#define UTZ_SNAPSHOT_BYTE_ORDER 0x01020304u
+
+// All offsets are from the start of the snapshot, 0 is "nothing" (the header is there).
+typedef struct utz_snapshot_header
+{
+    char    magic[8];                   // "utzsnap"
+    utz_u32 byte_order;                 // UTZ_SNAPSHOT_BYTE_ORDER, as stored by the machine that wrote it
+    utz_u32 version;                    // UTZ_SNAPSHOT_VERSION
+    utz_u64 snapshot_size;
+    utz_u64 header_size;                // sizes of the structs catch different layouts between compilers
+    utz_u64 timezone_size;
+    utz_u64 country_size;
+    char    iana_version[8];
+
+    utz_u64 timezone_count;
+    utz_u64 timezones;                  // utz_snapshot_timezone[timezone_count]
+    utz_u64 country_count;
+    utz_u64 countries;                  // utz_snapshot_country[country_count]
+    utz_u64 country_default_timezones;  // utz_u32[26 * 26], timezone index + 1, 0 for none
+
+    utz_u64 name_hash_seed_count;
+    utz_u64 name_hash_seeds;            // utz_u32[name_hash_seed_count]
+    utz_u64 name_hash_slots;            // utz_u32[timezone_count]
+} utz_snapshot_header;
+
+typedef struct utz_snapshot_timezone
+{
+    char            name[32 + 1];
+    utz_u8          kind;
+    utz_s32         alias_of;                   // timezone index, -1 for none
+    utz_s32         coordinate_latitude_seconds;
+    utz_s32         coordinate_longitude_seconds;
+    utz_s32         settled_offset_seconds;
+    utz_time_t      settled_since;
+    utz_time_t      settled_wall_since;
+    utz_tail_change tail_changes[2];
+    utz_u64         tail_change_count;
+
+    utz_u64 range_count;
+    utz_u64 ranges;                             // utz_time_range[range_count], preceded by a dynamic array header
+    utz_u64 range_since;                        // utz_time_t[range_count]
+    utz_u64 range_offset_seconds;               // utz_s32[range_count]
+    utz_u64 range_abbreviation_index;           // utz_u8[range_count]
+    utz_u64 range_wall_until;                   // utz_time_t[range_count]
+    utz_u64 range_wall_flags;                   // utz_u8[range_count]
+    utz_u64 abbreviation_count;
+    utz_u64 abbreviations;                      // char[abbreviation_count][5 + 1]
+
+    utz_u64 search_index_node_count;
+    utz_u64 search_index_keys;                  // utz_time_t[node_count * NODE_KEYS], on a cache line boundary
+    utz_u64 search_index_ranks;                 // utz_u32[node_count * NODE_KEYS + 1]
+
+    utz_u64 bucket_count;
+    utz_u64 bucket_shift;
+    utz_u64 bucket_first_range;                 // utz_u32[bucket_count]
+    utz_u64 bucket_first_wall_range;            // utz_u32[bucket_count]
+} utz_snapshot_timezone;
+
+typedef struct utz_snapshot_country
+{
+    char    code[2  + 1];
+    char    name[60 + 1];
+    utz_u64 timezone_count;
+    utz_u64 timezones;                          // utz_u32[timezone_count], timezone indices
+} utz_snapshot_country;
+
+typedef struct utz_snapshot_writer
+{
+    utz_u8*   buffer;   // NULL while measuring
+    utz_usize size;
+} utz_snapshot_writer;
+
+// Appends size bytes (zeros if data is NULL) at the next multiple of align and returns their offset.
+static utz_u64 utz_snapshot_put(utz_snapshot_writer* writer, const void* data, utz_usize size, utz_usize align = 8)
+{
+    utz_usize at = (writer->size + align - 1) & ~(align - 1);
+    if (writer->buffer)
+    {
+        for (utz_usize i = writer->size; i < at; i++) writer->buffer[i] = 0;
+        for (utz_usize i = 0; i < size; i++) writer->buffer[at + i] = data ? ((const utz_u8*) data)[i] : 0;
+    }
+    writer->size = at + size;
+    return at;
+}
+
+static void utz_write_snapshot_to(utz_timezones* tzs, utz_snapshot_writer* writer)
+{
+    utz_snapshot_header header = UtzInit;
+    utz_snapshot_put(writer, NULL, sizeof(header), 64);
+
+    utz_usize count = tzs->timezone_count;
+    header.timezone_count = count;
+    header.timezones      = utz_snapshot_put(writer, NULL, count * sizeof(utz_snapshot_timezone));
+
+    // Zones first, links then copy the record of the zone they point to.
+    for (int links = 0; links < 2; links++)
+    {
+        for (utz_usize i = 0; i < count; i++)
+        {
+            utz_timezone* tz = &tzs->timezones[i];
+            if ((tz->alias_of != NULL) != (links != 0)) continue;
+
+            utz_snapshot_timezone record = UtzInit;
+            if (tz->alias_of)
+            {
+                if (writer->buffer)
+                    record = ((utz_snapshot_timezone*)(writer->buffer + header.timezones))[tz->alias_of - tzs->timezones];
+                record.alias_of = (utz_s32)(tz->alias_of - tzs->timezones);
+            }
+            else
+            {
+                utz_usize n = tz->range_count;
+                utz_usize dyn_header[2] = { n, n }; // capacity and count, so that UtzDynCount works on loaded ranges
+
+                record.alias_of                 = -1;
+                record.kind                     = tz->kind;
+                record.settled_offset_seconds   = tz->settled_offset_seconds;
+                record.settled_since            = tz->settled_since;
+                record.settled_wall_since       = tz->settled_wall_since;
+                record.tail_changes[0]          = tz->tail_changes[0];
+                record.tail_changes[1]          = tz->tail_changes[1];
+                record.tail_change_count        = tz->tail_change_count;
+
+                record.range_count              = n;
+                record.ranges                   = utz_snapshot_put(writer, dyn_header, sizeof(dyn_header)) + sizeof(dyn_header);
+                utz_snapshot_put(writer, tz->ranges, n * sizeof(utz_time_range));
+                record.range_since              = utz_snapshot_put(writer, tz->range_since,              n * sizeof(utz_time_t));
+                record.range_wall_until         = utz_snapshot_put(writer, tz->range_wall_until,         n * sizeof(utz_time_t));
+                record.range_offset_seconds     = utz_snapshot_put(writer, tz->range_offset_seconds,     n * sizeof(utz_s32));
+                record.range_abbreviation_index = utz_snapshot_put(writer, tz->range_abbreviation_index, n * sizeof(utz_u8));
+                record.range_wall_flags         = utz_snapshot_put(writer, tz->range_wall_flags,         n * sizeof(utz_u8));
+                record.abbreviation_count       = tz->abbreviation_count;
+                record.abbreviations            = utz_snapshot_put(writer, tz->abbreviations, tz->abbreviation_count * sizeof(tz->abbreviations[0]));
+
+                if (tz->search_index_keys)
+                {
+                    utz_usize slots = tz->search_index_node_count * UTZ_SEARCH_INDEX_NODE_KEYS;
+                    record.search_index_node_count = tz->search_index_node_count;
+                    record.search_index_keys       = utz_snapshot_put(writer, tz->search_index_keys,  slots * sizeof(utz_time_t), 64);
+                    record.search_index_ranks      = utz_snapshot_put(writer, tz->search_index_ranks, (slots + 1) * sizeof(utz_u32));
+                }
+
+                if (tz->bucket_first_range)
+                {
+                    record.bucket_count            = tz->bucket_count;
+                    record.bucket_shift            = tz->bucket_shift;
+                    record.bucket_first_range      = utz_snapshot_put(writer, tz->bucket_first_range,      tz->bucket_count * sizeof(utz_u32));
+                    record.bucket_first_wall_range = utz_snapshot_put(writer, tz->bucket_first_wall_range, tz->bucket_count * sizeof(utz_u32));
+                }
+            }
+
+            UtzCopyArray(record.name, tz->name);
+            record.coordinate_latitude_seconds  = tz->coordinate_latitude_seconds;
+            record.coordinate_longitude_seconds = tz->coordinate_longitude_seconds;
+
+            if (writer->buffer)
+                ((utz_snapshot_timezone*)(writer->buffer + header.timezones))[i] = record;
+        }
+    }
+
+    header.country_count = tzs->country_count;
+    header.countries     = utz_snapshot_put(writer, NULL, tzs->country_count * sizeof(utz_snapshot_country));
+    for (utz_usize ci = 0; ci < tzs->country_count; ci++)
+    {
+        utz_country*         country = &tzs->countries[ci];
+        utz_snapshot_country record  = UtzInit;
+        UtzCopyArray(record.code, country->code);
+        UtzCopyArray(record.name, country->name);
+        record.timezone_count = country->timezone_count;
+        record.timezones      = utz_snapshot_put(writer, NULL, country->timezone_count * sizeof(utz_u32));
+
+        if (!writer->buffer) continue;
+        for (utz_usize i = 0; i < country->timezone_count; i++)
+            ((utz_u32*)(writer->buffer + record.timezones))[i] = (utz_u32)(country->timezones[i] - tzs->timezones);
+        ((utz_snapshot_country*)(writer->buffer + header.countries))[ci] = record;
+    }
+
+    header.country_default_timezones = utz_snapshot_put(writer, NULL, UtzArrayCount(tzs->country_default_timezones) * sizeof(utz_u32));
+    for (utz_usize i = 0; i < UtzArrayCount(tzs->country_default_timezones) && writer->buffer; i++)
+    {
+        utz_timezone* tz = tzs->country_default_timezones[i];
+        ((utz_u32*)(writer->buffer + header.country_default_timezones))[i] = tz ? (utz_u32)(tz - tzs->timezones) + 1 : 0;
+    }
+
+    if (tzs->name_hash_seeds)
+    {
+        header.name_hash_seed_count = tzs->name_hash_seed_count;
+        header.name_hash_seeds      = utz_snapshot_put(writer, tzs->name_hash_seeds, tzs->name_hash_seed_count * sizeof(utz_u32));
+        header.name_hash_slots      = utz_snapshot_put(writer, tzs->name_hash_slots, count * sizeof(utz_u32));
+    }
+
+    const char magic[8] = "utzsnap";
+    UtzCopyArray(header.magic, magic);
+    for (utz_usize i = 0; i < UtzArrayCount(tzs->iana_version); i++) header.iana_version[i] = tzs->iana_version[i];
+    header.byte_order    = UTZ_SNAPSHOT_BYTE_ORDER;
+    header.version       = UTZ_SNAPSHOT_VERSION;
+    header.snapshot_size = writer->size;
+    header.header_size   = sizeof(utz_snapshot_header);
+    header.timezone_size = sizeof(utz_snapshot_timezone);
+    header.country_size  = sizeof(utz_snapshot_country);
+    if (writer->buffer) *(utz_snapshot_header*) writer->buffer = header;
+}
+
+utz_usize utz_write_snapshot(utz_timezones* tzs, void* buffer, utz_usize buffer_size)
+{
+    for (utz_usize i = 0; i < tzs->timezone_count; i++)
+        utz_ensure_compiled(&tzs->timezones[i]);
+
+    utz_snapshot_writer measure = { NULL, 0 };
+    utz_write_snapshot_to(tzs, &measure);
+
+    if (buffer && measure.size <= buffer_size)
+    {
+        utz_snapshot_writer writer = { (utz_u8*) buffer, 0 };
+        utz_write_snapshot_to(tzs, &writer);
+    }
+    return measure.size;
+}
+
+// Returns count elements at offset in the snapshot, NULL for none. Clears *ok if they don't fit.
+static void* utz_snapshot_get(const utz_u8* snapshot, utz_usize snapshot_size, utz_u64 offset, utz_u64 count, utz_usize element_size,
+                              utz_usize align, utz_bool* ok)
+{
+    if (count == 0) return NULL;
+    if (offset > snapshot_size || offset % align || count > (snapshot_size - offset) / element_size)
+    {
+        *ok = UTZ_FALSE;
+        return NULL;
+    }
+    return (void*)(snapshot + offset);
+}
+
+// Whether the indices in a loaded timezone stay inside its arrays, the lookups don't check them.
+static utz_bool utz_snapshot_timezone_in_bounds(const utz_timezone* tz)
+{
+    utz_usize n = tz->range_count;
+    if (n && (tz->range_since[0] != UTZ_BEGINNING_OF_TIME || tz->range_wall_until[n - 1] != UTZ_END_OF_TIME)) return UTZ_FALSE;
+    if ((tz->search_index_node_count || tz->bucket_count) && !n)                                           return UTZ_FALSE;
+
+    for (utz_usize i = 0; i < n; i++)
+        if (tz->range_abbreviation_index[i] >= tz->abbreviation_count) return UTZ_FALSE;
+
+    for (utz_usize i = 0; i < tz->tail_change_count; i++)
+    {
+        const utz_tail_change* change = &tz->tail_changes[i];
+        if (change->abbreviation_index >= tz->abbreviation_count || change->month < 1 || change->month > 12 ||
+            change->day_kind > DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE || change->weekday > 6)
+            return UTZ_FALSE;
+    }
+
+    utz_usize slots = tz->search_index_node_count * UTZ_SEARCH_INDEX_NODE_KEYS;
+    for (utz_usize i = 0; i < slots + (slots ? 1 : 0); i++)
+        if (tz->search_index_ranks[i] > n) return UTZ_FALSE;
+
+    for (utz_usize b = 0; b < tz->bucket_count; b++)
+        if (tz->bucket_first_range[b] >= n || tz->bucket_first_wall_range[b] >= n) return UTZ_FALSE;
+
+    return UTZ_TRUE;
+}
+
+int utz_load_snapshot(utz_timezones* tzs, const void* snapshot, utz_usize snapshot_size, void* allocator_userdata)
+{
+#define LoadError(str) do {                                                            \
+    utz_free_timezones(tzs, allocator_userdata);                                       \
+    *tzs = UtzInit;                                                                    \
+    tzs->parsing_error = utz_allocate_string(allocator_userdata, UtzStr(str)).data;   \
+    return UTZ_FALSE;                                                                  \
+} while (0)
+
+#define SnapshotArray(type, offset, count, align) \
+    ((type*) utz_snapshot_get(base, snapshot_size, (offset), (count), sizeof(type), (align), &ok))
+
+    *tzs = UtzInit;
+    tzs->snapshot = snapshot;
+
+    const utz_u8* base = (const utz_u8*) snapshot;
+    utz_bool      ok   = UTZ_TRUE;
+
+    // The header check. Everything after it only turns offsets into pointers.
+    if ((utz_usize) base % 64)                       LoadError("Snapshot must be aligned to 64 bytes.");
+    if (snapshot_size < sizeof(utz_snapshot_header)) LoadError("Snapshot is too small.");
+
+    const utz_snapshot_header* header = (const utz_snapshot_header*) base;
+    if (!utz_equals(UtzStr("utzsnap"), header->magic))         LoadError("Not a utz snapshot.");
+    if (header->byte_order != UTZ_SNAPSHOT_BYTE_ORDER)         LoadError("Snapshot was written on a machine with a different byte order.");
+    if (header->version    != UTZ_SNAPSHOT_VERSION)            LoadError("Snapshot was written by a different version of utz.");
+    if (header->header_size   != sizeof(utz_snapshot_header)   ||
+        header->timezone_size != sizeof(utz_snapshot_timezone) ||
+        header->country_size  != sizeof(utz_snapshot_country))  LoadError("Snapshot was written with a different struct layout.");
+    if (header->snapshot_size > snapshot_size)                 LoadError("Snapshot is cut short.");
+
+    utz_usize timezone_count = (utz_usize) header->timezone_count;
+    utz_usize country_count  = (utz_usize) header->country_count;
+    const utz_snapshot_timezone* zones     = SnapshotArray(const utz_snapshot_timezone, header->timezones, timezone_count, 8);
+    const utz_snapshot_country*  countries = SnapshotArray(const utz_snapshot_country,  header->countries, country_count,  8);
+    const utz_u32*               defaults  = SnapshotArray(const utz_u32, header->country_default_timezones, 26 * 26, 4);
+    if (!ok || !defaults) LoadError("Snapshot is damaged (timezone or country table out of bounds).");
+
+    UtzCopyArray(tzs->iana_version, header->iana_version);
+    tzs->iana_version[UtzArrayCount(tzs->iana_version) - 1] = '\0';
+
+    UtzMakeDynArray(utz_timezone, &tzs->timezones, timezone_count ? timezone_count : 1);
+    for (utz_usize i = 0; i < timezone_count; i++)
+    {
+        const utz_snapshot_timezone* record = &zones[i];
+        utz_timezone                 tz     = UtzInit;
+        utz_usize                    n      = (utz_usize) record->range_count;
+
+        UtzCopyArray(tz.name, record->name);
+        tz.name[UtzArrayCount(tz.name) - 1] = '\0';
+        if (record->alias_of >= (utz_s32) timezone_count || record->alias_of == (utz_s32) i)
+            LoadError("Snapshot is damaged (bad link).");
+        tz.alias_of                     = (record->alias_of >= 0) ? &tzs->timezones[record->alias_of] : NULL;
+        tz.coordinate_latitude_seconds  = record->coordinate_latitude_seconds;
+        tz.coordinate_longitude_seconds = record->coordinate_longitude_seconds;
+
+        tz.kind                   = record->kind;
+        tz.settled_offset_seconds = record->settled_offset_seconds;
+        tz.settled_since          = record->settled_since;
+        tz.settled_wall_since     = record->settled_wall_since;
+        tz.tail_changes[0]        = record->tail_changes[0];
+        tz.tail_changes[1]        = record->tail_changes[1];
+        tz.tail_change_count      = (record->tail_change_count <= 2) ? (utz_usize) record->tail_change_count : 0;
+
+        tz.range_count              = n;
+        tz.ranges                   = SnapshotArray(utz_time_range, record->ranges,                   n, 8);
+        tz.range_since              = SnapshotArray(utz_time_t,     record->range_since,              n, 8);
+        tz.range_wall_until         = SnapshotArray(utz_time_t,     record->range_wall_until,         n, 8);
+        tz.range_offset_seconds     = SnapshotArray(utz_s32,        record->range_offset_seconds,     n, 4);
+        tz.range_abbreviation_index = SnapshotArray(utz_u8,         record->range_abbreviation_index, n, 1);
+        tz.range_wall_flags         = SnapshotArray(utz_u8,         record->range_wall_flags,         n, 1);
+        tz.abbreviation_count       = (utz_usize) record->abbreviation_count;
+        tz.abbreviations            = (char(*)[5 + 1]) utz_snapshot_get(base, snapshot_size, record->abbreviations, tz.abbreviation_count,
+                                                                        sizeof(tz.abbreviations[0]), 1, &ok);
+
+        utz_usize slots = (utz_usize) record->search_index_node_count * UTZ_SEARCH_INDEX_NODE_KEYS;
+        tz.search_index_node_count = (utz_usize) record->search_index_node_count;
+        tz.search_index_keys       = SnapshotArray(utz_time_t, record->search_index_keys,  slots,                 64);
+        tz.search_index_ranks      = SnapshotArray(utz_u32,    record->search_index_ranks, slots ? slots + 1 : 0, 4);
+
+        tz.bucket_count            = (utz_usize) record->bucket_count;
+        tz.bucket_shift            = (utz_u32)   record->bucket_shift;
+        tz.bucket_first_range      = SnapshotArray(utz_u32, record->bucket_first_range,      tz.bucket_count, 4);
+        tz.bucket_first_wall_range = SnapshotArray(utz_u32, record->bucket_first_wall_range, tz.bucket_count, 4);
+
+        if (!ok || (n && record->ranges < 2 * sizeof(utz_usize)) || tz.bucket_shift >= 64)
+            LoadError("Snapshot is damaged (timezone data out of bounds).");
+        if (!utz_snapshot_timezone_in_bounds(&tz))
+            LoadError("Snapshot is damaged (timezone index out of bounds).");
+        UtzDynAppend(utz_timezone, &tzs->timezones, &tz);
+    }
+    tzs->timezone_count = timezone_count;
+
+    UtzMakeDynArray(utz_country, &tzs->countries, country_count ? country_count : 1);
+    tzs->country_count = country_count;
+    for (utz_usize ci = 0; ci < country_count; ci++)
+    {
+        const utz_snapshot_country* record  = &countries[ci];
+        utz_country                 country = UtzInit;
+        UtzCopyArray(country.code, record->code);
+        UtzCopyArray(country.name, record->name);
+        country.code[UtzArrayCount(country.code) - 1] = '\0';
+        country.name[UtzArrayCount(country.name) - 1] = '\0';
+        UtzDynAppend(utz_country, &tzs->countries, &country);
+
+        const utz_u32* indices = SnapshotArray(const utz_u32, record->timezones, record->timezone_count, 4);
+        if (!ok) LoadError("Snapshot is damaged (country timezones out of bounds).");
+
+        utz_country* added = UtzDynGetLast(tzs->countries);
+        if (!record->timezone_count) continue;
+        UtzMakeDynArray(utz_timezone*, &added->timezones, (utz_usize) record->timezone_count);
+        for (utz_usize i = 0; i < record->timezone_count; i++)
+        {
+            if (indices[i] >= timezone_count) LoadError("Snapshot is damaged (bad country timezone).");
+            utz_timezone* tz = &tzs->timezones[indices[i]];
+            UtzDynAppend(utz_timezone*, &added->timezones, &tz);
+        }
+        added->timezone_count = UtzDynCount(added->timezones);
+    }
+
+    for (utz_usize i = 0; i < 26 * 26; i++)
+    {
+        if (defaults[i] > timezone_count) LoadError("Snapshot is damaged (bad country default timezone).");
+        tzs->country_default_timezones[i] = defaults[i] ? &tzs->timezones[defaults[i] - 1] : NULL;
+    }
+
+    tzs->name_hash_seed_count = (utz_usize) header->name_hash_seed_count;
+    tzs->name_hash_seeds      = SnapshotArray(utz_u32, header->name_hash_seeds, tzs->name_hash_seed_count, 4);
+    tzs->name_hash_slots      = SnapshotArray(utz_u32, header->name_hash_slots, tzs->name_hash_seeds ? timezone_count : 0, 4);
+    if (!ok) LoadError("Snapshot is damaged (name hash out of bounds).");
+    for (utz_usize i = 0; i < timezone_count && tzs->name_hash_slots; i++)
+        if (tzs->name_hash_slots[i] >= timezone_count) LoadError("Snapshot is damaged (bad name hash slot).");
+
+    return UTZ_TRUE;
+
+#undef SnapshotArray
+#undef LoadError
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Lookup
+
+// Same result as utz_find_timezone, binary search over the sorted names.
+static utz_timezone* utz_find_timezone_binary_search(utz_timezones* tzs, const char* name, utz_usize length)
+{
+    return (utz_timezone*) utz_find_by_char_array(
+        (unsigned char*) tzs->timezones, tzs->timezone_count, sizeof(utz_timezone),
+        UtzOffsetOf(utz_timezone, name), sizeof(tzs->timezones[0].name), (unsigned char*) name, length);
+}
+
+utz_timezone* utz_find_timezone(utz_timezones* tzs, const char* name, utz_usize length)
+{
+    utz_timezone* tz = NULL;
+    if (!tzs->name_hash_seeds) tz = utz_find_timezone_binary_search(tzs, name, length);
+    else if (length < sizeof(tzs->timezones[0].name))
+    {
+        // Every name maps to some slot, names that don't exist have to be caught by comparing.
+        utz_u64 hash = utz_hash_name(name, length);
+        utz_u32 seed = tzs->name_hash_seeds[utz_name_hash_bucket(hash, tzs->name_hash_seed_count)];
+        tz = &tzs->timezones[tzs->name_hash_slots[utz_name_hash_slot(hash, seed, tzs->timezone_count)]];
+
+        utz_string wanted = { length, (char*) name };
+        if (!utz_equals(wanted, tz->name)) tz = NULL;
+    }
+
+    utz_ensure_compiled(tz);
+    return tz;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Conversion
+
+// Returns the index of the last range with since <= utc.
+static utz_usize utz_find_range_binary_search(const utz_timezone* tz, utz_time_t utc)
+{
+    utz_usize lo = 0;
+    utz_usize hi = tz->range_count;
+    while (lo < hi)
+    {
+        utz_usize m = lo + (hi - lo) / 2;
+
+        if (tz->range_since[m] <= utc) lo = m + 1;
+        else                           hi = m;
+    }
+
+    // First range of all timezones must have since == UNIX_EPOCH, so a result (lo - 1) always exists.
+    UtzAssert(lo > 0);
+    return lo - 1;
+}
+
+// Returns how many of the 8 keys are <= x.
+static inline utz_usize utz_count_keys_at_or_before(const utz_time_t* keys, utz_time_t x)
+{
+#if !defined(UTZ_NO_SIMD) && defined(__AVX2__)
+    __m256i xv = _mm256_set1_epi64x(x);
+    __m256i a  = _mm256_cmpgt_epi64(_mm256_load_si256((const __m256i*)keys),     xv);
+    __m256i b  = _mm256_cmpgt_epi64(_mm256_load_si256((const __m256i*)keys + 1), xv);
+    int mask   = _mm256_movemask_pd(_mm256_castsi256_pd(a)) | (_mm256_movemask_pd(_mm256_castsi256_pd(b)) << 4);
+#elif !defined(UTZ_NO_SIMD) && defined(__SSE4_2__)
+    __m128i xv = _mm_set1_epi64x(x);
+    int mask   = 0;
+    for (int i = 0; i < 4; i++)
+        mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(_mm_load_si128((const __m128i*)keys + i), xv))) << (2 * i);
+#else
+    utz_usize count = 0;
+    for (utz_usize i = 0; i < UTZ_SEARCH_INDEX_NODE_KEYS; i++)
+        count += (keys[i] <= x);
+    return count;
+#endif
+
+#if !defined(UTZ_NO_SIMD) && (defined(__AVX2__) || defined(__SSE4_2__))
+    static const utz_u8 bits_in_nibble[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    return UTZ_SEARCH_INDEX_NODE_KEYS - bits_in_nibble[mask & 15] - bits_in_nibble[mask >> 4];
+#endif
+}
+
+// Same result as utz_find_range_binary_search, but walks search_index_keys without data dependent branches.
+static utz_usize utz_find_range_search_index(const utz_timezone* tz, utz_time_t utc)
+{
+    utz_usize node   = 0;
+    utz_usize result = tz->range_count; // rank of the first key > utc
+    while (node < tz->search_index_node_count)
+    {
+        utz_usize i = utz_count_keys_at_or_before(&tz->search_index_keys[node * UTZ_SEARCH_INDEX_NODE_KEYS], utc);
+        utz_usize candidate = tz->search_index_ranks[node * UTZ_SEARCH_INDEX_NODE_KEYS + i];
+        result = (i < UTZ_SEARCH_INDEX_NODE_KEYS) ? candidate : result;
+        node   = node * (UTZ_SEARCH_INDEX_NODE_KEYS + 1) + 1 + i;
+    }
+
+    UtzAssert(result > 0);
+    return result - 1;
+}
+
+// Same result as utz_find_range_binary_search, jumps to the bucket of utc and walks the few ranges starting in it.
+static inline utz_usize utz_find_range_bucket_index(const utz_timezone* tz, utz_time_t utc)
+{
+    if (utc < 0) return 0;
+
+    utz_usize b = (utz_usize)(utc >> tz->bucket_shift);
+    if (b >= tz->bucket_count) return tz->range_count - 1;
+
+    utz_usize i = tz->bucket_first_range[b];
+    while (i + 1 < tz->range_count && tz->range_since[i + 1] <= utc) i++;
+    return i;
+}
+
+static inline utz_usize utz_find_range(const utz_timezone* tz, utz_time_t utc)
+{
+    if      (tz->bucket_first_range) return utz_find_range_bucket_index (tz, utc);
+    else if (tz->search_index_keys)  return utz_find_range_search_index (tz, utc);
+    else                             return utz_find_range_binary_search(tz, utc);
+}
+
+static inline utz_time_t utz_year_from_days(utz_time_t days)
+{
+    days += 719468;
+    utz_time_t era = (days >= 0 ? days : days - 146096) / 146097;
+    utz_u32    doe = (utz_u32)(days - era * 146097);
+    utz_u32    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    utz_u32    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    utz_u32    mp  = (5 * doy + 2) / 153;
+    return era * 400 + (utz_time_t)yoe + (mp >= 10);
+}
+
+// UTC time of a tail change in the given year.
+static utz_time_t utz_tail_change_time(const utz_tail_change* change, utz_time_t year)
+{
+    utz_time_t day = 0;
+    if (change->day_kind == DAY_RULE_EQUAL_TO_DATE)
+    {
+        day = utz_days_from_civil(year, change->month, change->day);
+    }
+    else if (change->day_kind == DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE)
+    {
+        day  = utz_days_from_civil(year, change->month, change->day);
+        day += (change->weekday + 7 - utz_weekday_from_days(day)) % 7;
+    }
+    else
+    {
+        // "lastSun" is Sun<=31, clamp it to the end of shorter months.
+        static const utz_u8 days_in_month[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        utz_bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        utz_u32  last = days_in_month[change->month - 1] + (change->month == 2 && leap);
+
+        day  = utz_days_from_civil(year, change->month, change->day < last ? change->day : last);
+        day -= (utz_weekday_from_days(day) + 7 - change->weekday) % 7;
+    }
+
+    return day * 24 * 60 * 60 + change->at_seconds;
+}
+
+static inline utz_bool utz_in_tail(const utz_timezone* tz, utz_time_t utc)
+{
+    return tz->tail_change_count && utc >= tz->range_since[tz->range_count - 1];
+}
+
+typedef struct utz_tail_range
+{
+    utz_time_t             since;
+    utz_time_t             until;
+    const utz_tail_change* change; // in effect during [since, until)
+} utz_tail_range;
+
+// Finds the tail change in effect at utc, utz_in_tail(tz, utc) must be true.
+static utz_tail_range utz_find_tail_range(const utz_timezone* tz, utz_time_t utc)
+{
+    const utz_tail_change* first  = &tz->tail_changes[0];
+    const utz_tail_change* second = &tz->tail_changes[1];
+
+    // Changes close to new year can fall into the neighbouring UTC year, so check those too.
+    utz_time_t year = utz_year_from_days(utc / (24 * 60 * 60));
+    utz_time_t a    = utz_tail_change_time(first,  year);
+    utz_time_t b    = utz_tail_change_time(second, year);
+
+    utz_tail_range result;
+    if (utc < a)
+    {
+        utz_time_t previous = utz_tail_change_time(second, year - 1);
+        if (utc < previous) result = { utz_tail_change_time(first, year - 1), previous, first };
+        else                result = { previous, a, second };
+    }
+    else if (utc < b)
+    {
+        result = { a, b, first };
+    }
+    else
+    {
+        utz_time_t next = utz_tail_change_time(first, year + 1);
+        if (utc >= next) result = { next, utz_tail_change_time(second, year + 1), first };
+        else             result = { b, next, second };
+    }
+
+    UtzAssert(result.since <= utc && utc < result.until);
+    return result;
+}
+
+// utz_wall_time_from_utc of a zone that's already compiled, inlined into the batch functions.
+static inline utz_time_t utz_wall_time_from_utc_compiled(const utz_timezone* tz, utz_time_t utc)
+{
+    if (tz == NULL)                return utc;
+    if (utc >= tz->settled_since)  return utc + tz->settled_offset_seconds; // Fixed zones, and after the last change.
+    if (utc < 0)                   return utc; // We pretend there are no timezones before UNIX_EPOCH
+    if (tz->range_count == 0)      return utc; // utz_timezone without ranges - this is just the "UTC" timezone.
+
+    if (utz_in_tail(tz, utc)) return utc + utz_find_tail_range(tz, utc).change->offset_seconds;
+    return utc + tz->range_offset_seconds[utz_find_range(tz, utc)];
+}
+
+utz_time_t utz_wall_time_from_utc(utz_timezone* tz, utz_time_t utc)
+{
+    utz_ensure_compiled(tz);
+    return utz_wall_time_from_utc_compiled(tz, utc);
+}
+
+static inline utz_s32 utz_offset_at(const utz_timezone* tz, utz_time_t utc)
+{
+    return (utz_s32)(utz_wall_time_from_utc((utz_timezone*)tz, utc) - utc);
+}
+
+// Returns the index of the first range with wall_time <= range_wall_until.
+static utz_usize utz_find_wall_range(const utz_timezone* tz, utz_time_t wall_time)
+{
+    if (tz->bucket_first_wall_range && wall_time >= 0)
+    {
+        utz_usize b = (utz_usize)(wall_time >> tz->bucket_shift);
+        if (b >= tz->bucket_count) return tz->range_count - 1;
+
+        utz_usize i = tz->bucket_first_wall_range[b];
+        while (tz->range_wall_until[i] < wall_time) i++;
+        return i;
+    }
+
+    const utz_time_t* base  = tz->range_wall_until;
+    utz_usize         count = tz->range_count;
+    while (count > 1)
+    {
+        utz_usize half = count / 2;
+        base   = (base[half - 1] < wall_time) ? base + half : base;
+        count -= half;
+    }
+
+    // The last range ends at the end of time, so this never runs past the array.
+    return (utz_usize)(base - tz->range_wall_until) + (*base < wall_time);
+}
+
+// Computes the conversion for a wall time known to resolve to range i (see utz_find_wall_range).
+static inline utz_conversion utz_resolve_wall_time(const utz_timezone* tz, utz_usize i, utz_time_t wall_time)
+{
+    utz_u8     flags = tz->range_wall_flags[i];
+    utz_time_t utc   = wall_time - tz->range_offset_seconds[i];
+
+    // Exact moment of changing a range belongs to current.
+    // Because of this, both wall times when clocks go forward are not treated as invalid,
+    // and both times when clocks go backwards are treated as ambiguous.
+    if (flags & UTZ_WALL_OVERLAP_AFTER)
+    {
+        utz_time_t utc_with_next = wall_time - tz->range_offset_seconds[i + 1];
+        // We belong in both current and next (ambiguity).
+        if (utc_with_next >= tz->range_since[i + 1])
+            return { UTZ_TIMESTAMP_CONVERSION_INPUT_AMBIGUOUS, utc, utc_with_next, utc };
+    }
+
+    // Wall time is invalid, it was skipped when clocks moved forward into this range.
+    // Never true for the first range, it starts at the beginning of time.
+    if ((flags & UTZ_WALL_GAP_BEFORE) && utc < tz->range_since[i])
+    {
+        utz_time_t utc_with_previous = wall_time - tz->range_offset_seconds[i - 1];
+        return { UTZ_TIMESTAMP_CONVERSION_INPUT_INVALID, utc, utc_with_previous, tz->range_since[i] };
+    }
+
+    return { UTZ_TIMESTAMP_CONVERSION_OK, utc, utc, utc };
+}
+
+// utz_resolve_wall_time for wall times past the wall times of range_count - 2, in zones with a tail.
+// Same rules as utz_resolve_wall_time: a wall time reads correctly with an offset if that offset is in effect
+// at the resulting UTC time, or right before it (the exact moment of a change belongs to both sides).
+static utz_conversion utz_resolve_tail_wall_time(const utz_timezone* tz, utz_time_t wall_time)
+{
+    utz_time_t utc  [2];
+    utz_bool   valid[2];
+    for (utz_usize k = 0; k < 2; k++)
+    {
+        utz_s32 offset = tz->tail_changes[k].offset_seconds;
+        utc  [k] = wall_time - offset;
+        valid[k] = (utz_offset_at(tz, utc[k]) == offset || utz_offset_at(tz, utc[k] - 1) == offset);
+    }
+
+    if (valid[0] && valid[1])
+    {
+        utz_time_t earlier = (utc[0] < utc[1]) ? utc[0] : utc[1];
+        utz_time_t later   = (utc[0] < utc[1]) ? utc[1] : utc[0];
+        return { UTZ_TIMESTAMP_CONVERSION_INPUT_AMBIGUOUS, earlier, later, earlier };
+    }
+    if (valid[0]) return { UTZ_TIMESTAMP_CONVERSION_OK, utc[0], utc[0], utc[0] };
+    if (valid[1]) return { UTZ_TIMESTAMP_CONVERSION_OK, utc[1], utc[1], utc[1] };
+
+    // Clocks jumped over the wall time. Reading it with the smallest offset around lands right after the jump.
+    utz_s32 smallest = tz->range_offset_seconds[tz->range_count - 2];
+    if (tz->tail_changes[0].offset_seconds < smallest) smallest = tz->tail_changes[0].offset_seconds;
+    if (tz->tail_changes[1].offset_seconds < smallest) smallest = tz->tail_changes[1].offset_seconds;
+
+    utz_tail_range after = utz_find_tail_range(tz, wall_time - smallest);
+    utz_s32 offset_before = utz_offset_at(tz, after.since - 1);
+    return { UTZ_TIMESTAMP_CONVERSION_INPUT_INVALID, wall_time - after.change->offset_seconds, wall_time - offset_before, after.since };
+}
+
+utz_conversion utz_utc_from_wall_time(utz_timezone* tz, utz_time_t wall_time)
+{
+    utz_ensure_compiled(tz);
+    if (tz == NULL)
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+
+    if (wall_time < 24 * 60 * 60)
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };  // too close to zero, might underflow
+
+    if (wall_time >= tz->settled_wall_since)
+    {
+        utz_time_t utc = wall_time - tz->settled_offset_seconds;
+        return { UTZ_TIMESTAMP_CONVERSION_OK, utc, utc, utc };
+    }
+
+    if (tz->range_count == 0)
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+
+    utz_usize i = utz_find_wall_range(tz, wall_time);
+    if (i + 1 == tz->range_count && tz->tail_change_count) return utz_resolve_tail_wall_time(tz, wall_time);
+    return utz_resolve_wall_time(tz, i, wall_time);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cursor
+
+void utz_cursor_init(utz_cursor* cursor, utz_timezone* tz)
+{
+    utz_ensure_compiled(tz);
+    cursor->tz = tz;
+
+    // Empty intervals, the first conversion in each direction always misses.
+    cursor->utc_from            = UTZ_END_OF_TIME;
+    cursor->utc_to              = UTZ_BEGINNING_OF_TIME;
+    cursor->utc_offset_seconds  = 0;
+    cursor->wall_from           = UTZ_END_OF_TIME;
+    cursor->wall_to             = UTZ_BEGINNING_OF_TIME;
+    cursor->wall_offset_seconds = 0;
+}
+
+static utz_time_t utz_cursor_wall_time_from_utc_miss(utz_cursor* cursor, utz_time_t utc)
+{
+    utz_timezone* tz = cursor->tz;
+    if (tz == NULL || tz->range_count == 0)
+    {
+        cursor->utc_from           = UTZ_BEGINNING_OF_TIME;
+        cursor->utc_to             = UTZ_END_OF_TIME;
+        cursor->utc_offset_seconds = 0;
+    }
+    else if (utc < 0)
+    {
+        // Same as utz_wall_time_from_utc, there are no timezones before UNIX_EPOCH.
+        cursor->utc_from           = UTZ_BEGINNING_OF_TIME;
+        cursor->utc_to             = 0;
+        cursor->utc_offset_seconds = 0;
+    }
+    else if (utz_in_tail(tz, utc))
+    {
+        utz_tail_range tail = utz_find_tail_range(tz, utc);
+        cursor->utc_from           = tail.since;
+        cursor->utc_to             = tail.until;
+        cursor->utc_offset_seconds = tail.change->offset_seconds;
+    }
+    else
+    {
+        utz_usize i = utz_find_range(tz, utc);
+        cursor->utc_from           = (tz->range_since[i] > 0) ? tz->range_since[i] : 0;
+        cursor->utc_to             = (i + 1 < tz->range_count) ? tz->range_since[i + 1] : UTZ_END_OF_TIME;
+        cursor->utc_offset_seconds = tz->range_offset_seconds[i];
+    }
+
+    return utc + cursor->utc_offset_seconds;
+}
+
+utz_time_t utz_cursor_wall_time_from_utc(utz_cursor* cursor, utz_time_t utc)
+{
+    if (utc >= cursor->utc_from && utc < cursor->utc_to) return utc + cursor->utc_offset_seconds;
+    return utz_cursor_wall_time_from_utc_miss(cursor, utc);
+}
+
+static utz_conversion utz_cursor_utc_from_wall_time_miss(utz_cursor* cursor, utz_time_t wall_time)
+{
+    utz_timezone* tz = cursor->tz;
+    if (tz == NULL || tz->range_count == 0)
+    {
+        cursor->wall_from           = UTZ_BEGINNING_OF_TIME;
+        cursor->wall_to             = UTZ_END_OF_TIME;
+        cursor->wall_offset_seconds = 0;
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+    }
+
+    if (wall_time < 24 * 60 * 60)
+    {
+        // Same as utz_utc_from_wall_time, too close to zero.
+        cursor->wall_from           = UTZ_BEGINNING_OF_TIME;
+        cursor->wall_to             = 24 * 60 * 60 - 1;
+        cursor->wall_offset_seconds = 0;
+        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+    }
+
+    utz_usize i = utz_find_wall_range(tz, wall_time);
+    if (i + 1 == tz->range_count && tz->tail_change_count)
+    {
+        utz_conversion result = utz_resolve_tail_wall_time(tz, wall_time);
+        if (result.status != UTZ_TIMESTAMP_CONVERSION_OK || !utz_in_tail(tz, result.earlier)) return result;
+
+        // Same bounds as for a range below, for the tail change the result came from.
+        utz_tail_range tail   = utz_find_tail_range(tz, result.earlier);
+        utz_s32        offset = tail.change->offset_seconds;
+        if (offset != wall_time - result.earlier) return result;
+
+        utz_time_t from = tail.since + offset;
+        utz_time_t to   = tail.until + offset;
+        if (from < tail.since + utz_offset_at(tz, tail.since - 1) + 1) from = tail.since + utz_offset_at(tz, tail.since - 1) + 1;
+        if (to   > tail.until + utz_offset_at(tz, tail.until) - 1)     to   = tail.until + utz_offset_at(tz, tail.until) - 1;
+
+        cursor->wall_from           = from;
+        cursor->wall_to             = to;
+        cursor->wall_offset_seconds = offset;
+        return result;
+    }
+
+    utz_conversion result = utz_resolve_wall_time(tz, i, wall_time);
+
+    // Only cache the part of range i where utz_resolve_wall_time can't report a gap or an overlap,
+    // anything outside of it is rare enough to always take the full lookup.
+    if (result.status == UTZ_TIMESTAMP_CONVERSION_OK)
+    {
+        utz_s32    offset = tz->range_offset_seconds[i];
+        utz_time_t from   = 24 * 60 * 60;
+        utz_time_t to     = tz->range_wall_until[i];
+
+        // The first range starts at the beginning of time, adding its offset would overflow.
+        if (i > 0 && from < tz->range_since[i] + offset)     from = tz->range_since[i] + offset;
+        if (i > 0 && from < tz->range_wall_until[i - 1] + 1) from = tz->range_wall_until[i - 1] + 1;
+        if (i + 1 < tz->range_count && to > tz->range_since[i + 1] + tz->range_offset_seconds[i + 1] - 1)
+            to = tz->range_since[i + 1] + tz->range_offset_seconds[i + 1] - 1;
+
+        cursor->wall_from           = from;
+        cursor->wall_to             = to;
+        cursor->wall_offset_seconds = offset;
+    }
+
+    return result;
+}
+
+utz_conversion utz_cursor_utc_from_wall_time(utz_cursor* cursor, utz_time_t wall_time)
+{
+    if (wall_time >= cursor->wall_from && wall_time <= cursor->wall_to)
+    {
+        utz_time_t utc = wall_time - cursor->wall_offset_seconds;
+        return { UTZ_TIMESTAMP_CONVERSION_OK, utc, utc, utc };
+    }
+    return utz_cursor_utc_from_wall_time_miss(cursor, wall_time);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch conversion
+
+// Batches are processed in blocks. Each block is checked for sortedness on its own,
+// so partially sorted columns still get the cursor sweep where it pays off.
+#define UTZ_BATCH_BLOCK_SIZE 256
+
+static utz_bool utz_is_nearly_sorted(const utz_time_t* values, utz_usize count)
+{
+    utz_usize descents = 0;
+    for (utz_usize i = 1; i < count; i++)
+        descents += (values[i] < values[i - 1]);
+    return descents <= count / 16;
+}
+
+// Kernels for unsorted input. Each converts count timestamps with tz->range_count > 0.
+// They only search the ranges, timestamps in the tail are redone by utz_fix_tail afterwards.
+typedef void utz_wall_time_kernel(const utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count);
+
+static void utz_fix_tail(const utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    if (!tz->tail_change_count) return;
+
+    utz_time_t tail_since = tz->range_since[tz->range_count - 1];
+    for (utz_usize i = 0; i < count; i++)
+        if (utc[i] >= tail_since) out_wall_time[i] = utc[i] + utz_find_tail_range(tz, utc[i]).change->offset_seconds;
+}
+
+static void utz_wall_time_from_utc_scalar(const utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    for (utz_usize i = 0; i < count; i++)
+        out_wall_time[i] = (utc[i] < 0) ? utc[i] : utc[i] + tz->range_offset_seconds[utz_find_range(tz, utc[i])];
+}
+
+#ifdef UTZ_SIMD_DISPATCH
+
+// The vector kernels find the same range as utz_find_range_binary_search (searching range_since), one lane per
+// timestamp and without branches. All lanes take the same number of steps, so the only per-lane state is the index,
+// and every step is one gather. Each step waits for the gather before it, so two vectors are searched at once to
+// keep more loads in flight, that's what makes them faster than a scalar search.
+
+static UTZ_TARGET_AVX2 void utz_wall_time_from_utc_avx2(const utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    utz_usize i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x0     = _mm256_loadu_si256((const __m256i*)(utc + i));
+        __m256i x1     = _mm256_loadu_si256((const __m256i*)(utc + i + 4));
+        __m256i index0 = zero;
+        __m256i index1 = zero;
+        for (utz_usize n = tz->range_count; n > 1; )
+        {
+            utz_usize half   = n / 2;
+            __m256i   step   = _mm256_set1_epi64x((long long)half);
+            __m256i   probe0 = _mm256_add_epi64(index0, step);
+            __m256i   probe1 = _mm256_add_epi64(index1, step);
+            __m256i   since0 = _mm256_i64gather_epi64((const long long*)tz->range_since, probe0, 8);
+            __m256i   since1 = _mm256_i64gather_epi64((const long long*)tz->range_since, probe1, 8);
+            index0 = _mm256_blendv_epi8(probe0, index0, _mm256_cmpgt_epi64(since0, x0));
+            index1 = _mm256_blendv_epi8(probe1, index1, _mm256_cmpgt_epi64(since1, x1));
+            n     -= half;
+        }
+
+        __m256i wall0 = _mm256_add_epi64(x0, _mm256_cvtepi32_epi64(_mm256_i64gather_epi32((const int*)tz->range_offset_seconds, index0, 4)));
+        __m256i wall1 = _mm256_add_epi64(x1, _mm256_cvtepi32_epi64(_mm256_i64gather_epi32((const int*)tz->range_offset_seconds, index1, 4)));
+        wall0 = _mm256_blendv_epi8(wall0, x0, _mm256_cmpgt_epi64(zero, x0)); // We pretend there are no timezones before UNIX_EPOCH
+        wall1 = _mm256_blendv_epi8(wall1, x1, _mm256_cmpgt_epi64(zero, x1));
+        _mm256_storeu_si256((__m256i*)(out_wall_time + i),     wall0);
+        _mm256_storeu_si256((__m256i*)(out_wall_time + i + 4), wall1);
+    }
+
+    utz_wall_time_from_utc_scalar(tz, utc + i, out_wall_time + i, count - i);
+}
+
+static UTZ_TARGET_AVX512 void utz_wall_time_from_utc_avx512(const utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    const __m512i zero = _mm512_setzero_si512();
+
+    utz_usize i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i x0     = _mm512_loadu_si512((const void*)(utc + i));
+        __m512i x1     = _mm512_loadu_si512((const void*)(utc + i + 8));
+        __m512i index0 = zero;
+        __m512i index1 = zero;
+        for (utz_usize n = tz->range_count; n > 1; )
+        {
+            utz_usize half   = n / 2;
+            __m512i   step   = _mm512_set1_epi64((long long)half);
+            __m512i   since0 = _mm512_i64gather_epi64(_mm512_add_epi64(index0, step), (const void*)tz->range_since, 8);
+            __m512i   since1 = _mm512_i64gather_epi64(_mm512_add_epi64(index1, step), (const void*)tz->range_since, 8);
+            index0 = _mm512_mask_add_epi64(index0, _mm512_cmple_epi64_mask(since0, x0), index0, step);
+            index1 = _mm512_mask_add_epi64(index1, _mm512_cmple_epi64_mask(since1, x1), index1, step);
+            n     -= half;
+        }
+
+        __m512i wall0 = _mm512_add_epi64(x0, _mm512_cvtepi32_epi64(_mm512_i64gather_epi32(index0, (const void*)tz->range_offset_seconds, 4)));
+        __m512i wall1 = _mm512_add_epi64(x1, _mm512_cvtepi32_epi64(_mm512_i64gather_epi32(index1, (const void*)tz->range_offset_seconds, 4)));
+        wall0 = _mm512_mask_mov_epi64(wall0, _mm512_cmplt_epi64_mask(x0, zero), x0); // We pretend there are no timezones before UNIX_EPOCH
+        wall1 = _mm512_mask_mov_epi64(wall1, _mm512_cmplt_epi64_mask(x1, zero), x1);
+        _mm512_storeu_si512((void*)(out_wall_time + i),     wall0);
+        _mm512_storeu_si512((void*)(out_wall_time + i + 8), wall1);
+    }
+
+    utz_wall_time_from_utc_scalar(tz, utc + i, out_wall_time + i, count - i);
+}
+
+static utz_bool utz_cpu_supports(utz_bool avx512)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return UTZ_FALSE;
+
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27))) return UTZ_FALSE; // OSXSAVE
+
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if (avx512) return (info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6;
+    else        return (info[1] & (1 <<  5)) && (xcr0 & 0x06) == 0x06;
+#else
+    if (avx512) return __builtin_cpu_supports("avx512f");
+    else        return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // UTZ_SIMD_DISPATCH
+
+enum utz_kernel_support
+{
+    UTZ_KERNEL_UNKNOWN,
+    UTZ_KERNEL_NONE,
+    UTZ_KERNEL_AVX2,
+    UTZ_KERNEL_AVX512,
+};
+
+// NULL when converting the timestamps one by one is faster.
+static utz_wall_time_kernel* utz_pick_wall_time_kernel(const utz_timezone* tz)
+{
+    // A bucket lookup is a couple of compares, which beats searching several timestamps at once.
+    if (tz->bucket_first_range || !tz->range_count) return NULL;
+
+#ifdef UTZ_SIMD_DISPATCH
+    // The first batch asks the CPU, racing threads all store the same answer.
+    static utz_u32 cpu = UTZ_KERNEL_UNKNOWN;
+    utz_u32 supported = UtzAtomicLoadAcquire(&cpu);
+    if (supported == UTZ_KERNEL_UNKNOWN)
+    {
+        supported = utz_cpu_supports(UTZ_TRUE)  ? UTZ_KERNEL_AVX512 :
+                    utz_cpu_supports(UTZ_FALSE) ? UTZ_KERNEL_AVX2   : UTZ_KERNEL_NONE;
+        UtzAtomicStoreRelease(&cpu, supported);
+    }
+
+    if (supported == UTZ_KERNEL_AVX512) return utz_wall_time_from_utc_avx512;
+    if (supported == UTZ_KERNEL_AVX2)   return utz_wall_time_from_utc_avx2;
+#endif
+    return NULL;
+}
+
+void utz_wall_time_from_utc_batch(utz_timezone* tz, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    utz_ensure_compiled(tz);
+    if (tz == NULL)
+    {
+        for (utz_usize i = 0; i < count; i++) out_wall_time[i] = utc[i];
+        return;
+    }
+
+    if (tz->kind == UTZ_TIMEZONE_FIXED)
+    {
+        // No search at all, this loop vectorizes.
+        utz_time_t since  = tz->settled_since;
+        utz_time_t offset = tz->settled_offset_seconds;
+        for (utz_usize i = 0; i < count; i++) out_wall_time[i] = utc[i] + ((utc[i] >= since) ? offset : 0);
+        return;
+    }
+
+    utz_cursor cursor;
+    utz_cursor_init(&cursor, tz);
+    for (utz_usize block = 0; block < count; block += UTZ_BATCH_BLOCK_SIZE)
+    {
+        utz_usize end = (count - block < UTZ_BATCH_BLOCK_SIZE) ? count : block + UTZ_BATCH_BLOCK_SIZE;
+
+        if (utz_is_nearly_sorted(utc + block, end - block))
+        {
+            for (utz_usize i = block; i < end; i++)
+                out_wall_time[i] = utz_cursor_wall_time_from_utc(&cursor, utc[i]);
+        }
+        else if (utz_wall_time_kernel* kernel = utz_pick_wall_time_kernel(tz))
+        {
+            kernel(tz, utc + block, out_wall_time + block, end - block);
+            utz_fix_tail(tz, utc + block, out_wall_time + block, end - block);
+        }
+        else
+        {
+            // The same code as utz_wall_time_from_utc, without a call per timestamp.
+            for (utz_usize i = block; i < end; i++)
+                out_wall_time[i] = utz_wall_time_from_utc_compiled(tz, utc[i]);
+        }
+    }
+}
+
+void utz_utc_from_wall_time_batch(utz_timezone* tz, const utz_time_t* wall_time, utz_conversion* out_result, utz_usize count)
+{
+    utz_ensure_compiled(tz);
+    if (tz == NULL || tz->range_count == 0)
+    {
+        for (utz_usize i = 0; i < count; i++)
+            out_result[i] = { UTZ_TIMESTAMP_CONVERSION_OK, wall_time[i], wall_time[i], wall_time[i] };
+        return;
+    }
+
+    utz_cursor cursor;
+    utz_cursor_init(&cursor, tz);
+    for (utz_usize block = 0; block < count; block += UTZ_BATCH_BLOCK_SIZE)
+    {
+        utz_usize end = (count - block < UTZ_BATCH_BLOCK_SIZE) ? count : block + UTZ_BATCH_BLOCK_SIZE;
+
+        if (utz_is_nearly_sorted(wall_time + block, end - block))
+        {
+            for (utz_usize i = block; i < end; i++)
+                out_result[i] = utz_cursor_utc_from_wall_time(&cursor, wall_time[i]);
+        }
+        else
+        {
+            for (utz_usize i = block; i < end; i++)
+                out_result[i] = utz_utc_from_wall_time(tz, wall_time[i]);
+        }
+    }
+}
+
+// Rows are grouped in chunks, so the scratch space is about 25 KB of stack.
+#define UTZ_MULTI_CHUNK_SIZE 512
+
+// Grouping only pays off when the rows of a group go through a kernel or the cursor sweep, so when zones repeat a lot.
+// A chunk with more zones than this in its first rows goes row by row instead.
+#define UTZ_MULTI_SAMPLE_ROWS  64
+#define UTZ_MULTI_SAMPLE_ZONES 8
+
+// Rows that go one by one start loading their zone this many rows ahead.
+#define UTZ_MULTI_PREFETCH_ROWS 8
+
+// Whether the first rows of a chunk only use a few zones.
+static utz_bool utz_few_zones(utz_timezone* const* timezones, utz_usize rows)
+{
+    utz_timezone* seen[UTZ_MULTI_SAMPLE_ZONES];
+    utz_usize     seen_count = 0;
+    for (utz_usize i = 0; i < rows && i < UTZ_MULTI_SAMPLE_ROWS; i++)
+    {
+        utz_usize j = 0;
+        while (j < seen_count && seen[j] != timezones[i]) j++;
+        if (j < seen_count) continue;
+
+        if (seen_count == UTZ_MULTI_SAMPLE_ZONES) return UTZ_FALSE;
+        seen[seen_count++] = timezones[i];
+    }
+    return UTZ_TRUE;
+}
+
+// Starts loading what converting utc in tz will touch first.
+static inline void utz_prefetch_zone(const utz_timezone* tz, utz_time_t utc)
+{
+    if (!tz || !tz->range_count || utc < 0 || utc >= tz->settled_since) return;
+    if (tz->tail_change_count) UtzPrefetch(tz->range_since + tz->range_count - 1);
+
+    if (tz->bucket_first_range)
+    {
+        utz_usize b = (utz_usize)(utc >> tz->bucket_shift);
+        if (b < tz->bucket_count) UtzPrefetch(tz->bucket_first_range + b);
+    }
+    else if (tz->search_index_keys)
+    {
+        UtzPrefetch(tz->search_index_keys);
+        UtzPrefetch(tz->search_index_ranks);
+    }
+    else
+    {
+        UtzPrefetch(tz->range_since);
+        UtzPrefetch(tz->range_since + tz->range_count / 2);
+        UtzPrefetch(tz->range_since + tz->range_count / 4);
+        UtzPrefetch(tz->range_since + tz->range_count / 4 * 3);
+    }
+    UtzPrefetch(tz->range_offset_seconds);
+}
+
+void utz_wall_time_from_utc_multi(utz_timezone** timezones, const utz_time_t* utc, utz_time_t* out_wall_time, utz_usize count)
+{
+    utz_timezone* slot_zone [2 * UTZ_MULTI_CHUNK_SIZE]; // open addressing, zone -> group
+    utz_u16       slot_group[2 * UTZ_MULTI_CHUNK_SIZE];
+    utz_timezone* group_zone [UTZ_MULTI_CHUNK_SIZE];
+    utz_u16       group_start[UTZ_MULTI_CHUNK_SIZE + 1];
+    utz_u16       row_group  [UTZ_MULTI_CHUNK_SIZE];
+    utz_u16       order      [UTZ_MULTI_CHUNK_SIZE];   // chunk rows, sorted by group
+    utz_time_t    scratch_in [UTZ_MULTI_CHUNK_SIZE];
+    utz_time_t    scratch_out[UTZ_MULTI_CHUNK_SIZE];
+
+    for (utz_usize chunk = 0; chunk < count; chunk += UTZ_MULTI_CHUNK_SIZE)
+    {
+        utz_usize rows = (count - chunk < UTZ_MULTI_CHUNK_SIZE) ? count - chunk : UTZ_MULTI_CHUNK_SIZE;
+
+        if (!utz_few_zones(timezones + chunk, rows))
+        {
+            for (utz_usize i = chunk; i < chunk + rows; i++)
+            {
+                if (i + UTZ_MULTI_PREFETCH_ROWS < count)
+                {
+                    utz_ensure_compiled(timezones[i + UTZ_MULTI_PREFETCH_ROWS]);
+                    utz_prefetch_zone(timezones[i + UTZ_MULTI_PREFETCH_ROWS], utc[i + UTZ_MULTI_PREFETCH_ROWS]);
+                }
+                out_wall_time[i] = utz_wall_time_from_utc(timezones[i], utc[i]);
+            }
+            continue;
+        }
+
+        // Assign group ids in order of first appearance and count rows per group.
+        for (utz_usize i = 0; i < UtzArrayCount(slot_group); i++) slot_group[i] = 0xFFFF;
+
+        utz_usize group_count = 0;
+        for (utz_usize i = 0; i < rows; i++)
+        {
+            utz_timezone* tz   = timezones[chunk + i];
+            utz_usize     slot = ((utz_usize)tz >> 4) * 0x9E3779B1u % UtzArrayCount(slot_group);
+            while (slot_group[slot] != 0xFFFF && slot_zone[slot] != tz)
+                slot = (slot + 1 == UtzArrayCount(slot_group)) ? 0 : slot + 1;
+
+            if (slot_group[slot] == 0xFFFF)
+            {
+                utz_ensure_compiled(tz);
+                slot_zone [slot] = tz;
+                slot_group[slot] = (utz_u16) group_count;
+                group_zone [group_count] = tz;
+                group_start[group_count] = 0;
+                group_count++;
+            }
+
+            row_group[i] = slot_group[slot];
+            group_start[row_group[i]]++;
+        }
+
+        // Counts to exclusive prefix sums, then a stable counting sort of the rows.
+        utz_u16 total = 0;
+        for (utz_usize g = 0; g < group_count; g++)
+        {
+            utz_u16 size   = group_start[g];
+            group_start[g] = total;
+            total         += size;
+        }
+        group_start[group_count] = total;
+
+        for (utz_usize i = 0; i < rows; i++)
+            order[group_start[row_group[i]]++] = (utz_u16) i;
+        for (utz_usize g = group_count; g > 0; g--)
+            group_start[g] = group_start[g - 1];
+        group_start[0] = 0;
+
+        // Convert group by group, the next zone's arrays are loading (for its first row) while the current one is searched.
+        utz_prefetch_zone(group_zone[0], utc[chunk + order[0]]);
+        for (utz_usize g = 0; g < group_count; g++)
+        {
+            if (g + 1 < group_count) utz_prefetch_zone(group_zone[g + 1], utc[chunk + order[group_start[g + 1]]]);
+
+            utz_usize     from = group_start[g];
+            utz_usize     to   = group_start[g + 1];
+            utz_timezone* tz   = group_zone[g];
+
+            // Small groups aren't worth the copies, the sortedness check and kernel setup.
+            if (to - from < 16)
+            {
+                for (utz_usize k = from; k < to; k++)
+                    out_wall_time[chunk + order[k]] = utz_wall_time_from_utc_compiled(tz, utc[chunk + order[k]]);
+                continue;
+            }
+
+            for (utz_usize k = from; k < to; k++) scratch_in[k] = utc[chunk + order[k]];
+            utz_wall_time_from_utc_batch(tz, scratch_in + from, scratch_out + from, to - from);
+            for (utz_usize k = from; k < to; k++) out_wall_time[chunk + order[k]] = scratch_out[k];
+        }
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// TZif
+
+// RFC 8536. All numbers are big endian. Version 2+ files repeat the data with 64 bit times after the
+// version 1 block, and end with a POSIX TZ string for the times after the last transition.
+#define UTZ_TZIF_HEADER_SIZE 44
+#define UTZ_TZIF_MAX_TYPES   250   // range_abbreviation_index is a byte, the TZ string can add two more
+
+typedef struct utz_tzif_header
+{
+    utz_u8  version;    // 0 for version 1, '2', '3', ... after that
+    utz_u64 isutcnt;
+    utz_u64 isstdcnt;
+    utz_u64 leapcnt;
+    utz_u64 timecnt;
+    utz_u64 typecnt;
+    utz_u64 charcnt;
+} utz_tzif_header;
+
+static utz_u32 utz_tzif_u32(const utz_u8* p)
+{
+    return ((utz_u32)p[0] << 24) | ((utz_u32)p[1] << 16) | ((utz_u32)p[2] << 8) | (utz_u32)p[3];
+}
+
+static utz_time_t utz_tzif_time(const utz_u8* p, utz_usize time_size)
+{
+    if (time_size == 4) return (utz_time_t)(utz_s32) utz_tzif_u32(p);
+    return (utz_time_t)(((utz_u64) utz_tzif_u32(p) << 32) | utz_tzif_u32(p + 4));
+}
+
+// Returns the size of the data block that follows the header, 0 if the header is broken.
+static utz_u64 utz_read_tzif_header(const utz_u8* data, utz_usize size, utz_usize time_size, utz_tzif_header* header)
+{
+    if (size < UTZ_TZIF_HEADER_SIZE || data[0] != 'T' || data[1] != 'Z' || data[2] != 'i' || data[3] != 'f') return 0;
+
+    header->version  = data[4];
+    header->isutcnt  = utz_tzif_u32(data + 20);
+    header->isstdcnt = utz_tzif_u32(data + 24);
+    header->leapcnt  = utz_tzif_u32(data + 28);
+    header->timecnt  = utz_tzif_u32(data + 32);
+    header->typecnt  = utz_tzif_u32(data + 36);
+    header->charcnt  = utz_tzif_u32(data + 40);
+
+    return header->timecnt * time_size + header->timecnt + header->typecnt * 6 + header->charcnt +
+           header->leapcnt * (time_size + 4) + header->isstdcnt + header->isutcnt;
+}
+
+// Footer of a TZif file: "std offset [dst [offset],start[/time],end[/time]]", like "CET-1CEST,M3.5.0,M10.5.0/3".
+typedef struct utz_posix_tz
+{
+    utz_time_range  std;        // since is unused
+    utz_time_range  dst;
+    utz_tail_change changes[2]; // dst starts, dst ends, abbreviation_index is unset
+    utz_bool        has_dst;
+} utz_posix_tz;
+
+static utz_bool utz_posix_tz_number(utz_string* s, utz_u32 min, utz_u32 max, utz_u32* out)
+{
+    if (!utz_starts_with_digit(*s)) return UTZ_FALSE;
+
+    utz_u32 value = 0;
+    while (utz_starts_with_digit(*s) && value <= max)
+    {
+        value = value * 10 + (utz_u32)(s->data[0] - '0');
+        utz_consume(s, 1);
+    }
+
+    *out = value;
+    return (min <= value && value <= max);
+}
+
+static utz_bool utz_posix_tz_consume(utz_string* s, char c)
+{
+    if (!s->length || s->data[0] != c) return UTZ_FALSE;
+    utz_consume(s, 1);
+    return UTZ_TRUE;
+}
+
+// "EST" or "<-03>".
+static utz_bool utz_posix_tz_name(utz_string* s, char (*name)[5 + 1])
+{
+    utz_bool  quoted = utz_posix_tz_consume(s, '<');
+    utz_usize length = 0;
+
+    while (s->length)
+    {
+        char c = s->data[0];
+        if (quoted ? (c == '>') : !(UtzIsAlpha(c) && c != '_')) break;
+        if (!UtzIsAlphaNumeric(c) && c != '+' && c != '-') return UTZ_FALSE;
+        if (length == UtzArrayCount(*name) - 1)            return UTZ_FALSE;
+
+        (*name)[length++] = c;
+        utz_consume(s, 1);
+    }
+    (*name)[length] = '\0';
+
+    if (quoted && !utz_posix_tz_consume(s, '>')) return UTZ_FALSE;
+    return length > 0;
+}
+
+// "[+-]hh[:mm[:ss]]" in seconds.
+static utz_bool utz_posix_tz_time(utz_string* s, utz_u32 max_hours, utz_s32* out)
+{
+    utz_s32 sign = 1;
+    if (s->length && (s->data[0] == '+' || s->data[0] == '-'))
+    {
+        if (s->data[0] == '-') sign = -1;
+        utz_consume(s, 1);
+    }
+
+    utz_u32 hours = 0, minutes = 0, seconds = 0;
+    if (!utz_posix_tz_number(s, 0, max_hours, &hours)) return UTZ_FALSE;
+    if (utz_posix_tz_consume(s, ':'))
+    {
+        if (!utz_posix_tz_number(s, 0, 59, &minutes)) return UTZ_FALSE;
+        if (utz_posix_tz_consume(s, ':') && !utz_posix_tz_number(s, 0, 59, &seconds)) return UTZ_FALSE;
+    }
+
+    *out = sign * (utz_s32)(hours * 60 * 60 + minutes * 60 + seconds);
+    return UTZ_TRUE;
+}
+
+// "Mm.w.d", "Jn" or "n", then "[/time]". Sets the date of change and the local time of day it happens at.
+static utz_bool utz_posix_tz_rule(utz_string* s, utz_tail_change* change, utz_s32* local_time)
+{
+    static const utz_u8 days_in_month[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    utz_u32 month = 0, week = 0, weekday = 0, day = 0;
+    if (utz_posix_tz_consume(s, 'M'))
+    {
+        if (!utz_posix_tz_number(s, 1, 12, &month)   || !utz_posix_tz_consume(s, '.') ||
+            !utz_posix_tz_number(s, 1, 5,  &week)    || !utz_posix_tz_consume(s, '.') ||
+            !utz_posix_tz_number(s, 0, 6,  &weekday))
+            return UTZ_FALSE;
+
+        // Week 5 is the last one, which is "lastSun" in the source files.
+        change->month    = (utz_u8) month;
+        change->day_kind = (utz_u8)((week == 5) ? DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE : DAY_RULE_WEEKDAY_AFTER_OR_ON_DATE);
+        change->day      = (utz_u8)((week == 5) ? 31 : 1 + 7 * (week - 1));
+        change->weekday  = (utz_u8) weekday;
+    }
+    else
+    {
+        // Jn counts 1 - 365 and never February 29. n counts 0 - 365 with it, so only days before it are fixed dates.
+        utz_bool julian = utz_posix_tz_consume(s, 'J');
+        if (!utz_posix_tz_number(s, julian ? 1 : 0, 365, &day)) return UTZ_FALSE;
+        if (!julian)
+        {
+            if (day >= 31 + 28) return UTZ_FALSE;
+            day++;
+        }
+
+        month = 1;
+        while (day > days_in_month[month - 1])
+            day -= days_in_month[month++ - 1];
+
+        change->month    = (utz_u8) month;
+        change->day_kind = DAY_RULE_EQUAL_TO_DATE;
+        change->day      = (utz_u8) day;
+    }
+
+    // RFC 8536 allows -167 to 167 hours here, POSIX only 0 to 24.
+    *local_time = 2 * 60 * 60;
+    if (utz_posix_tz_consume(s, '/') && !utz_posix_tz_time(s, 167, local_time)) return UTZ_FALSE;
+    return UTZ_TRUE;
+}
+
+static utz_bool utz_parse_posix_tz(utz_string s, utz_posix_tz* tz)
+{
+    *tz = UtzInit;
+
+    // POSIX offsets are west of Greenwich.
+    utz_s32 west = 0;
+    if (!utz_posix_tz_name(&s, &tz->std.zone_abbreviation) || !utz_posix_tz_time(&s, 24, &west)) return UTZ_FALSE;
+    tz->std.offset_seconds = -west;
+    if (!s.length) return UTZ_TRUE;
+
+    if (!utz_posix_tz_name(&s, &tz->dst.zone_abbreviation)) return UTZ_FALSE;
+    tz->dst.offset_seconds = tz->std.offset_seconds + 60 * 60;
+    if (s.length && s.data[0] != ',')
+    {
+        if (!utz_posix_tz_time(&s, 24, &west)) return UTZ_FALSE;
+        tz->dst.offset_seconds = -west;
+    }
+
+    // zic always writes the rules, without them POSIX leaves the dates up to the implementation.
+    utz_s32 start = 0, end = 0;
+    if (!utz_posix_tz_consume(&s, ',') || !utz_posix_tz_rule(&s, &tz->changes[0], &start) ||
+        !utz_posix_tz_consume(&s, ',') || !utz_posix_tz_rule(&s, &tz->changes[1], &end)   || s.length)
+        return UTZ_FALSE;
+
+    // Rule times are read on the clock that is about to change.
+    tz->changes[0].at_seconds     = start - tz->std.offset_seconds;
+    tz->changes[0].offset_seconds = tz->dst.offset_seconds;
+    tz->changes[1].at_seconds     = end   - tz->dst.offset_seconds;
+    tz->changes[1].offset_seconds = tz->std.offset_seconds;
+    tz->has_dst = UTZ_TRUE;
+    return UTZ_TRUE;
+}
+
+// Appends range unless it changes nothing, the same way the parser merges ranges. Returns whether it was appended.
+static utz_bool utz_append_tzif_range(utz_time_range** ranges, const utz_time_range* range, void* allocator_userdata)
+{
+    utz_time_range* last = UtzDynGetLast(*ranges);
+    if (last && last->offset_seconds == range->offset_seconds && utz_equals(UtzStr(last->zone_abbreviation), UtzStr(range->zone_abbreviation)))
+        return UTZ_FALSE;
+
+    UtzDynAppend(utz_time_range, ranges, range);
+    return UTZ_TRUE;
+}
+
+// Fills tz (all but the name) from one TZif file. Returns NULL, or what's wrong with the file.
+static const char* utz_build_tzif_timezone(utz_timezone* tz, const utz_u8* data, utz_usize size, void* allocator_userdata, unsigned flags)
+{
+    utz_tzif_header header    = UtzInit;
+    utz_usize       time_size = 4;
+    utz_u64         block     = utz_read_tzif_header(data, size, time_size, &header);
+    if (!block) return "Not a TZif file.";
+
+    // Skip the 32 bit data of version 2+ files.
+    if (header.version >= '2')
+    {
+        if (block > size - UTZ_TZIF_HEADER_SIZE) return "TZif is cut short.";
+        data += UTZ_TZIF_HEADER_SIZE + block;
+        size -= UTZ_TZIF_HEADER_SIZE + block;
+
+        time_size = 8;
+        block     = utz_read_tzif_header(data, size, time_size, &header);
+        if (!block) return "TZif is missing its 64 bit header.";
+    }
+    if (block > size - UTZ_TZIF_HEADER_SIZE)                    return "TZif is cut short.";
+    if (header.leapcnt)                                         return "TZif files with leap seconds (like the ones in right/) aren't supported.";
+    if (!header.typecnt || header.typecnt > UTZ_TZIF_MAX_TYPES) return "TZif has no or too many local time types.";
+    if (!header.charcnt)                                        return "TZif has no abbreviations.";
+
+    const utz_u8* times   = data + UTZ_TZIF_HEADER_SIZE;
+    const utz_u8* indices = times   + header.timecnt * time_size;
+    const utz_u8* types   = indices + header.timecnt;
+    const char*   chars   = (const char*)(types + header.typecnt * 6);
+
+    // Local time types: offset, is dst, abbreviation index.
+    utz_time_range type_ranges[UTZ_TZIF_MAX_TYPES];
+    for (utz_usize i = 0; i < header.typecnt; i++)
+    {
+        const utz_u8* type  = types + i * 6;
+        utz_u32       abbr  = type[5];
+        utz_usize     chars_left = (utz_usize) header.charcnt - abbr;
+        if (abbr >= header.charcnt)                      return "TZif abbreviation index out of bounds.";
+        if ((utz_s32) utz_tzif_u32(type) == UtzMinValue(utz_s32)) return "TZif has an invalid offset.";
+
+        utz_time_range* range = &type_ranges[i];
+        *range = UtzInit;
+        range->offset_seconds = (utz_s32) utz_tzif_u32(type);
+
+        utz_usize length = 0;
+        while (length < chars_left && chars[abbr + length]) length++;
+        if (length == chars_left)                                   return "TZif abbreviation isn't terminated.";
+        if (length + 1 > UtzArrayCount(range->zone_abbreviation))   return "TZif abbreviation is longer than 5 characters.";
+        for (utz_usize c = 0; c < length; c++)
+            range->zone_abbreviation[c] = chars[abbr + c];
+    }
+
+    // The footer is "\n<POSIX TZ string>\n", the string can be empty.
+    utz_posix_tz posix = UtzInit;
+    utz_bool     has_posix = UTZ_FALSE;
+    if (time_size == 8)
+    {
+        const char* footer      = (const char*)(data + UTZ_TZIF_HEADER_SIZE + block);
+        utz_usize   footer_size = size - UTZ_TZIF_HEADER_SIZE - (utz_usize) block;
+        if (footer_size < 2 || footer[0] != '\n') return "TZif is missing its footer.";
+
+        utz_string tz_string = { 0, (char*)footer + 1 };
+        while (tz_string.length < footer_size - 1 && footer[1 + tz_string.length] != '\n')
+            tz_string.length++;
+        if (tz_string.length == footer_size - 1) return "TZif footer isn't terminated.";
+
+        has_posix = (tz_string.length > 0);
+        if (has_posix && !utz_parse_posix_tz(tz_string, &posix)) return "Can't read the POSIX TZ string in the TZif footer.";
+    }
+
+    // When both halves of the year are the same the zone doesn't really change clocks.
+    if (posix.has_dst && posix.std.offset_seconds == posix.dst.offset_seconds &&
+        utz_equals(UtzStr(posix.std.zone_abbreviation), UtzStr(posix.dst.zone_abbreviation)))
+        posix.has_dst = UTZ_FALSE;
+
+    // Type 0 is in effect before the first transition.
+    utz_time_range* ranges = NULL;
+    UtzMakeDynArray(utz_time_range, &ranges, (utz_usize) header.timecnt + 4);
+
+    utz_time_range first = type_ranges[0];
+    first.since = UTZ_BEGINNING_OF_TIME;
+    UtzDynAppend(utz_time_range, &ranges, &first);
+
+    utz_time_t previous = UTZ_BEGINNING_OF_TIME;
+    for (utz_usize i = 0; i < header.timecnt; i++)
+    {
+        utz_time_t since = utz_tzif_time(times + i * time_size, time_size);
+        if (indices[i] >= header.typecnt || since <= previous)
+        {
+            UtzFreeDynArray(&ranges);
+            return (indices[i] >= header.typecnt) ? "TZif transition has an invalid type." : "TZif transitions aren't sorted.";
+        }
+        previous = since;
+
+        utz_time_range range = type_ranges[indices[i]];
+        range.since = since;
+        utz_append_tzif_range(&ranges, &range, allocator_userdata);
+    }
+
+    // The TZ string covers everything after the last transition. Expand it until the last range is the later
+    // change of a year, which is what the tail starts from (see utz_find_tail_range), and keep the changes in that order.
+    utz_time_range tail_ranges[2] = {};
+    if (posix.has_dst)
+    {
+        utz_time_t last_since = UtzDynGetLast(ranges)->since;
+        utz_time_t last_day   = (last_since == UTZ_BEGINNING_OF_TIME) ? 0 : last_since / (24 * 60 * 60) - (last_since % (24 * 60 * 60) < 0);
+        utz_time_t year       = utz_year_from_days(last_day);
+
+        utz_usize end = (utz_tail_change_time(&posix.changes[1], year) < utz_tail_change_time(&posix.changes[0], year)) ? 0 : 1;
+        tz->tail_changes[1 - end] = posix.changes[0];
+        tz->tail_changes[end]     = posix.changes[1];
+        tail_ranges     [1 - end] = posix.dst;
+        tail_ranges     [end]     = posix.std;
+        tz->tail_change_count     = 2;
+
+        utz_bool done = UTZ_FALSE;
+        for (utz_time_t y = year - 1; y <= year + 2 && !done; y++)
+        {
+            for (utz_usize k = 0; k < 2 && !done; k++)
+            {
+                utz_time_range range = tail_ranges[k];
+                range.since = utz_tail_change_time(&tz->tail_changes[k], y);
+                if (range.since <= UtzDynGetLast(ranges)->since) continue;
+                done = utz_append_tzif_range(&ranges, &range, allocator_userdata) && k == 1;
+            }
+        }
+        if (!done)
+        {
+            UtzFreeDynArray(&ranges);
+            return "The POSIX TZ string in the TZif footer doesn't change clocks.";
+        }
+    }
+
+    tz->ranges      = ranges;
+    tz->range_count = UtzDynCount(ranges);
+    utz_build_range_arrays(tz, allocator_userdata);
+    utz_classify_timezone (tz);
+
+    for (utz_usize i = 0; i < tz->tail_change_count; i++)
+        for (utz_usize j = 0; j < tz->abbreviation_count; j++)
+            if (utz_equals(UtzStr(tz->abbreviations[j]), UtzStr(tail_ranges[i].zone_abbreviation)))
+                tz->tail_changes[i].abbreviation_index = (utz_u8) j;
+    if (flags & UTZ_PARSE_SEARCH_INDEX)
+        utz_build_search_index(tz, allocator_userdata);
+    if (flags & UTZ_PARSE_BUCKET_INDEX)
+        utz_build_bucket_index(tz, allocator_userdata);
+    return NULL;
+}
+
+// Replaces whatever is in tzs with an error about the TZif file called name.
+static int utz_tzif_error(utz_timezones* tzs, const char* name, const char* message, void* allocator_userdata)
+{
+    utz_free_timezones(tzs, allocator_userdata);
+    *tzs = UtzInit;
+
+#ifndef UTZ_NO_SPRINTF
+    char* buf = UtzAllocate(allocator_userdata, char, 2048);
+    UtzSprintf(buf, 2048, "Error: %s\nTZif: %s\n", message, name ? name : "N/A");
+    tzs->parsing_error = buf;
+#else
+    tzs->parsing_error = message;
+#endif
+    return UTZ_FALSE;
+}
+
+int utz_load_tzif(utz_timezones* tzs, const utz_tzif_file* files, utz_usize file_count, void* allocator_userdata, unsigned flags)
+{
+    *tzs = UtzInit;
+    UtzMakeDynArray(utz_timezone, &tzs->timezones, file_count ? file_count : 1);
+
+    for (utz_usize i = 0; i < file_count; i++)
     {
-        utz_string line = current_line;
-
-        if (!utz_peek(line, UTZ_TOKEN_WORD)) ReportStaticError("Expected country.code");
-        utz_string code = utz_next(&line);
+        const utz_tzif_file* file = &files[i];
+        utz_timezone         tz   = UtzInit;
+
+        utz_usize length = 0;
+        while (file->name && file->name[length]) length++;
+        if (!length || length + 1 > UtzArrayCount(tz.name))
+            return utz_tzif_error(tzs, file->name, "Timezone name is empty or longer than 32 characters.", allocator_userdata);
+        for (utz_usize c = 0; c < length; c++)
+            tz.name[c] = file->name[c];
+
+        const char* error = utz_build_tzif_timezone(&tz, (const utz_u8*) file->data, file->size, allocator_userdata, flags);
+        if (error) return utz_tzif_error(tzs, file->name, error, allocator_userdata);
+        UtzDynAppend(utz_timezone, &tzs->timezones, &tz);
+    }
 
-        utz_string name = next_space_separated_string(&line);
-        if (!name.length)        ReportStaticError("Expected country.name");
-        if (utz_next(&line).length)  ReportStaticError("Expected end of line but got garbage.");
+    utz_radix_sort(tzs->timezones, UtzDynCount(tzs->timezones), sizeof(utz_timezone),
+                   UtzOffsetOf(utz_timezone, name), sizeof(tzs->timezones[0].name), UTZ_TRUE);
+    tzs->timezone_count = UtzDynCount(tzs->timezones);
 
-        utz_country country = UtzInit;
-        CopyToCharArray(name, country.name, "parsing country name");
-        CopyToCharArray(code, country.code, "parsing country code");
-        UtzDynAppend(utz_country, &tzs->countries, &country);
+    for (utz_usize i = 1; i < tzs->timezone_count; i++)
+        if (utz_equals(UtzStr(tzs->timezones[i - 1].name), UtzStr(tzs->timezones[i].name)))
+            return utz_tzif_error(tzs, tzs->timezones[i].name, "Timezone is there twice.", allocator_userdata);
 
-        // @Temporary
-        // // Insert an alias if one references this country.
-        // for (utz_usize i = 0; i < UtzArrayCount(the_country_aliases); i++)
-        // {
-        //     if (!utz_equals(the_country_aliases[i].main_country_code, code)) continue;
-        //     utz_country alias = UtzInit;
-        //     CopyToCharArray(the_country_aliases[i].alias_country_name, alias.name, "parsing alias country name");
-        //     CopyToCharArray(the_country_aliases[i].alias_country_code, alias.code, "parsing alias country code");
-        //     UtzDynAppend(utz_country, &tzs->countries, &alias);
-        // }
-    }
+    utz_build_name_hash(tzs, allocator_userdata);
+    return UTZ_TRUE;
+}
 
-    tzs->country_count = UtzDynCount(tzs->countries);
-    SortByCharArray(utz_country, code, tzs->countries);
 
-    //
-    // Parse country to timezone relations.
-    //
+// Appends to a POSIX TZ string, false once it doesn't fit.
+typedef struct utz_posix_tz_builder
+{
+    char      data[128];
+    utz_usize length;
+    utz_bool  needs_v3;     // rule times outside of 0 - 24 hours are an RFC 8536 version 3 extension
+} utz_posix_tz_builder;
 
-    MustFindFile(UtzStr("zone1970.tab"));
+static utz_bool utz_posix_tz_put(utz_posix_tz_builder* b, const char* str)
+{
+    for (; *str; str++)
+    {
+        if (b->length + 1 >= UtzArrayCount(b->data)) return UTZ_FALSE;
+        b->data[b->length++] = *str;
+    }
+    b->data[b->length] = '\0';
+    return UTZ_TRUE;
+}
 
-    utz_string country_to_timezone = current_file;
-    while (utz_maybe_next_line(&country_to_timezone, &current_line))
+static utz_bool utz_posix_tz_put_number(utz_posix_tz_builder* b, utz_u32 value, utz_u32 min_digits = 1)
+{
+    char      digits[16];
+    utz_usize count = 0;
+    do
     {
-        utz_string line = current_line;
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value || count < min_digits);
+
+    char str[16];
+    for (utz_usize i = 0; i < count; i++) str[i] = digits[count - 1 - i];
+    str[count] = '\0';
+    return utz_posix_tz_put(b, str);
+}
 
-        utz_string comma_separated_codes = utz_next(&line);
-        if (!comma_separated_codes.length) ReportStaticError("Expected a comma separated list of country codes.");
+// Plain if it's only letters, like "CET", "<-03>" otherwise.
+static utz_bool utz_posix_tz_put_name(utz_posix_tz_builder* b, const char* name)
+{
+    utz_usize length = 0;
+    utz_bool  plain  = UTZ_TRUE;
+    for (; name[length]; length++)
+        plain = plain && UtzIsAlpha(name[length]) && name[length] != '_';
+    plain = plain && length >= 3;
 
-        utz_string latlong = utz_next(&line);
-        if (!latlong.length) ReportStaticError("Expected latitude/longitude after country code.");
+    return (plain || utz_posix_tz_put(b, "<")) && utz_posix_tz_put(b, name) && (plain || utz_posix_tz_put(b, ">"));
+}
 
-        utz_string zone_name = utz_next(&line);
-        if (!zone_name.length) ReportStaticError("Expected timezone name after latitude/longitude.");
+// "[-]h[:mm[:ss]]"
+static utz_bool utz_posix_tz_put_time(utz_posix_tz_builder* b, utz_s32 seconds)
+{
+    if (seconds < 0 && !utz_posix_tz_put(b, "-")) return UTZ_FALSE;
+    utz_u32 value = (utz_u32)(seconds < 0 ? -seconds : seconds);
 
-        utz_timezone* zone = FindByCharArray(utz_timezone, name, tzs->timezones, zone_name);
-        if (!zone) ReportError("Can't find timezone '%.*s'", UtzStringArgs(zone_name));
+    if (!utz_posix_tz_put_number(b, value / 3600)) return UTZ_FALSE;
+    if (value % 3600 && (!utz_posix_tz_put(b, ":") || !utz_posix_tz_put_number(b, value / 60 % 60, 2))) return UTZ_FALSE;
+    if (value % 60   && (!utz_posix_tz_put(b, ":") || !utz_posix_tz_put_number(b, value % 60, 2)))      return UTZ_FALSE;
+    return UTZ_TRUE;
+}
 
-        if (!utz_parse_latitude_and_longitude(latlong, &zone->coordinate_latitude_seconds, &zone->coordinate_longitude_seconds))
-            ReportStaticError("Bad latitude/longitude.");
+// ",Mm.w.d[/time]" or ",Jn[/time]". offset_before is the offset of the clock that the rule's local time is read on.
+// Day rules that POSIX can't express fail: weekdays after the 28th, or Sun<=x that reaches into the previous month.
+static utz_bool utz_posix_tz_put_rule(utz_posix_tz_builder* b, const utz_tail_change* change, utz_s32 offset_before)
+{
+    static const utz_u8 days_in_month[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    static const utz_u16 days_before_month[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
 
-        while (UTZ_TRUE)
+    if (change->month < 1 || change->month > 12 || !utz_posix_tz_put(b, ",")) return UTZ_FALSE;
+
+    utz_s32 local = change->at_seconds + offset_before;
+    if (change->day_kind == DAY_RULE_EQUAL_TO_DATE)
+    {
+        // Jn never counts February 29.
+        if (change->month == 2 && change->day == 29) return UTZ_FALSE;
+        if (!utz_posix_tz_put(b, "J") || !utz_posix_tz_put_number(b, days_before_month[change->month - 1] + change->day)) return UTZ_FALSE;
+    }
+    else
+    {
+        utz_u32 day     = change->day;
+        utz_u32 weekday = change->weekday;
+        utz_u32 week    = 5;
+
+        // Sun<=x is the last Sunday of the month when x is at least the length of the month, Sun>=(x - 6) otherwise.
+        utz_bool last = (change->day_kind == DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE && day >= days_in_month[change->month - 1]);
+        if (!last)
         {
-            utz_string code = { 0, comma_separated_codes.data };
-            while (comma_separated_codes.length && comma_separated_codes.data[0] != ',')
+            if (change->day_kind == DAY_RULE_WEEKDAY_BEFORE_OR_ON_DATE)
             {
-                utz_consume(&comma_separated_codes, 1);
-                code.length++;
+                if (day < 7) return UTZ_FALSE;
+                day -= 6;
             }
-            if (comma_separated_codes.length) utz_consume(&comma_separated_codes, 1);
-
-            if (!code.length) break;
 
-            utz_country* country = FindByCharArray(utz_country, code, tzs->countries, code);
-            if (!country) ReportError("Can't find country with code '%.*s", UtzStringArgs(code));
+            // Weeks start on the 1st, 8th, 15th and 22nd. Sat>=9 is the Friday on or after the 8th, one day later.
+            utz_u32 shift = (day - 1) % 7;
+            week = (day - 1) / 7 + 1;
+            if (week > 4) return UTZ_FALSE;
 
-            if (!country->timezones)
-                UtzMakeDynArray(utz_timezone*, &country->timezones, 1);
-            UtzDynAppend(utz_timezone*, &country->timezones, &zone);
+            weekday = (weekday + 7 - shift) % 7;
+            local  += (utz_s32) shift * 24 * 60 * 60;
         }
 
-        // rest of `line` is comments
+        if (!utz_posix_tz_put(b, "M")                || !utz_posix_tz_put_number(b, change->month) ||
+            !utz_posix_tz_put(b, ".")                || !utz_posix_tz_put_number(b, week)          ||
+            !utz_posix_tz_put(b, ".")                || !utz_posix_tz_put_number(b, weekday))
+            return UTZ_FALSE;
     }
 
-    current_line = UtzStr("--- EOF (file already processed) ---");
+    if (local < -167 * 60 * 60 || local > 167 * 60 * 60) return UTZ_FALSE;
+    if (local < 0 || local > 24 * 60 * 60) b->needs_v3 = UTZ_TRUE;
+    return local == 2 * 60 * 60 || (utz_posix_tz_put(b, "/") && utz_posix_tz_put_time(b, local));
+}
 
-    for (utz_usize country_idx = 0; country_idx < UtzDynCount(tzs->countries); country_idx++)
+// The footer for the times after the last range.
+static utz_bool utz_build_posix_tz(utz_posix_tz_builder* b, const utz_timezone* tz)
+{
+    *b = UtzInit;
+    if (!tz->tail_change_count)
     {
-        utz_country* country = &tzs->countries[country_idx];
+        utz_usize last = tz->range_count - 1;
+        return utz_posix_tz_put_name(b, tz->abbreviations[tz->range_abbreviation_index[last]]) &&
+               utz_posix_tz_put_time(b, -tz->range_offset_seconds[last]);
+    }
 
-        // We know that these countries don't have any timezone data, and we don't care.
-        if (!country->timezones && (!utz_equals(UtzStr("BV"), country->code) && !utz_equals(UtzStr("HM"), country->code)))
-            ReportError("No timezones for country '%s' (%s).", country->name, country->code);
+    // The change to the smaller offset starts standard time. dst_start is the other one.
+    const utz_tail_change* changes   = tz->tail_changes;
+    utz_usize              std_start = (changes[1].offset_seconds < changes[0].offset_seconds) ? 1 : 0;
+    utz_usize              dst_start = 1 - std_start;
+    utz_s32                std       = changes[std_start].offset_seconds;
+    utz_s32                dst       = changes[dst_start].offset_seconds;
+
+    return utz_posix_tz_put_name(b, tz->abbreviations[changes[std_start].abbreviation_index]) &&
+           utz_posix_tz_put_time(b, -std) &&
+           utz_posix_tz_put_name(b, tz->abbreviations[changes[dst_start].abbreviation_index]) &&
+           (dst == std + 60 * 60 || utz_posix_tz_put_time(b, -dst)) &&
+           utz_posix_tz_put_rule(b, &changes[dst_start], std) &&
+           utz_posix_tz_put_rule(b, &changes[std_start], dst);
+}
 
-#if 0
-        // Resolve default timezone overrides. There should only be one override per country. I don't care to check this.
-        for (utz_usize i = 0; i < ArrayCount(the_default_timezone_overrides); i++)
-        {
-            Default_Timezone_Override* override = &the_default_timezone_overrides[i];
-            if (override->country_code != country->code) continue;
+// utz doesn't keep which ranges are daylight saving time. A range is, if its offset is above the ones around it,
+// and in zones with a tail the change to the larger offset is.
+static utz_bool utz_tzif_range_is_dst(const utz_timezone* tz, utz_usize i)
+{
+    utz_s32 offset = tz->range_offset_seconds[i];
+    utz_s32 before = (i > 0) ? tz->range_offset_seconds[i - 1] : offset;
+    utz_s32 after  = offset;
+    if (i + 1 < tz->range_count)   after = tz->range_offset_seconds[i + 1];
+    else if (tz->tail_change_count) after = tz->tail_changes[0].offset_seconds;
+    return offset > before && offset > after;
+}
 
-            // Find the default timezone and insert it at index 0.
-            utz_bool found = UTZ_FALSE;
-            utz_timezone* previous = country->timezones.count ? country->timezones[0] : NULL;
-            for (utz_usize j = 1; j < country->timezones.count; j++)
-            {
-                if (previous->name == override->default_timezone_name)
-                {
-                    country->timezones[0] = previous;
-                    found = UTZ_TRUE;
-                    break;
-                }
-                else
-                {
-                    utz_timezone* temp = country->timezones[j];
-                    country->timezones[j] = previous;
-                    previous = temp;
-                }
-            }
-            if (previous->name == override->default_timezone_name)
-            {
-                country->timezones[0] = previous;
-                found = UTZ_TRUE;
-            }
+static void utz_tzif_put_u32(utz_snapshot_writer* writer, utz_u32 value)
+{
+    utz_u8 bytes[4] = { (utz_u8)(value >> 24), (utz_u8)(value >> 16), (utz_u8)(value >> 8), (utz_u8) value };
+    utz_snapshot_put(writer, bytes, 4, 1);
+}
 
-            if (!found)
-            {
-                utz_string_t_Concatenator cat = {};
-                FormatAdd(&cat, "Specified a default timezone override '%' for country '% (%)', but the country doesn't have this timezone. "
-                                "It has these timezones:",
-                                override->default_timezone_name, country->name, country->code);
+typedef struct utz_tzif_types
+{
+    utz_s32   offset      [256];
+    utz_u8    dst         [256];
+    utz_u8    abbreviation[256];    // index into utz_timezone.abbreviations
+    utz_usize count;
+} utz_tzif_types;
+
+// Index of the local time type of range i, adds it if it's new. Returns 256 if there are too many.
+static utz_usize utz_tzif_type_of(utz_tzif_types* types, const utz_timezone* tz, utz_usize i)
+{
+    utz_s32 offset = tz->range_offset_seconds[i];
+    utz_u8  dst    = (utz_u8) utz_tzif_range_is_dst(tz, i);
+    utz_u8  abbr   = tz->range_abbreviation_index[i];
 
-                For (country->timezones)
-                {
-                    add(&cat, "\n");
-                    add(&cat, (*it)->name);
-                }
+    utz_usize t = 0;
+    while (t < types->count && !(types->offset[t] == offset && types->dst[t] == dst && types->abbreviation[t] == abbr)) t++;
+    if (t == types->count && t < UtzArrayCount(types->offset))
+    {
+        types->offset      [t] = offset;
+        types->dst         [t] = dst;
+        types->abbreviation[t] = abbr;
+        types->count++;
+    }
+    return t;
+}
 
-                return report_error(resolve_to_string_and_free(&cat, temp));
-            }
-        }
-#endif
+static utz_bool utz_write_tzif_to(const utz_timezone* tz, utz_snapshot_writer* writer)
+{
+    if (!tz->range_count) return UTZ_FALSE;
 
-        // @Temporary
-        // // Resolve country aliases. These countries have already been inserted.
-        // for (utz_usize ai = 0; ai < UtzArrayCount(the_country_aliases); ai++)
-        // {
-        //     if (!utz_equals(the_country_aliases[ai].main_country_code, country->code)) continue;
-        //     for (utz_usize ci = 0; ci < UtzDynCount(tzs->countries); ci++)
-        //         if (utz_equals(the_country_aliases[ai].alias_country_code, tzs->countries[ci].code))
-        //         {
-        //             tzs->countries[ci].timezones = country->timezones;
-        //             break;
-        //         }
-        // }
+    utz_posix_tz_builder footer;
+    if (!utz_build_posix_tz(&footer, tz)) return UTZ_FALSE;
+
+    // Local time types in the order ranges first use them, so type 0 is the one before the first transition.
+    utz_tzif_types types;
+    types.count = 0;
+    for (utz_usize i = 0; i < tz->range_count; i++)
+        if (utz_tzif_type_of(&types, tz, i) == UtzArrayCount(types.offset)) return UTZ_FALSE;
+
+    // Abbreviations are written once each, desigidx points into them.
+    utz_u32 abbreviation_at[256];
+    utz_u32 char_count = 0;
+    for (utz_usize a = 0; a < tz->abbreviation_count; a++)
+    {
+        abbreviation_at[a] = char_count;
+        utz_u32 length = 0;
+        while (tz->abbreviations[a][length]) length++;
+        char_count += length + 1;
     }
+    if (char_count > 256) return UTZ_FALSE; // desigidx is a byte
+
+    // The version 1 block only has the transitions that fit 32 bits, the version 2 one all of them.
+    // ranges[0] starts at the beginning of time, it's what type 0 means and isn't a transition.
+    for (utz_usize time_size = 4; time_size <= 8; time_size += 4)
+    {
+        utz_usize first = 1, end = tz->range_count;
+        if (time_size == 4)
+        {
+            while (first < end && tz->range_since[first]   < UtzMinValue(utz_s32)) first++;
+            while (end > first && tz->range_since[end - 1] > UtzMaxValue(utz_s32)) end--;
+        }
+
+        utz_u8 header[20] = { 'T', 'Z', 'i', 'f', (utz_u8)(footer.needs_v3 ? '3' : '2') };
+        utz_snapshot_put(writer, header, sizeof(header), 1);
+        utz_tzif_put_u32(writer, 0);                    // isutcnt
+        utz_tzif_put_u32(writer, 0);                    // isstdcnt
+        utz_tzif_put_u32(writer, 0);                    // leapcnt
+        utz_tzif_put_u32(writer, (utz_u32)(end - first));
+        utz_tzif_put_u32(writer, (utz_u32) types.count);
+        utz_tzif_put_u32(writer, char_count);
+
+        for (utz_usize i = first; i < end; i++)
+        {
+            if (time_size == 8) utz_tzif_put_u32(writer, (utz_u32)((utz_u64) tz->range_since[i] >> 32));
+            utz_tzif_put_u32(writer, (utz_u32)(utz_u64) tz->range_since[i]);
+        }
+        for (utz_usize i = first; i < end; i++)
+        {
+            utz_u8 type = (utz_u8) utz_tzif_type_of(&types, tz, i);
+            utz_snapshot_put(writer, &type, 1, 1);
+        }
+
+        for (utz_usize t = 0; t < types.count; t++)
+        {
+            utz_u8 rest[2] = { types.dst[t], (utz_u8) abbreviation_at[types.abbreviation[t]] };
+            utz_tzif_put_u32(writer, (utz_u32) types.offset[t]);
+            utz_snapshot_put(writer, rest, 2, 1);
+        }
 
+        for (utz_usize a = 0; a < tz->abbreviation_count; a++)
+        {
+            utz_u32 length = 0;
+            while (tz->abbreviations[a][length]) length++;
+            utz_snapshot_put(writer, tz->abbreviations[a], length + 1, 1);
+        }
     }
-cleanup:;
-    UtzFreeDynArray(&last_parsed_links);
-    FreeNestedDynArray(&last_rule_bundles, rules);
-    FreeNestedDynArray(&last_zone_bundles, zones);
-    return (tzs->parsing_error == NULL);
 
-#undef CopyToCharArray
-#undef UtzOffsetOf
-#undef FreeNestedDynArray
-#undef SortByCharArray
-#undef FindByCharArray
-#undef ReportError
-#undef ReportStaticError
-#undef MustFindFile
+    utz_snapshot_put(writer, "\n", 1, 1);
+    utz_snapshot_put(writer, footer.data, footer.length, 1);
+    utz_snapshot_put(writer, "\n", 1, 1);
+    return UTZ_TRUE;
 }
 
-void utz_free_timezones(utz_timezones* tzs, void* allocator_userdata)
+utz_usize utz_write_tzif(utz_timezone* tz, void* buffer, utz_usize buffer_size)
 {
-    for (utz_usize ci = 0; ci < UtzDynCount(tzs->countries); ci++)
-    {
-        utz_country* country = &tzs->countries[ci];
-        UtzFreeDynArray(&country->timezones);
-    }
+    utz_ensure_compiled(tz);
+    utz_snapshot_writer measure = { NULL, 0 };
+    if (!utz_write_tzif_to(tz, &measure)) return 0;
 
-    for (utz_usize zi = 0; zi < UtzDynCount(tzs->timezones); zi++)
+    if (buffer && measure.size <= buffer_size)
     {
-        utz_timezone* timezone = &tzs->timezones[zi];
-        if (timezone->alias_of) continue;
-        UtzFreeDynArray(&timezone->ranges);
+        utz_snapshot_writer writer = { (utz_u8*) buffer, 0 };
+        utz_write_tzif_to(tz, &writer);
     }
+    return measure.size;
+}
 
-    UtzFreeDynArray(&tzs->countries);
-    UtzFreeDynArray(&tzs->timezones);
+#ifndef UTZ_NO_FILESYSTEM
 
-#ifndef UTZ_NO_SPRINTF
-    UtzFree(allocator_userdata, (void*)tzs->parsing_error);
+#if !defined(_WIN32)
+  #include <dirent.h>
+  #include <sys/stat.h>
 #endif
-}
-
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////
-// Conversion
+// Writes "a/b" into out, returns false if it doesn't fit.
+static utz_bool utz_join_path(char* out, utz_usize out_size, const char* a, const char* b)
+{
+    utz_usize length = 0;
+    for (const char* c = a; *c; c++) { if (length + 1 >= out_size) return UTZ_FALSE; out[length++] = *c; }
+    if (length && *b)                { if (length + 1 >= out_size) return UTZ_FALSE; out[length++] = '/'; }
+    for (const char* c = b; *c; c++) { if (length + 1 >= out_size) return UTZ_FALSE; out[length++] = *c; }
+    out[length] = '\0';
+    return UTZ_TRUE;
+}
 
-utz_time_t utz_wall_time_from_utc(utz_timezone* tz, utz_time_t utc)
+// Reads a whole file with the allocator, NULL if it can't be read.
+static utz_u8* utz_read_file(const char* path, utz_usize* out_size, void* allocator_userdata)
 {
-    if (tz == NULL)           return utc;
-    if (utc < 0)              return utc; // We pretend there are no timezones before UNIX_EPOCH
-    if (tz->range_count == 0) return utc; // utz_timezone without ranges - this is just the "UTC" timezone.
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
 
-    utz_usize lo = 0;
-    utz_usize hi = tz->range_count;
-    while (lo < hi)
+    utz_u8* data = NULL;
+    long    size = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+    if (size >= 0 && fseek(file, 0, SEEK_SET) == 0)
     {
-        utz_usize m = lo + (hi - lo) / 2;
-
-        if (tz->ranges[m].since <= utc) lo = m + 1;
-        else                            hi = m;
+        data = UtzAllocate(allocator_userdata, utz_u8, size ? (utz_usize) size : 1);
+        if (fread(data, 1, (utz_usize) size, file) != (utz_usize) size)
+        {
+            UtzFree(allocator_userdata, data);
+            data = NULL;
+        }
     }
+    fclose(file);
 
-    // First range of all timezones must have since == UNIX_EPOCH, so a result (lo - 1) always exists.
-    UtzAssert(lo > 0);
-
-    return utc + tz->ranges[lo - 1].offset_seconds;
+    *out_size = (utz_usize)(size > 0 ? size : 0);
+    return data;
 }
 
-utz_conversion utz_utc_from_wall_time(utz_timezone* tz, utz_time_t wall_time)
+typedef struct utz_zoneinfo_name
 {
-    if (tz == NULL)
-        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
+    char name[32 + 1];
+} utz_zoneinfo_name;
 
-    if (wall_time < 24 * 60 * 60)
-        return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };  // too close to zero, might underflow
+#if !defined(_WIN32)
+// Appends the names of all files under directory/relative. Names that can't be timezone names are skipped.
+static void utz_list_zoneinfo(const char* directory, const char* relative, utz_zoneinfo_name** names, utz_usize depth, void* allocator_userdata)
+{
+    char path[4096];
+    if (!utz_join_path(path, sizeof(path), directory, relative)) return;
 
-    for (utz_usize i = 0; i < tz->range_count; i++)
+    DIR* dir = opendir(path);
+    if (!dir) return;
+
+    while (struct dirent* entry = readdir(dir))
     {
-        utz_time_range* current = &tz->ranges[i];
-        utz_time_range* next    = (i + 1 < tz->range_count) ? &tz->ranges[i + 1] : NULL;
+        if (entry->d_name[0] == '.') continue;
+
+        // The same tree again, with leap seconds or a different default. Nobody wants those twice.
+        if (depth == 0 && (utz_equals(UtzStr("posix"), entry->d_name) || utz_equals(UtzStr("right"), entry->d_name))) continue;
+
+        char name[4096], full[4096];
+        struct stat info;
+        if (!utz_join_path(name, sizeof(name), relative, entry->d_name)) continue;
+        if (!utz_join_path(full, sizeof(full), directory, name))         continue;
+        if (stat(full, &info) != 0)                                       continue;
 
-        utz_time_t to  = next ? next->since : UtzMaxValue(utz_time_t); // :File_Time_Sign
-        utz_time_t utc = wall_time - current->offset_seconds;
+        if (S_ISDIR(info.st_mode))
+        {
+            if (depth < 4) utz_list_zoneinfo(directory, name, names, depth + 1, allocator_userdata);
+            continue;
+        }
+
+        utz_zoneinfo_name zone_name;
+        if (S_ISREG(info.st_mode) && utz_join_path(zone_name.name, sizeof(zone_name.name), name, ""))
+            UtzDynAppend(utz_zoneinfo_name, names, &zone_name);
+    }
+    closedir(dir);
+}
+#endif
 
-        // Exact moment of changing a range belongs to current.
-        // Because of this, both wall times when clocks go forward are not treated as invalid,
-        // and both times when clocks go backwards are treated as ambiguous.
-        if (utc > to) continue;
+int utz_load_tzif_directory(utz_timezones* tzs, const char* directory, const char* const* names, utz_usize name_count,
+                            void* allocator_userdata, unsigned flags)
+{
+    *tzs = UtzInit;
 
-        if (next)
+    // Without names, every file in the tree is a candidate and the ones that aren't TZif (zone.tab, ...) are skipped.
+    utz_zoneinfo_name* listed = NULL;
+    if (!names)
+    {
+#if !defined(_WIN32)
+        UtzMakeDynArray(utz_zoneinfo_name, &listed, 256);
+        utz_list_zoneinfo(directory, "", &listed, 0, allocator_userdata);
+        name_count = UtzDynCount(listed);
+        if (!name_count)
         {
-            utz_time_t utc_with_next = wall_time - next->offset_seconds;
-            // We belong in both current and next (ambiguity).
-            if (utc_with_next >= to)
-                return { UTZ_TIMESTAMP_CONVERSION_INPUT_AMBIGUOUS, utc, utc_with_next, utc };
+            UtzFreeDynArray(&listed);
+            return utz_tzif_error(tzs, directory, "No files found in the zoneinfo directory.", allocator_userdata);
         }
+#else
+        return utz_tzif_error(tzs, directory, "Listing zoneinfo directories isn't supported on Windows, pass the names to load.", allocator_userdata);
+#endif
+    }
+
+    utz_tzif_file* files      = UtzAllocate(allocator_userdata, utz_tzif_file, name_count ? name_count : 1);
+    utz_usize      file_count = 0;
+    const char*    failed     = NULL;
+    for (utz_usize i = 0; i < name_count && !failed; i++)
+    {
+        const char* name = listed ? listed[i].name : names[i];
+
+        char path[4096];
+        utz_usize size = 0;
+        utz_u8*   data = utz_join_path(path, sizeof(path), directory, name) ? utz_read_file(path, &size, allocator_userdata) : NULL;
+        if (!data && !listed) failed = name;
+        if (!data) continue;
 
-        if (utc < current->since)
+        if (listed && (size < 4 || data[0] != 'T' || data[1] != 'Z' || data[2] != 'i' || data[3] != 'f'))
         {
-            // Wall time is invalid.
-            if (i == 0)
-            {
-                // It's invalid for us to be in the first range, but the range starts at UNIX_EPOCH.
-                // We ignore timezones prior to UNIX_EPOCH, return input as UTC.
-                return { UTZ_TIMESTAMP_CONVERSION_OK, wall_time, wall_time, wall_time };
-            }
-            else
-            {
-                utz_time_range* previous = &tz->ranges[i - 1];
-                utz_time_t utc_with_previous = wall_time - previous->offset_seconds;
-                return { UTZ_TIMESTAMP_CONVERSION_INPUT_INVALID, utc, utc_with_previous, current->since };
-            }
+            UtzFree(allocator_userdata, data);
+            continue;
         }
 
-        return { UTZ_TIMESTAMP_CONVERSION_OK, utc, utc, utc };
+        files[file_count].name = name;
+        files[file_count].data = data;
+        files[file_count].size = size;
+        file_count++;
     }
 
-    UtzAssert(0 && "Unreachable code");
-    utz_conversion ret = {(utz_conversion_status) 0};
-    return ret;
+    int result = failed ? utz_tzif_error(tzs, failed, "Can't read the file.", allocator_userdata)
+                        : utz_load_tzif(tzs, files, file_count, allocator_userdata, flags);
+
+    for (utz_usize i = 0; i < file_count; i++)
+        UtzFree(allocator_userdata, (void*) files[i].data);
+    UtzFree(allocator_userdata, files);
+    UtzFreeDynArray(&listed);
+    return result;
 }
 
+#endif // UTZ_NO_FILESYSTEM
+
+#undef UTZ_TZIF_HEADER_SIZE
+#undef UTZ_TZIF_MAX_TYPES
+
+
 utz_timezone* utz_default_tz_for_country(utz_timezones* tzs, const char* country_code)
 {
-    for (utz_usize ci = 0; ci < tzs->country_count; ci++)
-    {
-        if (!utz_equals(UtzStr(tzs->countries[ci].code), country_code)) continue;
-        return tzs->countries[ci].timezone_count ? tzs->countries[ci].timezones[0] : NULL;
-    }
-    return NULL;
+    utz_usize     index = utz_country_code_index(country_code);
+    utz_timezone* tz    = (index < UtzArrayCount(tzs->country_default_timezones)) ? tzs->country_default_timezones[index] : NULL;
+    utz_ensure_compiled(tz);
+    return tz;
 }
 
 utz_bool utz_wall_time_from_utc_default_tz(utz_timezones* tzs, const char* country_code, utz_time_t utc, utz_time_t* out_wall_time)
@@ -2620,12 +6899,24 @@ utz_bool utz_utc_from_wall_time_default_tz(utz_timezones* tzs, const char* count
 #undef UtzCalloc
 #undef UtzRealloc
 #undef UtzFree
+#undef UtzArenaAllocateBlock
+#undef UtzArenaFreeBlock
+#undef UtzAllocate
+#undef UtzReallocate
+#undef UtzNanoseconds
+#undef UTZ_THREAD_LOCAL
 #undef UtzSprintf
+#undef UtzAtomicLoadAcquire
+#undef UtzAtomicStoreRelease
+#undef UtzAtomicCompareExchange
+#undef UtzAtomicFetchAdd
 #undef UtzAssert
 
 #undef UTZ_TRUE
 #undef UTZ_FALSE
 #undef UtzArrayCount
+#undef UtzCopyArray
+#undef UtzOffsetOf
 #undef UtzInit
 #undef UtzCtor1
 #undef UtzCtor2
@@ -2636,15 +6927,22 @@ utz_bool utz_utc_from_wall_time_default_tz(utz_timezones* tzs, const char* count
 #undef UtzMinValue
 #undef UTZ_BEGINNING_OF_TIME
 #undef UTZ_END_OF_TIME
+#undef UTZ_ARENA_ALIGN
+#undef UTZ_ARENA_DEFAULT_BLOCK_SIZE
 #undef UtzDynCapacity
 #undef UtzDynCount
 #undef UtzDynCapacityPtr
 #undef UtzDynCountPtr
 #undef UtzMakeDynArray
 #undef UtzGrowDynArray
+#undef UtzShrinkDynArray
 #undef UtzDynAppend
 #undef UtzDynGetLast
 #undef UtzFreeDynArray
+#undef UtzThreadProc
+#undef UtzThreadReturn
+#undef UtzStartThread
+#undef UtzJoinThread
 
 
 #endif